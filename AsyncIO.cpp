@@ -0,0 +1,387 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Reading and writing whole files with many requests in flight,
+ *           using io_uring on Linux or a pool of threads elsewhere.
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+
+#include "AsyncIO.h"
+#include "SObject.h"
+
+#include <wx/wx.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(S2SPICE_HAVE_IO_URING) && defined(__has_include)
+#if __has_include(<liburing.h>)
+#define USE_IO_URING
+#include <fcntl.h>
+#include <liburing.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#endif
+
+using namespace std;
+
+// Counts the requests in flight so callers wait when there are too many
+class IOBase : public AsyncIO {
+public:
+  void Flush() {
+    unique_lock<mutex> lock(countLock);
+    slotFree.wait(lock, [this] { return inFlight == 0; });
+  }
+
+protected:
+  explicit IOBase(int n) : depth(max(1, n)), inFlight(0) {}
+  void Acquire() {
+    unique_lock<mutex> lock(countLock);
+    slotFree.wait(lock, [this] { return inFlight < depth; });
+    inFlight++;
+  }
+  void Release() {
+    lock_guard<mutex> lock(countLock);
+    inFlight--;
+    slotFree.notify_all();
+  }
+
+  int depth;
+
+private:
+  mutex countLock;
+  condition_variable slotFree;
+  int inFlight;
+};
+
+// The portable backend: depth threads doing blocking reads and writes
+class ThreadIO : public IOBase {
+public:
+  explicit ThreadIO(int n) : IOBase(n), stopping(false) {
+    for (int i = 0; i < depth; i++) pool.emplace_back(&ThreadIO::Worker, this);
+  }
+  ~ThreadIO() {
+    Flush();
+    {
+      lock_guard<mutex> lock(taskLock);
+      stopping = true;
+    }
+    taskReady.notify_all();
+    for (auto& t : pool) t.join();
+  }
+
+  const char* Name() const { return "threads"; }
+
+  void Read(const string& path, ReadDone done) {
+    Acquire();
+    Post([this, path, done] {
+      string contents;
+      int err = ReadFile(path, contents);
+      done(err, contents);
+      Release();
+    });
+  }
+
+  void Write(const string& path, string contents, WriteDone done) {
+    Acquire();
+    auto data = make_shared<string>(std::move(contents));
+    Post([this, path, data, done] {
+      done(WriteFile(path, *data));
+      Release();
+    });
+  }
+
+private:
+  void Post(function<void()> task) {
+    lock_guard<mutex> lock(taskLock);
+    tasks.push_back(std::move(task));
+    taskReady.notify_one();
+  }
+
+  void Worker() {
+    for (;;) {
+      function<void()> task;
+      {
+        unique_lock<mutex> lock(taskLock);
+        taskReady.wait(lock, [this] { return stopping || !tasks.empty(); });
+        if (tasks.empty()) return;
+        task = std::move(tasks.front());
+        tasks.pop_front();
+      }
+      task();
+    }
+  }
+
+  static int ReadFile(const string& path, string& contents) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f == NULL) return errno ? errno : EIO;
+    char buffer[64 * 1024];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+      contents.append(buffer, n);
+    int err = ferror(f) ? EIO : 0;
+    fclose(f);
+    return err;
+  }
+
+  static int WriteFile(const string& path, const string& contents) {
+    string part = PartFileName(path);
+    FILE* f = fopen(part.c_str(), "wb");
+    if (f == NULL) return errno ? errno : EIO;
+    bool ok = fwrite(contents.data(), 1, contents.size(), f) == contents.size();
+    ok = fclose(f) == 0 && ok;
+    if (ok && wxRenameFile(part, path, true)) return 0;
+    wxRemoveFile(part);
+    return EIO;
+  }
+
+  mutex taskLock;
+  condition_variable taskReady;
+  deque<function<void()>> tasks;
+  bool stopping;
+  vector<thread> pool;
+};
+
+#if defined(USE_IO_URING)
+
+// The io_uring backend.  Each request goes through its steps (open, size,
+// read or write, close, rename) one submission at a time; one thread
+// submits the next step of each request as the previous one completes.
+// New requests are handed to that thread through a list and an eventfd
+// it always has a read pending on.
+class UringIO : public IOBase {
+public:
+  explicit UringIO(int n) : IOBase(n), ok(false), stopping(false) {
+    wakeFd = eventfd(0, EFD_CLOEXEC);
+    if (wakeFd < 0) return;
+    if (io_uring_queue_init(depth + 1, &ring, 0) < 0) {
+      close(wakeFd);
+      return;
+    }
+    ok = true;
+    loop = thread(&UringIO::Loop, this);
+  }
+  ~UringIO() {
+    if (!ok) return;
+    Flush();
+    {
+      lock_guard<mutex> lock(newLock);
+      stopping = true;
+    }
+    Wake();
+    loop.join();
+    io_uring_queue_exit(&ring);
+    close(wakeFd);
+  }
+
+  bool Ok() const { return ok; }
+  const char* Name() const { return "io_uring"; }
+
+  void Read(const string& path, ReadDone done) {
+    Acquire();
+    Request* req = new Request;
+    req->write = false;
+    req->path = path;
+    req->readDone = done;
+    Start(req);
+  }
+
+  void Write(const string& path, string contents, WriteDone done) {
+    Acquire();
+    Request* req = new Request;
+    req->write = true;
+    req->path = path;
+    req->part = PartFileName(path);
+    req->data = std::move(contents);
+    req->writeDone = done;
+    Start(req);
+  }
+
+private:
+  enum Step { STEP_OPEN, STEP_SIZE, STEP_DATA, STEP_CLOSE, STEP_RENAME };
+  struct Request {
+    bool write;
+    Step step = STEP_OPEN;
+    string path, part;
+    string data;
+    size_t done = 0;  // bytes read or written
+    int fd = -1;
+    struct statx st;
+    ReadDone readDone;
+    WriteDone writeDone;
+  };
+
+  void Start(Request* req) {
+    {
+      lock_guard<mutex> lock(newLock);
+      added.push_back(req);
+    }
+    Wake();
+  }
+
+  void Wake() {
+    uint64_t one = 1;
+    while (write(wakeFd, &one, sizeof(one)) < 0 && errno == EINTR) {
+    }
+  }
+
+  // A submission for the next step of req (NULL for the eventfd)
+  io_uring_sqe* Next(Request* req) {
+    io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+    io_uring_sqe_set_data(sqe, req);
+    return sqe;
+  }
+
+  void Loop() {
+    io_uring_prep_read(Next(NULL), wakeFd, &wakeCount, sizeof(wakeCount), 0);
+    for (;;) {
+      io_uring_submit(&ring);
+      io_uring_cqe* cqe = NULL;
+      int r = io_uring_wait_cqe(&ring, &cqe);
+      if (r == -EINTR) continue;
+      if (r < 0) break;
+      Request* req = (Request*)io_uring_cqe_get_data(cqe);
+      int res = cqe->res;
+      io_uring_cqe_seen(&ring, cqe);
+      if (req != NULL) {
+        Advance(req, res);
+        continue;
+      }
+
+      // The eventfd: start the new requests
+      vector<Request*> start;
+      {
+        lock_guard<mutex> lock(newLock);
+        if (stopping) break;
+        start.swap(added);
+      }
+      for (Request* req : start) {
+        if (req->write)
+          io_uring_prep_openat(Next(req), AT_FDCWD, req->part.c_str(),
+                               O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        else
+          io_uring_prep_openat(Next(req), AT_FDCWD, req->path.c_str(),
+                               O_RDONLY | O_CLOEXEC, 0);
+      }
+      io_uring_prep_read(Next(NULL), wakeFd, &wakeCount, sizeof(wakeCount),
+                         0);
+    }
+  }
+
+  // The step of req completed with res; submit the next one
+  void Advance(Request* req, int res) {
+    if (res < 0) {
+      Finish(req, -res);
+      return;
+    }
+    switch (req->step) {
+      case STEP_OPEN:
+        req->fd = res;
+        if (!req->write) {
+          req->step = STEP_SIZE;
+          io_uring_prep_statx(Next(req), req->fd, "", AT_EMPTY_PATH,
+                              STATX_SIZE, &req->st);
+          return;
+        }
+        req->step = STEP_DATA;
+        break;
+      case STEP_SIZE:
+        req->data.resize(req->st.stx_size);
+        req->step = STEP_DATA;
+        break;
+      case STEP_DATA:
+        if (res == 0) {
+          if (req->write) {
+            Finish(req, EIO);
+            return;
+          }
+          // The file shrank while it was read
+          req->data.resize(req->done);
+        }
+        req->done += res;
+        break;
+      case STEP_CLOSE:
+        if (!req->write) {
+          Finish(req, 0);
+          return;
+        }
+        req->step = STEP_RENAME;
+        io_uring_prep_renameat(Next(req), AT_FDCWD, req->part.c_str(),
+                               AT_FDCWD, req->path.c_str(), 0);
+        return;
+      case STEP_RENAME:
+        req->part.clear();
+        Finish(req, 0);
+        return;
+    }
+
+    // Transfer the rest of the data, then close the file
+    if (req->done < req->data.size()) {
+      char* at = &req->data[0] + req->done;
+      unsigned n =
+          (unsigned)min<size_t>(req->data.size() - req->done, 1u << 30);
+      if (req->write)
+        io_uring_prep_write(Next(req), req->fd, at, n, req->done);
+      else
+        io_uring_prep_read(Next(req), req->fd, at, n, req->done);
+    } else {
+      req->step = STEP_CLOSE;
+      io_uring_prep_close(Next(req), req->fd);
+      req->fd = -1;
+    }
+  }
+
+  void Finish(Request* req, int err) {
+    if (req->fd >= 0) close(req->fd);
+    if (!req->part.empty() && err != 0) unlink(req->part.c_str());
+    if (req->write)
+      req->writeDone(err);
+    else
+      req->readDone(err, req->data);
+    delete req;
+    Release();
+  }
+
+  bool ok;
+  io_uring ring;
+  int wakeFd;
+  uint64_t wakeCount;
+  thread loop;
+  mutex newLock;
+  vector<Request*> added;  // requests not yet started
+  bool stopping;
+};
+
+#endif
+
+unique_ptr<AsyncIO> AsyncIO::Create(int depth) {
+#if defined(USE_IO_URING)
+  unique_ptr<UringIO> uring(new UringIO(depth));
+  if (uring->Ok()) return std::move(uring);
+#endif
+  return unique_ptr<AsyncIO>(new ThreadIO(depth));
+}
@@ -0,0 +1,64 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Reading and writing whole files with many requests in flight,
+ *           using io_uring on Linux or a pool of threads elsewhere.
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+#if !defined(__ASYNCIO)
+#define __ASYNCIO
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#include <functional>
+#include <memory>
+#include <string>
+
+// Reads and writes whole files in the background.  Read() and Write() wait
+// only while the maximum number of requests is in flight; their callbacks
+// run on a thread of the AsyncIO object and must not block for long.
+//
+// With io_uring (S2SPICE_HAVE_IO_URING, needs liburing) one thread drives
+// the open, read, write, close and rename of all requests, so many slow
+// (e.g. NFS) system calls overlap without a thread for each.  Without it,
+// or if the kernel refuses io_uring, a pool of threads does the same with
+// blocking calls.
+class AsyncIO {
+public:
+  // err is 0 or an errno value
+  typedef std::function<void(int err, std::string& contents)> ReadDone;
+  typedef std::function<void(int err)> WriteDone;
+
+  // An AsyncIO keeping up to depth requests in flight
+  static std::unique_ptr<AsyncIO> Create(int depth);
+  virtual ~AsyncIO() {}
+
+  virtual const char* Name() const = 0;
+  // Read the whole file at path
+  virtual void Read(const std::string& path, ReadDone done) = 0;
+  // Write contents to path; like WriteLIB() the file is written under a
+  // temporary name (PartFileName()) and renamed when complete
+  virtual void Write(const std::string& path, std::string contents,
+                     WriteDone done) = 0;
+  // Wait until all requests are done
+  virtual void Flush() = 0;
+};
+
+#endif
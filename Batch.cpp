@@ -0,0 +1,186 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Parallel conversion of a batch of files of very different
+ *           sizes (--threads).
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+
+#include "Batch.h"
+#include "stringformat.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+
+using namespace std;
+
+// Files smaller than this are converted in groups of up to groupFiles
+// files or groupBytes bytes
+static const uint64_t smallFile = 256 * 1024;
+static const size_t groupFiles = 64;
+static const uint64_t groupBytes = 1024 * 1024;
+
+// Jobs read ahead by Stream() while the previous ones are converted
+static const size_t streamChunk = 1024;
+
+BalancedBatch::BalancedBatch(int threads)
+    : scheduler(threads), seconds(0), jobCount(0), failedCount(0) {}
+
+int BalancedBatch::Run(vector<BatchJob>& jobs) {
+  auto start = chrono::steady_clock::now();
+  TaskGroup group;
+  Spawn(jobs, group);
+  scheduler.Wait(group);
+  seconds = chrono::duration<double>(chrono::steady_clock::now() - start)
+                .count();
+
+  int res = 0;
+  jobCount = jobs.size();
+  failedCount = 0;
+  for (auto& job : jobs) {
+    if (job.code == 0) continue;
+    failedCount++;
+    if (res == 0) res = job.code;
+  }
+  return res;
+}
+
+int BalancedBatch::Stream(const function<bool(BatchJob&)>& next,
+                          const function<void(const BatchJob&)>& done) {
+  auto start = chrono::steady_clock::now();
+  int res = 0;
+  jobCount = failedCount = 0;
+  // One chunk is converted while the next is read
+  vector<BatchJob> chunks[2];
+  TaskGroup groups[2];
+  auto finish = [&](int c) {
+    scheduler.Wait(groups[c]);
+    for (auto& job : chunks[c]) {
+      jobCount++;
+      if (job.code != 0) {
+        failedCount++;
+        if (res == 0) res = job.code;
+      }
+      done(job);
+    }
+    chunks[c].clear();
+  };
+  int current = 0;
+  bool more = true;
+  while (more) {
+    vector<BatchJob>& chunk = chunks[current];
+    while (chunk.size() < streamChunk) {
+      chunk.push_back(BatchJob());
+      if (!next(chunk.back())) {
+        chunk.pop_back();
+        more = false;
+        break;
+      }
+    }
+    Spawn(chunk, groups[current]);
+    current ^= 1;
+    finish(current);
+  }
+  finish(current ^ 1);
+  seconds = chrono::duration<double>(chrono::steady_clock::now() - start)
+                .count();
+  return res;
+}
+
+void BalancedBatch::Spawn(vector<BatchJob>& jobs, TaskGroup& group) {
+  vector<uint64_t> sizes(jobs.size());
+  for (size_t i = 0; i < jobs.size(); i++) {
+    wxULongLong size = jobs[i].file.GetSize();
+    sizes[i] = size == wxInvalidSize ? 0 : size.GetValue();
+  }
+  // Largest first, so the big files are not left for the end
+  vector<size_t> order(jobs.size());
+  iota(order.begin(), order.end(), 0);
+  stable_sort(order.begin(), order.end(),
+              [&](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+
+  vector<size_t> small;
+  uint64_t smallBytes = 0;
+  auto spawnSmall = [&] {
+    if (small.empty()) return;
+    scheduler.Spawn(group, [this, &jobs, small] {
+      for (size_t i : small) Convert(jobs[i]);
+    });
+    small.clear();
+    smallBytes = 0;
+  };
+  for (size_t i : order) {
+    if (sizes[i] >= smallFile) {
+      scheduler.Spawn(group, [this, &jobs, i] { Convert(jobs[i]); });
+      continue;
+    }
+    small.push_back(i);
+    smallBytes += sizes[i];
+    if (small.size() >= groupFiles || smallBytes >= groupBytes) spawnSmall();
+  }
+  spawnSmall();
+}
+
+void BalancedBatch::Convert(BatchJob& job) {
+  // A thread may convert a file while waiting for the tasks of another,
+  // so the previous log target is put back afterwards
+  JobLog log;
+  wxLog* previous = wxLog::SetThreadActiveTarget(&log);
+  auto start = chrono::steady_clock::now();
+  SObject SD;
+  SD.SetQuiet(false);
+  SD.SetForce(job.force);
+  SD.SetScheduler(&scheduler);
+  job.code = ConvertFile(SD, job.file, job.opts);
+  job.seconds = chrono::duration<double>(chrono::steady_clock::now() - start)
+                    .count();
+  job.messages = log.messages;
+  wxLog::SetThreadActiveTarget(previous);
+}
+
+void BalancedBatch::WriteReport(ostream& out,
+                                const vector<BatchJob>& jobs) const {
+  for (auto& job : jobs) {
+    if (job.code != 0) WriteFailure(out, job);
+  }
+  WriteSummary(out);
+}
+
+void BalancedBatch::WriteFailure(ostream& out, const BatchJob& job) {
+  out << stringFormat("%s failed (%d)\n",
+                      job.file.GetFullPath().ToStdString(), job.code);
+  for (size_t i = 0; i < job.messages.GetCount(); i++)
+    out << "  " << job.messages[i] << "\n";
+}
+
+void BalancedBatch::WriteSummary(ostream& out) const {
+  out << stringFormat("batch: %d files on %d threads in %.3f s, %d failed\n",
+                      (int)jobCount, scheduler.Threads(), seconds,
+                      (int)failedCount);
+  out << "thread   tasks  stolen   busy\n";
+  vector<TaskScheduler::WorkerStats> stats = scheduler.Stats();
+  for (size_t i = 0; i < stats.size(); i++) {
+    string name = i + 1 < stats.size() ? stringFormat("%d", (int)i + 1)
+                                       : string("main");
+    double busy = seconds > 0 ? 100 * stats[i].busy / seconds : 0;
+    out << stringFormat("%-6s %7d %7d %5.1f%%\n", name, (int)stats[i].run,
+                        (int)stats[i].stolen, busy);
+  }
+}
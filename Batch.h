@@ -0,0 +1,83 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Parallel conversion of a batch of files of very different
+ *           sizes (--threads).
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+#if !defined(__BATCH)
+#define __BATCH
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#include "Convert.h"
+#include "Scheduler.h"
+
+#include <functional>
+#include <ostream>
+#include <vector>
+
+// One file of a batch and what became of it
+struct BatchJob {
+  wxFileName file;
+  ConvertOptions opts;
+  bool force = false;
+  int code = 0;  // 0 or the exit code of ConvertFile()
+  double seconds = 0;
+  wxArrayString messages;
+};
+
+// Converts a batch on a work-stealing scheduler.  Big files are started
+// first and split their work into tasks (see SObject::SetScheduler()) that
+// idle workers steal, while small files are converted in groups so the
+// cost of a task is spread over several of them.
+class BalancedBatch {
+public:
+  // threads <= 0 uses one thread per CPU
+  explicit BalancedBatch(int threads);
+
+  // Convert all jobs, continuing after failures.  Returns 0 or the exit
+  // code of the first job (in the given order) that failed.
+  int Run(std::vector<BatchJob>& jobs);
+
+  // Convert the jobs that next() fills in until it returns false, without
+  // holding more than two chunks of them at once, and hand every finished
+  // job to done() in the order they were read.  Returns like Run().
+  int Stream(const std::function<bool(BatchJob&)>& next,
+             const std::function<void(const BatchJob&)>& done);
+
+  // The failed jobs with their messages and what each thread did
+  void WriteReport(std::ostream& out,
+                   const std::vector<BatchJob>& jobs) const;
+  // The same without the list of failures
+  void WriteSummary(std::ostream& out) const;
+  static void WriteFailure(std::ostream& out, const BatchJob& job);
+
+private:
+  // Start converting jobs, biggest files first
+  void Spawn(std::vector<BatchJob>& jobs, TaskGroup& group);
+  void Convert(BatchJob& job);
+
+  TaskScheduler scheduler;
+  double seconds;
+  size_t jobCount, failedCount;
+};
+
+#endif
@@ -0,0 +1,111 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Bounded lock-free queue connecting the stages of the batch
+ *           pipeline.
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+#if !defined(__BOUNDEDQUEUE)
+#define __BOUNDEDQUEUE
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+// Multi-producer multi-consumer queue of fixed capacity (a power of two).
+// Each slot carries a sequence number telling whether it is free for the
+// producer of a given position or full for its consumer, so pushing and
+// popping only take one compare-and-swap and never block.  Callers decide
+// how to wait when TryPush() or TryPop() fails.
+template <typename T>
+class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity) {
+    size_t n = 2;
+    while (n < capacity) n *= 2;
+    mask = n - 1;
+    slots.reset(new Slot[n]);
+    for (size_t i = 0; i < n; i++)
+      slots[i].seq.store(i, std::memory_order_relaxed);
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+  }
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+  // false if the queue is full
+  bool TryPush(const T& value) {
+    size_t pos = tail.load(std::memory_order_relaxed);
+    for (;;) {
+      Slot& slot = slots[pos & mask];
+      size_t seq = slot.seq.load(std::memory_order_acquire);
+      ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)pos;
+      if (diff == 0) {
+        if (tail.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed)) {
+          slot.value = value;
+          slot.seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = tail.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // false if the queue is empty
+  bool TryPop(T& value) {
+    size_t pos = head.load(std::memory_order_relaxed);
+    for (;;) {
+      Slot& slot = slots[pos & mask];
+      size_t seq = slot.seq.load(std::memory_order_acquire);
+      ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)(pos + 1);
+      if (diff == 0) {
+        if (head.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed)) {
+          value = slot.value;
+          slot.seq.store(pos + mask + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = head.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+private:
+  struct Slot {
+    std::atomic<size_t> seq;
+    T value;
+  };
+  std::unique_ptr<Slot[]> slots;
+  size_t mask;
+  // Producers and consumers work on separate cache lines
+  alignas(64) std::atomic<size_t> tail;
+  alignas(64) std::atomic<size_t> head;
+};
+
+#endif
@@ -0,0 +1,185 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Cascade and de-embedding of several files into one model
+ *           (--cascade).
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+
+#include "Cascade.h"
+#include "Resample.h"
+#include "Scheduler.h"
+#include "Trace.h"
+#include "stringformat.hpp"
+
+#include <memory>
+
+using namespace std;
+
+// Frequencies chained by one task
+static const size_t blockRecords = 256;
+
+CascadeStage ParseCascadeStage(const wxString& arg) {
+  CascadeStage stage;
+  wxString name;
+  stage.deembed = arg.StartsWith("inv:", &name);
+  stage.file = wxFileName(stage.deembed ? name : arg);
+  return stage;
+}
+
+// The T-parameters of the 2n-port S, [b1; a1] = T [a2; b2] for the waves of
+// the left (1) and right (2) ports, so the T of a chain is the product of
+// those of its stages.  false if S21 is singular.
+static bool SToT(const MatrixXcd& S, int n, MatrixXcd& T) {
+  FullPivLU<MatrixXcd> lu(S.bottomLeftCorner(n, n));
+  if (!lu.isInvertible()) return false;
+  MatrixXcd inv21 = lu.inverse();
+  T.resize(2 * n, 2 * n);
+  T.topRightCorner(n, n) = S.topLeftCorner(n, n) * inv21;
+  T.bottomLeftCorner(n, n) = -inv21 * S.bottomRightCorner(n, n);
+  T.bottomRightCorner(n, n) = inv21;
+  T.topLeftCorner(n, n) =
+      S.topRightCorner(n, n) + S.topLeftCorner(n, n) * T.bottomLeftCorner(n, n);
+  return true;
+}
+
+// And back; false if T22 is singular
+static bool TToS(const MatrixXcd& T, int n, MatrixXcd& S) {
+  FullPivLU<MatrixXcd> lu(T.bottomRightCorner(n, n));
+  if (!lu.isInvertible()) return false;
+  MatrixXcd inv22 = lu.inverse();
+  S.resize(2 * n, 2 * n);
+  S.bottomLeftCorner(n, n) = inv22;
+  S.bottomRightCorner(n, n) = -inv22 * T.bottomLeftCorner(n, n);
+  S.topLeftCorner(n, n) = T.topRightCorner(n, n) * inv22;
+  S.topRightCorner(n, n) =
+      T.topLeftCorner(n, n) + T.topRightCorner(n, n) * S.bottomRightCorner(n, n);
+  return true;
+}
+
+bool CascadeData(const vector<CascadeStage>& stages,
+                 const vector<vector<Sparam>>& sets, int ports,
+                 vector<Sparam>& result, string& error,
+                 TaskScheduler* scheduler) {
+  result.clear();
+  const int n = ports / 2;
+  const size_t nFreq = sets.empty() ? 0 : sets[0].size();
+  result.assign(nFreq, Sparam((size_t)ports));
+  // The stage (1 based) that cannot be chained at each frequency, or -1 if
+  // the chain cannot be converted back to S-parameters
+  vector<int> failed(nFreq, 0);
+  auto body = [&](size_t begin, size_t end) {
+    vector<MatrixXcd> chain(end - begin,
+                            MatrixXcd::Identity(2 * n, 2 * n));
+    vector<MatrixXcd> S(end - begin);
+    MatrixXcd T;
+    for (size_t s = 0; s < stages.size(); s++) {
+      for (size_t k = 0; k < chain.size(); k++) {
+        if (failed[begin + k] != 0) continue;
+        if (!SToT(sets[s][begin + k].Scplx(), n, T)) {
+          failed[begin + k] = (int)s + 1;
+          continue;
+        }
+        if (stages[s].deembed) {
+          FullPivLU<MatrixXcd> lu(T);
+          if (!lu.isInvertible()) {
+            failed[begin + k] = (int)s + 1;
+            continue;
+          }
+          T = lu.inverse();
+        }
+        chain[k] = chain[k] * T;
+      }
+    }
+    for (size_t k = 0; k < chain.size(); k++) {
+      if (failed[begin + k] != 0) continue;
+      if (!TToS(chain[k], n, S[k])) {
+        failed[begin + k] = -1;
+        continue;
+      }
+      result[begin + k].Freq = sets[0][begin + k].Freq;
+      result[begin + k].cplxStore(S[k]);
+    }
+  };
+  if (scheduler != NULL)
+    scheduler->ParallelFor(nFreq, blockRecords, body);
+  else
+    body(0, nFreq);
+  for (size_t k = 0; k < nFreq; k++) {
+    if (failed[k] == 0) continue;
+    if (failed[k] < 0)
+      error = stringFormat("the chain has no transmission at %g Hz",
+                           sets[0][k].Freq);
+    else
+      error = stringFormat(
+          "%s has no transmission at %g Hz",
+          stages[failed[k] - 1].file.GetFullPath().ToStdString(),
+          sets[0][k].Freq);
+    result.clear();
+    return false;
+  }
+  return true;
+}
+
+int CascadeFiles(const vector<CascadeStage>& stages, const wxFileName& out,
+                 const ConvertOptions& opts, SObject& result) {
+  TRACE_SCOPE("cascade", out.GetFullPath().ToStdString());
+  vector<wxFileName> names;
+  for (auto& stage : stages) names.push_back(stage.file);
+  vector<unique_ptr<SObject>> files;
+  vector<vector<Sparam>> sets;
+  string error;
+  if (stages.empty()) {
+    error = "no files given";
+  } else {
+    int res = ReadResampled(names, opts, result, files, sets, error);
+    if (res != 0 && res != 11) return res;
+  }
+  if (error.empty() && files[0]->nPorts() % 2 != 0)
+    error = stringFormat("%s has %d ports, not two sides of equally many",
+                         files[0]->getSNPfile().GetFullPath().ToStdString(),
+                         files[0]->nPorts());
+  vector<Sparam> chain;
+  if (error.empty()) {
+    TRACE_SCOPE("chain");
+    CascadeData(stages, sets, files[0]->nPorts(), chain, error,
+                result.GetScheduler());
+  }
+  if (!error.empty()) {
+    wxString mess =
+        wxString::Format(_("%s:%d Cannot cascade the files into %s: %s."),
+                         __FILE__, __LINE__, out.GetFullPath(), error);
+    HandleMessage(mess, result.GetQuiet());
+    return 11;
+  }
+
+  wxArrayString comments;
+  comments.Add("! Cascade of");
+  for (auto& stage : stages) {
+    comments.Add("!   " + stage.file.GetFullPath() +
+                 (stage.deembed ? " (de-embedded)" : ""));
+  }
+  result.SetOutputOptions(opts.output);
+  if (!result.SetData(out, *files[0], files[0]->nPorts(), chain, comments))
+    return 1;
+  ConvertOptions write = opts;
+  write.lib = true;
+  write.stream = false;
+  return WriteOutputs(result, write);
+}
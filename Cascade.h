@@ -0,0 +1,67 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Cascade and de-embedding of several files into one model
+ *           (--cascade).
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+#if !defined(__CASCADE)
+#define __CASCADE
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#include "Convert.h"
+
+#include <string>
+#include <vector>
+
+class TaskScheduler;
+
+// One file of a cascade.  Each file is a 2N-port with ports 1..N on the
+// left, towards the previous file, and N+1..2N on the right, towards the
+// next one.
+struct CascadeStage {
+  wxFileName file;
+  bool deembed = false;  // take the file out of the chain instead
+};
+
+// A file name of the command line; "inv:name" de-embeds name
+CascadeStage ParseCascadeStage(const wxString& arg);
+
+// The S-parameters of the chain of stages with the data sets sets, all at
+// the same frequencies (see ReadResampled()).  The T-parameters of the
+// stages, inverted for the de-embedded ones, are multiplied for blocks of
+// frequencies at a time, as tasks of scheduler if given.  Returns false
+// with the reason in error.
+bool CascadeData(const std::vector<CascadeStage>& stages,
+                 const std::vector<std::vector<Sparam>>& sets, int ports,
+                 std::vector<Sparam>& result, std::string& error,
+                 TaskScheduler* scheduler);
+
+// Read the files of stages and chain them into result, as if read from out,
+// and write its outputs as opts asks (the LIB file always).  Returns 0 or
+// the exit code: 1 if a file cannot be read or the chain cannot be
+// converted as opts asks, 11 if the files cannot be chained or else that of
+// WriteOutputs().
+int CascadeFiles(const std::vector<CascadeStage>& stages,
+                 const wxFileName& out, const ConvertOptions& opts,
+                 SObject& result);
+
+#endif
@@ -0,0 +1,193 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ *
+ * Project:  S2spice
+ * Purpose:  Causality check of S-parameter data (--causality).
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+
+#include "Causality.h"
+#include "Scheduler.h"
+#include "Spectrum.h"
+#include "stringformat.hpp"
+
+#include <unsupported/Eigen/FFT>
+#include <algorithm>
+#include <mutex>
+
+using namespace std;
+
+// Bands are only reported where the taper is at least this
+static const double judgedTaper = 0.1;
+// Samples just before t = 0 that still belong to the response at t = 0
+static const size_t guardSamples = 3;
+// Bands closer than this many grid steps are reported as one
+static const size_t bandGap = 2;
+// Steps and relative residual of the causal guess below the first
+// frequency
+static const int extendSteps = 100;
+static const double extendTolerance = 1e-6;
+
+// The causal part of the tapered spectrum s: the transform of its impulse
+// response at t >= 0 and the guard before it.  before and total are the
+// energies of the response before t = 0 and in all.
+static Spectrum CausalPart(Eigen::FFT<double>& fft, const Spectrum& s,
+                           double& before, double& total) {
+  vector<double> h = InverseHalfSpectrum(fft, s);
+  const size_t n = h.size();
+  before = total = 0;
+  for (size_t t = 0; t < n; t++) {
+    total += h[t] * h[t];
+    if (t < n / 2 || t >= n - guardSamples) continue;
+    before += h[t] * h[t];
+    h[t] = t == n / 2 ? h[t] / 2 : 0;
+  }
+  return ForwardHalfSpectrum(fft, h);
+}
+
+// The part of s before t = 0, at the frequencies below known
+static Spectrum NonCausalBelow(Eigen::FFT<double>& fft, const Spectrum& s,
+                               size_t known) {
+  double before, total;
+  Spectrum causal = CausalPart(fft, s, before, total);
+  Spectrum res(known);
+  for (size_t k = 0; k < known; k++) res[k] = s[k] - causal[k];
+  return res;
+}
+
+// The inner product of two spectra below known that matches the energy of
+// their time signals: the frequencies above DC count twice
+static double Dot(const Spectrum& a, const Spectrum& b) {
+  double res = 0;
+  for (size_t k = 0; k < a.size(); k++)
+    res += (k == 0 ? 1 : 2) * (conj(a[k]) * b[k]).real();
+  return res;
+}
+
+// Below the first frequency of the data, s holds a guess.  If the guess is
+// not causal itself, the data look non-causal far above it, so it is
+// replaced by the one that leaves the least of s before t = 0.  That is a
+// linear least squares problem, solved by conjugate gradients with two FFTs
+// per step.
+static void ExtendCausally(Eigen::FFT<double>& fft, Spectrum& s,
+                           size_t known) {
+  if (known == 0) return;
+  Spectrum r = NonCausalBelow(fft, s, known);
+  for (auto& v : r) v = -v;
+  Spectrum p = r;
+  double rr = Dot(r, r);
+  const double goal = rr * extendTolerance * extendTolerance;
+  Spectrum probe(s.size());
+  for (int step = 0; step < extendSteps && rr > goal && rr > 0; step++) {
+    copy(p.begin(), p.end(), probe.begin());
+    Spectrum Ap = NonCausalBelow(fft, probe, known);
+    double pAp = Dot(p, Ap);
+    if (pAp <= 0) break;
+    double alpha = rr / pAp;
+    for (size_t k = 0; k < known; k++) {
+      s[k] += alpha * p[k];
+      r[k] -= alpha * Ap[k];
+    }
+    double rrNext = Dot(r, r);
+    for (size_t k = 0; k < known; k++) p[k] = r[k] + rrNext / rr * p[k];
+    rr = rrNext;
+  }
+}
+
+static PairCausality CheckPair(Eigen::FFT<double>& fft,
+                               const vector<Sparam>& data, int i, int j,
+                               double tol, const vector<double>& taper) {
+  const size_t points = taper.size();
+  const double fStep = data.back().Freq / (points - 1);
+  PairCausality res;
+  res.i = i;
+  res.j = j;
+  Spectrum s = UniformSpectrum(data, i, j, points);
+  double peak = 0;
+  size_t known = points;  // the first frequency of the grid with data
+  for (size_t k = 0; k < points; k++) {
+    peak = max(peak, abs(s[k]));
+    s[k] *= taper[k];
+    if (known == points && k * fStep >= data.front().Freq) known = k;
+  }
+  ExtendCausally(fft, s, known);
+  double before, total;
+  Spectrum causal = CausalPart(fft, s, before, total);
+  res.energy = total > 0 ? before / total : 0;
+  size_t lastBad = 0;
+  for (size_t k = 0; k < points; k++) {
+    double w = taper[k];
+    if (w < judgedTaper) break;
+    // Below the first frequency the data are made up
+    if (k < known) continue;
+    if (abs(s[k] - causal[k]) / w <= tol * peak) continue;
+    if (!res.bands.empty() && k - lastBad <= bandGap)
+      res.bands.back().second = k * fStep;
+    else
+      res.bands.push_back(make_pair(k * fStep, k * fStep));
+    lastBad = k;
+  }
+  return res;
+}
+
+vector<PairCausality> CheckCausality(const vector<Sparam>& data, int ports,
+                                     double tol, TaskScheduler* scheduler) {
+  vector<PairCausality> res;
+  if (data.size() < 2) return res;
+  const size_t points = SpectrumPoints(data);
+  const size_t nPairs = (size_t)ports * ports;
+  // Tapering the whole band keeps the response to the data at t = 0 within
+  // a few samples, so advances as short as one period of the last
+  // frequency are found
+  const vector<double> taper = SpectrumTaper(points);
+  vector<PairCausality> pairs(nPairs);
+  auto body = [&](size_t begin, size_t end) {
+    Eigen::FFT<double> fft;
+    for (size_t p = begin; p < end; p++)
+      pairs[p] = CheckPair(fft, data, (int)(p / ports), (int)(p % ports), tol,
+                           taper);
+  };
+  if (scheduler != NULL)
+    scheduler->ParallelFor(nPairs, 1, body);
+  else
+    body(0, nPairs);
+  for (auto& p : pairs) {
+    if (!p.bands.empty()) res.push_back(p);
+  }
+  stable_sort(res.begin(), res.end(),
+              [](const PairCausality& a, const PairCausality& b) {
+                return a.energy > b.energy;
+              });
+  return res;
+}
+
+string DescribeCausality(const PairCausality& pair) {
+  string res = stringFormat(
+      "S%d%d: %.2g%% of the impulse response before t = 0, not causal at",
+      pair.i + 1, pair.j + 1, 100 * pair.energy);
+  for (size_t b = 0; b < pair.bands.size(); b++) {
+    res += b == 0 ? " " : ", ";
+    if (pair.bands[b].first == pair.bands[b].second)
+      res += stringFormat("%.4g GHz", pair.bands[b].first / 1e9);
+    else
+      res += stringFormat("%.4g-%.4g GHz", pair.bands[b].first / 1e9,
+                          pair.bands[b].second / 1e9);
+  }
+  return res;
+}
@@ -0,0 +1,66 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ *
+ * Project:  S2spice
+ * Purpose:  Causality check of S-parameter data (--causality).
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+#if !defined(__CAUSALITY)
+#define __CAUSALITY
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#include "SObject.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+class TaskScheduler;
+
+// How causal one S_ij is
+struct PairCausality {
+  int i = 0, j = 0;
+  // Fraction of the energy of the impulse response before t = 0
+  double energy = 0;
+  // Frequency ranges (Hz) where the data differ from the causal part of
+  // the impulse response by more than the tolerance
+  std::vector<std::pair<double, double>> bands;
+};
+
+// The Kramers-Kronig relations tie the real and imaginary parts of a
+// causal response together.  They are checked with FFTs: each S_ij is
+// resampled from DC, tapered towards the last frequency, transformed to
+// its impulse response and compared with the transform of the part of
+// that response at t >= 0.  Below the first frequency the spectrum is the
+// one that leaves the least of the response before t = 0, and it is not
+// judged, nor is the last fifth of the band where the taper is small.
+// Pairs are checked as tasks of scheduler if given.  Returns the pairs
+// with bands where the difference exceeds tol times the largest |S_ij|,
+// worst first.
+std::vector<PairCausality> CheckCausality(const std::vector<Sparam>& data,
+                                          int ports, double tol,
+                                          TaskScheduler* scheduler);
+
+// One line for a pair, e.g. "S21: 1.2% of the impulse response before
+// t = 0, not causal at 2.1-2.4 GHz"
+std::string DescribeCausality(const PairCausality& pair);
+
+#endif
@@ -0,0 +1,275 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Conversion of one file as done by the command line, the GUI
+ *           queue and the server.
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+
+#include "Convert.h"
+#include "Causality.h"
+#include "TimeDomain.h"
+#include "Trace.h"
+
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+bool IsTouchstoneFile(const wxFileName& file) {
+  wxString ext = file.GetExt().Lower();
+  if (ext == "ts") return true;
+  if (ext.length() < 3 || !wxIsalpha(ext[0]) || ext.Last() != 'p')
+    return false;
+  for (size_t i = 1; i + 1 < ext.length(); i++) {
+    if (!wxIsdigit(ext[i])) return false;
+  }
+  return true;
+}
+
+int CheckOptions(const ConvertOptions& opts, string& why) {
+  const string& format = opts.output.timeDomain;
+  if (!format.empty() && format != "csv" && format != "bin") {
+    why = "time domain format '" + format + "' unknown, use csv or bin";
+    return 12;
+  }
+  if (!format.empty() && opts.stream) {
+    why = "the time domain needs the data in memory, so not with --stream";
+    return 12;
+  }
+  if (opts.output.causality > 0 && opts.stream) {
+    why = "the causality check needs the data in memory, so not with "
+          "--stream";
+    return 12;
+  }
+  return 0;
+}
+
+// CheckOptions() for SFile, with the reason as the message of SD
+static int OptionsFailed(SObject& SD, const wxFileName& SFile,
+                         const ConvertOptions& opts) {
+  string why;
+  int res = CheckOptions(opts, why);
+  if (res != 0) {
+    wxString mess = wxString::Format(_("%s:%d Cannot convert %s: %s."),
+                                     __FILE__, __LINE__,
+                                     SFile.GetFullPath().c_str(),
+                                     wxString(why));
+    HandleMessage(mess, SD.GetQuiet());
+  }
+  return res;
+}
+
+int ConvertFile(SObject& SD, wxFileName& SFile, const ConvertOptions& opts) {
+  TRACE_SCOPE("file", SFile.GetFullPath().ToStdString());
+  int res = ReadInput(SD, SFile, opts);
+  if (res != 0) return res;
+  return WriteOutputs(SD, opts);
+}
+
+int ReadInput(SObject& SD, wxFileName& SFile, const ConvertOptions& opts,
+              const std::string* contents) {
+  // Streaming writes the LIB file right away
+  int res = OptionsFailed(SD, SFile, opts);
+  if (res != 0) return res;
+  SD.SetOutputOptions(opts.output);
+  if (opts.stream) {
+    if (!SD.StreamLIB(SFile)) {
+      wxString mess = wxString::Format(
+          _("%s:%d LIB file %s not created."), __FILE__, __LINE__,
+          SD.getLIBfile().GetFullPath().c_str());
+      HandleMessage(mess, SD.GetQuiet());
+      return 5;
+    }
+  } else if (contents != NULL
+                 ? !SD.readSFile(SFile, contents->data(), contents->size())
+                 : !SD.readSFile(SFile)) {
+    wxString mess =
+        wxString::Format(_("%s:%d S-parameter file %s could not be read."), __FILE__,
+                         __LINE__, SFile.GetFullPath().c_str());
+    HandleMessage(mess, SD.GetQuiet());
+    return 1;
+  }
+  return 0;
+}
+
+// Warn about data that make the LIB model ring or diverge in transient
+// simulations.  The LIB file is written anyway.
+static void WarnIfNotCausal(SObject& SD, const ConvertOptions& opts) {
+  if (opts.output.causality <= 0) return;
+  TRACE_SCOPE("causality");
+  vector<PairCausality> pairs =
+      CheckCausality(SD.getSData(), SD.nPorts(), opts.output.causality,
+                     SD.GetScheduler());
+  if (pairs.empty()) return;
+  wxString mess = wxString::Format(
+      _("%s:%d WARNING: %d of the S-parameters of %s are not causal:"),
+      __FILE__, __LINE__, (int)pairs.size(),
+      SD.getSNPfile().GetFullPath().c_str());
+  for (auto& p : pairs) mess += "\n  " + DescribeCausality(p);
+  HandleWarning(mess, SD.GetQuiet());
+}
+
+// The impulse and step responses go next to the LIB file, e.g. amp.td.csv
+static wxFileName TimeDomainFile(SObject& SD, const ConvertOptions& opts) {
+  wxFileName file = SD.getLIBfile();
+  file.SetExt("td." + opts.output.timeDomain);
+  return file;
+}
+
+// The format and stream were checked by OptionsFailed()
+static void FormatTimeDomain(SObject& SD, const ConvertOptions& opts,
+                             string& contents) {
+  const string& format = opts.output.timeDomain;
+  TRACE_SCOPE("time domain");
+  TimeResponses responses =
+      TimeDomain(SD.getSData(), SD.nPorts(), SD.GetScheduler());
+  ostringstream out;
+  if (format == "csv")
+    WriteTimeCSV(out, responses, SD.Zref());
+  else
+    WriteTimeBinary(out, responses);
+  contents = out.str();
+}
+
+static bool TimeDomainExists(SObject& SD, const ConvertOptions& opts) {
+  if (!TimeDomainFile(SD, opts).Exists() || SD.GetForce()) return false;
+  wxString mess = wxString::Format(
+      _("%s:%d Time domain file %s already exists.  Delete it first."),
+      __FILE__, __LINE__, TimeDomainFile(SD, opts).GetFullPath().c_str());
+  HandleMessage(mess, SD.GetQuiet());
+  return true;
+}
+
+static void TimeDomainFailed(SObject& SD, const ConvertOptions& opts) {
+  wxString mess = wxString::Format(
+      _("%s:%d Time domain file %s not created."), __FILE__, __LINE__,
+      TimeDomainFile(SD, opts).GetFullPath().c_str());
+  HandleMessage(mess, SD.GetQuiet());
+}
+
+int WriteOutputs(SObject& SD, const ConvertOptions& opts) {
+  int res = OptionsFailed(SD, SD.getSNPfile(), opts);
+  if (res != 0) return res;
+  WarnIfNotCausal(SD, opts);
+  // Should we create the symbol file?
+  if (opts.asy) {
+    if (SD.getASYfile().Exists() && !SD.GetForce()) {
+      wxString mess = wxString::Format(
+          _("%s:%d ASY file %s already exists.  Delete it first."), __FILE__,
+          __LINE__, SD.getASYfile().GetFullPath().c_str());
+      HandleMessage(mess, SD.GetQuiet());
+      return 2;
+    }
+    if (!SD.WriteASY()) {
+      wxString mess = wxString::Format(
+          _("%s:%d ASY file %s creation failed."), __FILE__, __LINE__,
+          SD.getASYfile().GetFullPath().c_str());
+      HandleMessage(mess, SD.GetQuiet());
+      return 3;
+    }
+  }
+
+  // Should we create the library file?
+  if (opts.lib && !opts.stream) {
+    if (SD.getLIBfile().Exists() && !SD.GetForce()) {
+      wxString mess = wxString::Format(
+          _("%s:%d LIB file %s already exists.  Delete it first."), __FILE__,
+          __LINE__, SD.getLIBfile().GetFullPath().c_str());
+      HandleMessage(mess, SD.GetQuiet());
+      return 4;
+    }
+    if (!SD.WriteLIB()) {
+      wxString mess = wxString::Format(
+          _("%s:%d LIB file %s not created."), __FILE__, __LINE__,
+          SD.getLIBfile().GetFullPath().c_str());
+      HandleMessage(mess, SD.GetQuiet());
+      return 5;
+    }
+  }
+
+  // Should we write the time domain responses?
+  if (!opts.output.timeDomain.empty()) {
+    if (TimeDomainExists(SD, opts)) return 9;
+    string contents;
+    FormatTimeDomain(SD, opts, contents);
+    // Under a temporary name until complete, like the LIB file
+    string name = TimeDomainFile(SD, opts).GetFullPath().ToStdString();
+    string partName = PartFileName(name);
+    ofstream out(partName, ios::binary);
+    out.write(contents.data(), contents.size());
+    out.close();
+    if (!out || !wxRenameFile(partName, name, true)) {
+      wxRemoveFile(partName);
+      TimeDomainFailed(SD, opts);
+      return 10;
+    }
+  }
+  return 0;
+}
+
+int FormatOutputs(SObject& SD, const ConvertOptions& opts,
+                  vector<OutputFile>& files) {
+  files.clear();
+  int res = OptionsFailed(SD, SD.getSNPfile(), opts);
+  if (res != 0) return res;
+  WarnIfNotCausal(SD, opts);
+  if (opts.asy) {
+    if (SD.getASYfile().Exists() && !SD.GetForce()) {
+      wxString mess = wxString::Format(
+          _("%s:%d ASY file %s already exists.  Delete it first."), __FILE__,
+          __LINE__, SD.getASYfile().GetFullPath().c_str());
+      HandleMessage(mess, SD.GetQuiet());
+      return 2;
+    }
+    files.push_back(OutputFile{SD.getASYfile(), string(), 3});
+    if (!SD.FormatASY(files.back().contents)) {
+      wxString mess = wxString::Format(
+          _("%s:%d ASY file %s creation failed."), __FILE__, __LINE__,
+          SD.getASYfile().GetFullPath().c_str());
+      HandleMessage(mess, SD.GetQuiet());
+      return 3;
+    }
+  }
+
+  if (opts.lib && !opts.stream) {
+    if (SD.getLIBfile().Exists() && !SD.GetForce()) {
+      wxString mess = wxString::Format(
+          _("%s:%d LIB file %s already exists.  Delete it first."), __FILE__,
+          __LINE__, SD.getLIBfile().GetFullPath().c_str());
+      HandleMessage(mess, SD.GetQuiet());
+      return 4;
+    }
+    files.push_back(OutputFile{SD.getLIBfile(), string(), 5});
+    if (!SD.FormatLIB(files.back().contents)) {
+      wxString mess = wxString::Format(
+          _("%s:%d LIB file %s not created."), __FILE__, __LINE__,
+          SD.getLIBfile().GetFullPath().c_str());
+      HandleMessage(mess, SD.GetQuiet());
+      return 5;
+    }
+  }
+
+  if (!opts.output.timeDomain.empty()) {
+    if (TimeDomainExists(SD, opts)) return 9;
+    files.push_back(OutputFile{TimeDomainFile(SD, opts), string(), 10});
+    FormatTimeDomain(SD, opts, files.back().contents);
+  }
+  return 0;
+}
@@ -0,0 +1,87 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Conversion of one file as done by the command line, the GUI
+ *           queue and the server.
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+#if !defined(__CONVERT)
+#define __CONVERT
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#include "SObject.h"
+#include <wx/log.h>
+
+// What to do with each input file
+struct ConvertOptions {
+  bool lib = false;     // write the LIB file
+  bool asy = false;     // write the ASY file
+  bool stream = false;  // write the LIB file while reading the input
+  OutputOptions output;  // names and number format of the outputs
+};
+
+// Touchstone files are named *.ts or *.<letter><ports>p (e.g. s2p, s12p)
+bool IsTouchstoneFile(const wxFileName& file);
+
+// Outputs that opts asks for but cannot be made, e.g. an unknown time domain
+// format, or the time domain or the causality check with stream, which need
+// the data in memory.  Checked before anything is written.  Returns 0 or the
+// exit code (12), with the reason in why.
+int CheckOptions(const ConvertOptions& opts, std::string& why);
+
+// Read one S-parameter file and write the requested outputs.  Returns 0
+// on success or the program exit code describing the failure.
+int ConvertFile(SObject& SD, wxFileName& SFile, const ConvertOptions& opts);
+
+// The two halves of ConvertFile(), for callers that keep SD loaded.  With
+// opts.stream ReadInput() also writes the LIB file.  If contents is given
+// it holds the bytes of SFile, already read by the caller.
+int ReadInput(SObject& SD, wxFileName& SFile, const ConvertOptions& opts,
+              const std::string* contents = NULL);
+int WriteOutputs(SObject& SD, const ConvertOptions& opts);
+
+// An output file formatted in memory
+struct OutputFile {
+  wxFileName name;
+  std::string contents;
+  int failCode;  // exit code if writing it fails
+};
+
+// WriteOutputs() for callers that write the files themselves: checks and
+// formats the requested outputs into files, which are to be written only
+// if 0 is returned.
+int FormatOutputs(SObject& SD, const ConvertOptions& opts,
+                  std::vector<OutputFile>& files);
+
+// Collects the messages logged by one thread so each job's errors end up
+// with the job instead of in message boxes.
+class JobLog : public wxLog {
+public:
+  wxArrayString messages;
+
+protected:
+  virtual void DoLogRecord(wxLogLevel WXUNUSED(level), const wxString& msg,
+                           const wxLogRecordInfo& WXUNUSED(info)) {
+    messages.Add(msg);
+  }
+};
+
+#endif
@@ -0,0 +1,150 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Parametric model of a family of files, e.g. one part at several
+ *           temperatures (--temperature).
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+
+#include "Family.h"
+#include "Resample.h"
+#include "Trace.h"
+#include "stringformat.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <memory>
+
+using namespace std;
+
+static bool EndsWith(const string& s, const string& tail) {
+  return s.length() >= tail.length() &&
+         s.compare(s.length() - tail.length(), tail.length(), tail) == 0;
+}
+
+bool ParseFamilyMember(const wxString& arg, FamilyMember& member) {
+  if (arg.Contains("=") && arg.BeforeFirst('=').ToCDouble(&member.value)) {
+    member.file = wxFileName(arg.AfterFirst('='));
+    return true;
+  }
+  member.file = wxFileName(arg);
+  string name = member.file.GetName().ToStdString();
+  size_t end = name.find_last_of("0123456789");
+  if (end == string::npos) return false;
+  size_t begin = end;
+  while (begin > 0 &&
+         (isdigit((unsigned char)name[begin - 1]) || name[begin - 1] == '.'))
+    begin--;
+  member.value = atof(name.substr(begin, end + 1 - begin).c_str());
+  string before = name.substr(0, begin);
+  transform(before.begin(), before.end(), before.begin(),
+            [](unsigned char c) { return (char)tolower(c); });
+  if (EndsWith(before, "-") || EndsWith(before, "minus") ||
+      EndsWith(before, "minu"))
+    member.value = -member.value;
+  return true;
+}
+
+static bool IsParamName(const string& name) {
+  if (name.empty() || !isalpha((unsigned char)name[0])) return false;
+  for (char c : name) {
+    if (!isalnum((unsigned char)c) && c != '_') return false;
+  }
+  return true;
+}
+
+// The weight of the set at v[k] falls linearly from 1 at its value to 0 at
+// those of its neighbours, so the weights always add up to 1 and beyond
+// the first and last value the model holds their data
+static string FamilyWeight(const string& param, const vector<double>& v,
+                           size_t k) {
+  const char* p = param.c_str();
+  string rise = "1", fall = "1";
+  if (k > 0)
+    rise = stringFormat("(%s-(%.12g))/%.12g", p, v[k - 1], v[k] - v[k - 1]);
+  if (k + 1 < v.size())
+    fall = stringFormat("((%.12g)-%s)/%.12g", v[k + 1], p, v[k + 1] - v[k]);
+  return stringFormat(".param W%d={limit(min(%s,%s),0,1)}", (int)k + 1,
+                      rise, fall);
+}
+
+int FamilyFiles(const vector<FamilyMember>& members, const string& param,
+                const wxFileName& out, const ConvertOptions& opts,
+                SObject& result) {
+  TRACE_SCOPE("family", out.GetFullPath().ToStdString());
+  vector<FamilyMember> sorted(members);
+  stable_sort(sorted.begin(), sorted.end(),
+              [](const FamilyMember& a, const FamilyMember& b) {
+                return a.value < b.value;
+              });
+
+  string error;
+  if (sorted.size() < 2) error = "a family needs at least two files";
+  if (!IsParamName(param))
+    error = "'" + param + "' is not a parameter name";
+  for (size_t m = 1; m < sorted.size() && error.empty(); m++) {
+    if (sorted[m].value == sorted[m - 1].value)
+      error = stringFormat("%s and %s are both at %s=%g",
+                           sorted[m - 1].file.GetFullPath().ToStdString(),
+                           sorted[m].file.GetFullPath().ToStdString(), param,
+                           sorted[m].value);
+  }
+  vector<unique_ptr<SObject>> files;
+  vector<vector<Sparam>> sets;
+  if (error.empty()) {
+    vector<wxFileName> names;
+    for (auto& m : sorted) names.push_back(m.file);
+    int res = ReadResampled(names, opts, result, files, sets, error);
+    if (res != 0 && res != 11) return res;
+  }
+  if (!error.empty()) {
+    wxString mess = wxString::Format(
+        _("%s:%d Cannot make a family of the files for %s: %s."), __FILE__,
+        __LINE__, out.GetFullPath(), error);
+    HandleMessage(mess, result.GetQuiet());
+    return 11;
+  }
+
+  wxArrayString comments;
+  comments.Add("! Parameter " + param +
+               " interpolates linearly between the data of");
+  vector<double> values;
+  vector<string> lines, weights, labels;
+  for (auto& m : sorted) {
+    comments.Add(wxString::Format("!   %s=%g: ", wxString(param), m.value) +
+                 m.file.GetFullPath());
+    values.push_back(m.value);
+    labels.push_back(stringFormat("%s=%g", param, m.value));
+  }
+  for (size_t k = 0; k < values.size(); k++) {
+    lines.push_back(FamilyWeight(param, values, k));
+    weights.push_back(stringFormat("W%d", (int)k + 1));
+  }
+  result.SetOutputOptions(opts.output);
+  if (!result.SetData(out, *files[0], files[0]->nPorts(), sets[0], comments))
+    return 1;
+  vector<vector<Sparam>> others(make_move_iterator(sets.begin() + 1),
+                                make_move_iterator(sets.end()));
+  result.SetWeightedSets(stringFormat("%s=%g", param, members[0].value),
+                         lines, weights, labels, others);
+  ConvertOptions write = opts;
+  write.lib = true;
+  write.stream = false;
+  return WriteOutputs(result, write);
+}
@@ -0,0 +1,58 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Parametric model of a family of files, e.g. one part at several
+ *           temperatures (--temperature).
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+#if !defined(__FAMILY)
+#define __FAMILY
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#include "Convert.h"
+
+#include <string>
+#include <vector>
+
+// One file of a family and the value of the parameter it was measured at
+struct FamilyMember {
+  double value = 0;
+  wxFileName file;
+};
+
+// A file name of the command line: "85=amp.s2p" is amp.s2p at 85.  Without
+// a value it is taken from the last number of the name, negative after a
+// '-' or "Minus"/"Minu" as in "AD6PS-1+___-40.S7P" and
+// "BBP-20R5+_Minu40degC.s2p".  false if the name has no number.
+bool ParseFamilyMember(const wxString& arg, FamilyMember& member);
+
+// Read the files of members, resample them all onto the frequencies of the
+// one with the lowest value that every one covers and write one LIB model
+// (and the other outputs of opts) as if read from out, with the subcircuit
+// parameter param that interpolates between them.  Its default is the
+// value of the first member.  Returns 0 or the exit code: 1 if a file
+// cannot be read, 11 if the files do not make a family or else that of
+// WriteOutputs().
+int FamilyFiles(const std::vector<FamilyMember>& members,
+                const std::string& param, const wxFileName& out,
+                const ConvertOptions& opts, SObject& result);
+
+#endif
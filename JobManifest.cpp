@@ -0,0 +1,368 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Batches described by a job manifest (--jobs) and their result
+ *           manifest (--results).
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+
+#include "JobManifest.h"
+#include "stringformat.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+using namespace std;
+
+JobManifest::JobManifest(istream& i, const BatchJob& d, const wxString& dir)
+    : in(i),
+      defaults(d),
+      baseDir(dir),
+      format(UNKNOWN),
+      inArray(false),
+      lineNumber(1) {}
+
+bool JobManifest::Next(BatchJob& job) {
+  if (!error.empty()) return false;
+  if (format == UNKNOWN) {
+    int c = Peek();
+    if (c == EOF) return false;
+    format = c == '{' || c == '[' ? JSON : LINES;
+  }
+  return format == JSON ? NextJSON(job) : NextLine(job);
+}
+
+bool JobManifest::Finish(BatchJob& job) {
+  // As with --stream on the command line
+  job.opts.stream = job.opts.stream && job.opts.lib;
+  OutputOptions& output = job.opts.output;
+  if (output.fMin > 0 && output.fMax > 0 && output.fMin > output.fMax)
+    return Fail("fmin is above fmax");
+  string why;
+  if (CheckOptions(job.opts, why) != 0) return Fail(why);
+  return true;
+}
+
+bool JobManifest::Fail(const string& why) {
+  error = stringFormat("line %d: %s", lineNumber, why);
+  return false;
+}
+
+bool JobManifest::NextLine(BatchJob& job) {
+  string line;
+  for (; getline(in, line); lineNumber++) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    vector<string> tokens;
+    size_t i = 0;
+    while (true) {
+      while (i < line.size() && isspace((unsigned char)line[i])) i++;
+      if (i == line.size() || (tokens.empty() && line[i] == '#')) break;
+      string token;
+      while (i < line.size() && !isspace((unsigned char)line[i])) {
+        if (line[i] != '"') {
+          token += line[i++];
+          continue;
+        }
+        size_t end = line.find('"', i + 1);
+        if (end == string::npos) return Fail("missing closing \"");
+        token += line.substr(i + 1, end - i - 1);
+        i = end + 1;
+      }
+      tokens.push_back(token);
+    }
+    if (tokens.empty()) continue;
+
+    job = defaults;
+    if (!Set(job, "file", tokens[0])) return false;
+    for (size_t k = 1; k < tokens.size(); k++) {
+      size_t eq = tokens[k].find('=');
+      if (eq == string::npos)
+        return Fail("expected key=value, not '" + tokens[k] + "'");
+      if (!Set(job, tokens[k].substr(0, eq), tokens[k].substr(eq + 1)))
+        return false;
+    }
+    if (!Finish(job)) return false;
+    lineNumber++;
+    return true;
+  }
+  return false;
+}
+
+int JobManifest::Peek() {
+  int c;
+  while ((c = in.peek()) != EOF && isspace(c)) {
+    if (c == '\n') lineNumber++;
+    in.get();
+  }
+  return c;
+}
+
+bool JobManifest::Expect(char c) {
+  if (Peek() != c) return Fail(stringFormat("expected '%c'", c));
+  in.get();
+  return true;
+}
+
+bool JobManifest::ReadString(string& s) {
+  if (!Expect('"')) return false;
+  s.clear();
+  int c;
+  while ((c = in.get()) != '"') {
+    if (c == EOF || c == '\n') return Fail("unterminated string");
+    if (c != '\\') {
+      s += (char)c;
+      continue;
+    }
+    c = in.get();
+    switch (c) {
+      case '"':
+      case '\\':
+      case '/':
+        s += (char)c;
+        break;
+      case 'b':
+        s += '\b';
+        break;
+      case 'f':
+        s += '\f';
+        break;
+      case 'n':
+        s += '\n';
+        break;
+      case 'r':
+        s += '\r';
+        break;
+      case 't':
+        s += '\t';
+        break;
+      case 'u': {
+        char hex[5] = {0};
+        in.read(hex, 4);
+        char* end;
+        unsigned long u = strtoul(hex, &end, 16);
+        if (in.gcount() != 4 || end != hex + 4)
+          return Fail("bad \\u escape");
+        // UTF-8; file names outside the BMP are not supported
+        if (u < 0x80) {
+          s += (char)u;
+        } else if (u < 0x800) {
+          s += (char)(0xc0 | (u >> 6));
+          s += (char)(0x80 | (u & 0x3f));
+        } else {
+          s += (char)(0xe0 | (u >> 12));
+          s += (char)(0x80 | ((u >> 6) & 0x3f));
+          s += (char)(0x80 | (u & 0x3f));
+        }
+        break;
+      }
+      default:
+        return Fail("bad escape in string");
+    }
+  }
+  return true;
+}
+
+bool JobManifest::ReadValue(string& value) {
+  if (Peek() == '"') return ReadString(value);
+  value.clear();
+  int c;
+  while ((c = in.peek()) != EOF && !isspace(c) && c != ',' && c != '}' &&
+         c != ']')
+    value += (char)in.get();
+  if (value.empty()) return Fail("missing value");
+  if (value == "{" || value[0] == '[') return Fail("nested values");
+  return true;
+}
+
+bool JobManifest::NextJSON(BatchJob& job) {
+  int c = Peek();
+  if (c == '[' && !inArray) {
+    in.get();
+    inArray = true;
+    c = Peek();
+  }
+  if (c == ',') {
+    in.get();
+    c = Peek();
+  }
+  if (c == ']' && inArray) {
+    in.get();
+    inArray = false;
+    if (Peek() != EOF) return Fail("text after the job array");
+    return false;
+  }
+  if (c == EOF) {
+    if (inArray) return Fail("missing ']'");
+    return false;
+  }
+  if (!Expect('{')) return false;
+
+  job = defaults;
+  bool hasFile = false;
+  if (Peek() == '}') {
+    in.get();
+  } else {
+    while (true) {
+      string key, value;
+      if (!ReadString(key) || !Expect(':')) return false;
+      bool quoted = Peek() == '"';
+      if (!ReadValue(value)) return false;
+      if (quoted || value != "null") {
+        if (!Set(job, key, value)) return false;
+        if (key == "file") hasFile = true;
+      }
+      c = Peek();
+      in.get();
+      if (c == '}') break;
+      if (c != ',') return Fail("expected ',' or '}'");
+    }
+  }
+  if (!hasFile) return Fail("job without \"file\"");
+  return Finish(job);
+}
+
+static bool ParseBool(const string& value, bool& b) {
+  if (value == "true" || value == "1" || value == "yes") {
+    b = true;
+  } else if (value == "false" || value == "0" || value == "no") {
+    b = false;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool JobManifest::Set(BatchJob& job, const string& key, const string& value) {
+  OutputOptions& output = job.opts.output;
+  auto path = [this](const string& name) {
+    wxFileName file(name);
+    if (!baseDir.IsEmpty() && file.IsRelative())
+      file = wxFileName(baseDir + wxFileName::GetPathSeparator() + name);
+    return file;
+  };
+  auto number = [&](double& x) {
+    char* end;
+    x = strtod(value.c_str(), &end);
+    return !value.empty() && *end == 0 && x >= 0;
+  };
+  if (key == "file") {
+    if (value.empty()) return Fail("empty file name");
+    job.file = path(value);
+  } else if (key == "lib") {
+    output.libFile = path(value).GetFullPath();
+  } else if (key == "asy") {
+    output.asyFile = path(value).GetFullPath();
+  } else if (key == "subckt") {
+    if (value.empty() ||
+        find_if(value.begin(), value.end(), [](char c) {
+          return isspace((unsigned char)c);
+        }) != value.end())
+      return Fail("bad subckt name '" + value + "'");
+    output.subckt = value;
+  } else if (key == "formats") {
+    job.opts.lib = job.opts.asy = false;
+    for (auto& f : wxStringTokenize(value, ",")) {
+      if (f == "lib") {
+        job.opts.lib = true;
+      } else if (f == "asy") {
+        job.opts.asy = true;
+      } else if (f != "none") {
+        return Fail("unknown format '" + f.ToStdString() + "'");
+      }
+    }
+  } else if (key == "force") {
+    if (!ParseBool(value, job.force)) return Fail("force wants true or false");
+  } else if (key == "stream") {
+    if (!ParseBool(value, job.opts.stream))
+      return Fail("stream wants true or false");
+  } else if (key == "precision") {
+    double digits;
+    if (!number(digits) || digits < 1 || digits > 17 ||
+        digits != (int)digits)
+      return Fail("precision wants 1 to 17 digits");
+    output.precision = (int)digits;
+  } else if (key == "fmin") {
+    if (!number(output.fMin)) return Fail("fmin wants a frequency in Hz");
+  } else if (key == "fmax") {
+    if (!number(output.fMax)) return Fail("fmax wants a frequency in Hz");
+  } else if (key == "reciprocal") {
+    if (!number(output.reciprocal) || output.reciprocal < 0)
+      return Fail("reciprocal wants a tolerance of at least 0");
+  } else if (key == "prune") {
+    if (!number(output.prune)) return Fail("prune wants a level in dB");
+  } else if (key == "mixed-mode") {
+    output.mixedMode = value;
+  } else if (key == "causality") {
+    if (!number(output.causality) || output.causality < 0)
+      return Fail("causality wants a tolerance of at least 0");
+  } else if (key == "time-domain") {
+    if (value != "csv" && value != "bin")
+      return Fail("time-domain wants csv or bin");
+    output.timeDomain = value;
+  } else if (key == "terminate") {
+    output.terminate = value;
+  } else {
+    return Fail("unknown key '" + key + "'");
+  }
+  return true;
+}
+
+static string JSONString(const string& s) {
+  string res = "\"";
+  for (char c : s) {
+    switch (c) {
+      case '"':
+        res += "\\\"";
+        break;
+      case '\\':
+        res += "\\\\";
+        break;
+      case '\n':
+        res += "\\n";
+        break;
+      case '\r':
+        res += "\\r";
+        break;
+      case '\t':
+        res += "\\t";
+        break;
+      default:
+        if ((unsigned char)c < 0x20)
+          res += stringFormat("\\u%04x", (int)c);
+        else
+          res += c;
+    }
+  }
+  return res + "\"";
+}
+
+void WriteJobResult(ostream& out, size_t index, const BatchJob& job) {
+  out << stringFormat(
+      "{\"job\":%llu,\"file\":%s,\"status\":\"%s\",\"code\":%d,"
+      "\"seconds\":%.6f,\"messages\":[",
+      (unsigned long long)index,
+      JSONString(job.file.GetFullPath().ToStdString()),
+      job.code == 0 ? "ok" : "failed", job.code, job.seconds);
+  for (size_t i = 0; i < job.messages.GetCount(); i++) {
+    if (i > 0) out << ",";
+    out << JSONString(job.messages[i].ToStdString());
+  }
+  out << "]}\n";
+}
@@ -0,0 +1,101 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Batches described by a job manifest (--jobs) and their result
+ *           manifest (--results).
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+#if !defined(__JOBMANIFEST)
+#define __JOBMANIFEST
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#include "Batch.h"
+
+#include <istream>
+#include <ostream>
+#include <string>
+
+// A manifest lists one job per line:
+//
+//   # comment
+//   <file> [key=value ...]
+//
+// where a file name or value with spaces is written in double quotes, or is
+// JSON: objects with a "file" member and the same keys, one after another
+// (JSON Lines) or in an array.  The keys are
+//
+//   lib=<file>      LIB file instead of <file name>.inc
+//   asy=<file>      ASY file instead of <file name>.asy
+//   subckt=<name>   subcircuit name instead of the LIB file name
+//   formats=<list>  outputs to write: lib, asy, lib,asy or none
+//   force=<bool>    overwrite existing outputs
+//   stream=<bool>   write the LIB file while reading the input
+//   precision=<n>   digits after the point in the LIB tables (1 to 17)
+//   fmin=<Hz>, fmax=<Hz>  drop the frequencies outside this range
+//   reciprocal=<tol>  share the tables of S_ij and S_ji within this tolerance
+//   prune=<dB>      leave out the S_ij that stay below -<dB> dB
+//   mixed-mode=<modes>  ports of the LIB model, e.g. "D1,3 D2,4 C1,3 C2,4"
+//   causality=<tol> warn about S_ij that are not causal within tol
+//   time-domain=<f> also write the impulse and step responses, csv or bin
+//   terminate=<ports>  terminate these ports, e.g. "3 5=75 6=open"
+//
+// Keys that are not given keep the setting of the command line.  Relative
+// file names are relative to the directory of the manifest.
+class JobManifest {
+public:
+  JobManifest(std::istream& in, const BatchJob& defaults,
+              const wxString& baseDir);
+
+  // Read the next job into job.  Returns false at the end of the manifest
+  // or if it is malformed; Error() then tells why.
+  bool Next(BatchJob& job);
+  const std::string& Error() const { return error; }
+
+private:
+  bool NextLine(BatchJob& job);
+  bool NextJSON(BatchJob& job);
+  // Checks of the complete job
+  bool Finish(BatchJob& job);
+  // JSON tokens; return false after setting error
+  bool ReadString(std::string& s);
+  bool ReadValue(std::string& value);
+  bool Expect(char c);
+  int Peek();  // the next character that is not white space, or EOF
+  bool Set(BatchJob& job, const std::string& key, const std::string& value);
+  bool Fail(const std::string& why);
+
+  std::istream& in;
+  BatchJob defaults;
+  wxString baseDir;
+  enum { UNKNOWN, LINES, JSON } format;
+  bool inArray;
+  int lineNumber;
+  std::string error;
+};
+
+// Append the result of the index'th (from 1) job to a result manifest, as
+// one JSON object per line:
+//
+//   {"job":1,"file":"a.s2p","status":"ok","code":0,"seconds":0.012,
+//    "messages":[]}
+void WriteJobResult(std::ostream& out, size_t index, const BatchJob& job);
+
+#endif
@@ -0,0 +1,103 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Min/max decimation of a sampled curve for fast plotting.
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+
+#include "MinMaxPyramid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+void MinMaxPyramid::Clear() {
+  xs.clear();
+  mins.clear();
+  maxs.clear();
+}
+
+void MinMaxPyramid::Build(const vector<double>& x, const vector<double>& y) {
+  Clear();
+  xs = x;
+  mins.push_back(y);
+  maxs.push_back(y);
+  // Each level halves the previous one; an odd last block is kept alone
+  while (mins.back().size() > 1) {
+    const vector<double>& lo = mins.back();
+    const vector<double>& hi = maxs.back();
+    size_t n = (lo.size() + 1) / 2;
+    vector<double> nextLo(n), nextHi(n);
+    for (size_t i = 0; i < n; i++) {
+      size_t a = 2 * i;
+      size_t b = min(a + 1, lo.size() - 1);
+      nextLo[i] = min(lo[a], lo[b]);
+      nextHi[i] = max(hi[a], hi[b]);
+    }
+    mins.push_back(std::move(nextLo));
+    maxs.push_back(std::move(nextHi));
+  }
+}
+
+void MinMaxPyramid::Range(double x0, double x1, size_t& first,
+                          size_t& last) const {
+  first = lower_bound(xs.begin(), xs.end(), x0) - xs.begin();
+  last = upper_bound(xs.begin(), xs.end(), x1) - xs.begin();
+  if (last < first) last = first;
+}
+
+void MinMaxPyramid::MinMax(size_t first, size_t last, double& ymin,
+                           double& ymax) const {
+  ymin = numeric_limits<double>::infinity();
+  ymax = -numeric_limits<double>::infinity();
+  // Take the largest aligned block that starts at first and fits
+  while (first < last) {
+    size_t k = 0;
+    while (k + 1 < mins.size() && (first & ((size_t(2) << k) - 1)) == 0 &&
+           first + (size_t(2) << k) <= last)
+      k++;
+    size_t block = first >> k;
+    ymin = min(ymin, mins[k][block]);
+    ymax = max(ymax, maxs[k][block]);
+    first += size_t(1) << k;
+  }
+}
+
+void MinMaxPyramid::Columns(double x0, double x1, int n, vector<double>& ymin,
+                            vector<double>& ymax) const {
+  const double nan = numeric_limits<double>::quiet_NaN();
+  ymin.assign(max(n, 0), nan);
+  ymax.assign(max(n, 0), nan);
+  if (n <= 0 || xs.empty() || !(x1 > x0)) return;
+  const double dx = (x1 - x0) / n;
+  size_t first = lower_bound(xs.begin(), xs.end(), x0) - xs.begin();
+  for (int c = 0; c < n && first < xs.size(); c++) {
+    size_t last;
+    if (c == n - 1) {
+      last = upper_bound(xs.begin() + first, xs.end(), x1) - xs.begin();
+    } else {
+      last = lower_bound(xs.begin() + first, xs.end(), x0 + (c + 1) * dx) -
+             xs.begin();
+    }
+    if (last > first) MinMax(first, last, ymin[c], ymax[c]);
+    first = last;
+  }
+}
@@ -0,0 +1,63 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Min/max decimation of a sampled curve for fast plotting.
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+#if !defined(__MINMAXPYRAMID)
+#define __MINMAXPYRAMID
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#include <cstddef>
+#include <vector>
+
+// Holds a curve y(x) (x increasing) together with the min and max of y over
+// aligned blocks of 2, 4, 8, ... samples.  The min and max of any run of
+// samples is then found from O(log n) blocks, so the min/max of every pixel
+// column of a plot costs the same whatever the zoom level.
+class MinMaxPyramid {
+public:
+  void Build(const std::vector<double>& x, const std::vector<double>& y);
+  void Clear();
+
+  size_t size() const { return xs.size(); }
+  const std::vector<double>& X() const { return xs; }
+  const std::vector<double>& Y() const { return mins[0]; }
+
+  // Index range [first, last) of the samples with x0 <= x <= x1
+  void Range(double x0, double x1, size_t& first, size_t& last) const;
+
+  // Min and max of y over the samples [first, last).  last > first.
+  void MinMax(size_t first, size_t last, double& ymin, double& ymax) const;
+
+  // Split [x0, x1] into n equal columns and return the min and max of the
+  // samples in each one.  Columns without samples are set to NaN.
+  void Columns(double x0, double x1, int n, std::vector<double>& ymin,
+               std::vector<double>& ymax) const;
+
+private:
+  std::vector<double> xs;
+  // Level k holds the min (max) of the blocks of 2^k samples.  Level 0 is y.
+  std::vector<std::vector<double>> mins;
+  std::vector<std::vector<double>> maxs;
+};
+
+#endif
@@ -0,0 +1,185 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Statistical model of several units of one part (--monte-carlo).
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+
+#include "MonteCarlo.h"
+#include "Resample.h"
+#include "Scheduler.h"
+#include "Trace.h"
+#include "stringformat.hpp"
+
+#include <cmath>
+#include <memory>
+
+using namespace std;
+
+// Frequencies handled by one task
+static const size_t blockRecords = 256;
+
+// The components of the model explain this much of the variance
+static const double explainedVariance = 0.99;
+
+// The tables are in dB, so smaller magnitudes are written as this one
+static const double floorMagnitude = 1e-20;
+
+static void StoreFloored(Sparam& s, MatrixXcd S) {
+  for (Index k = 0; k < S.size(); k++) {
+    if (abs(S(k)) < floorMagnitude) S(k) = polar(floorMagnitude, arg(S(k)));
+  }
+  s.cplxStore(S);
+}
+
+// Call body(b) for the blocks of nFreq frequencies, as tasks of scheduler
+// if given.  The blocks do not depend on the scheduler, so neither do sums
+// over them.
+static void ForBlocks(size_t nFreq, TaskScheduler* scheduler,
+                      const function<void(size_t)>& body) {
+  size_t blocks = (nFreq + blockRecords - 1) / blockRecords;
+  auto run = [&](size_t begin, size_t end) {
+    for (size_t b = begin; b < end; b++) body(b);
+  };
+  if (scheduler != NULL)
+    scheduler->ParallelFor(blocks, 1, run);
+  else
+    run(0, blocks);
+}
+
+UnitSpread SpreadOfUnits(const vector<vector<Sparam>>& sets, int ports,
+                         double variance, TaskScheduler* scheduler) {
+  const size_t units = sets.size();
+  const size_t nFreq = units == 0 ? 0 : sets[0].size();
+  UnitSpread spread;
+  spread.mean.assign(nFreq, Sparam((size_t)ports));
+  if (units < 2) return spread;
+
+  // The mean, and the inner products of the units less the mean as real
+  // vectors, summed per block and then in order of the blocks
+  vector<MatrixXcd> mean(nFreq);
+  vector<MatrixXd> grams((nFreq + blockRecords - 1) / blockRecords);
+  ForBlocks(nFreq, scheduler, [&](size_t b) {
+    MatrixXd& gram = grams[b];
+    gram = MatrixXd::Zero(units, units);
+    vector<MatrixXcd> S(units);
+    for (size_t n = b * blockRecords; n < min(nFreq, (b + 1) * blockRecords);
+         n++) {
+      mean[n] = MatrixXcd::Zero(ports, ports);
+      for (size_t m = 0; m < units; m++) {
+        S[m] = sets[m][n].Scplx();
+        mean[n] += S[m];
+      }
+      mean[n] /= (double)units;
+      for (size_t m = 0; m < units; m++) S[m] -= mean[n];
+      for (size_t a = 0; a < units; a++) {
+        for (size_t c = 0; c <= a; c++) {
+          gram(a, c) += (S[a].conjugate().cwiseProduct(S[c])).sum().real();
+          gram(c, a) = gram(a, c);
+        }
+      }
+      spread.mean[n].Freq = sets[0][n].Freq;
+      StoreFloored(spread.mean[n], mean[n]);
+    }
+  });
+  MatrixXd gram = MatrixXd::Zero(units, units);
+  for (auto& g : grams) gram += g;
+
+  // The eigenvectors of the inner products give the scores of the units,
+  // with the largest eigenvalues first
+  SelfAdjointEigenSolver<MatrixXd> solver(gram);
+  const double total = gram.trace();
+  vector<VectorXd> weights;  // of the units for each component
+  double explained = 0;
+  for (Index k = (Index)units - 1; k >= 0 && total > 0; k--) {
+    double lambda = solver.eigenvalues()(k);
+    if (lambda <= total * 1e-12 || explained >= variance * total) break;
+    // Scores sqrt(units - 1) times the eigenvector have a variance of 1
+    weights.push_back(solver.eigenvectors().col(k) / sqrt(units - 1.0));
+    spread.fractions.push_back(lambda / total);
+    explained += lambda;
+  }
+
+  // Each component is the sum of the units less the mean, weighted by
+  // their scores over the variance of the scores
+  spread.components.assign(weights.size(), spread.mean);
+  ForBlocks(nFreq, scheduler, [&](size_t b) {
+    for (size_t n = b * blockRecords; n < min(nFreq, (b + 1) * blockRecords);
+         n++) {
+      for (size_t k = 0; k < weights.size(); k++) {
+        MatrixXcd C = MatrixXcd::Zero(ports, ports);
+        for (size_t m = 0; m < units; m++)
+          C += weights[k](m) * (sets[m][n].Scplx() - mean[n]);
+        StoreFloored(spread.components[k][n], C);
+      }
+    }
+  });
+  return spread;
+}
+
+int MonteCarloFiles(const vector<wxFileName>& units, const wxFileName& out,
+                    const ConvertOptions& opts, SObject& result) {
+  TRACE_SCOPE("monte carlo", out.GetFullPath().ToStdString());
+  vector<unique_ptr<SObject>> files;
+  vector<vector<Sparam>> sets;
+  string error;
+  if (units.size() < 2) {
+    error = "a statistical model needs at least two units";
+  } else {
+    int res = ReadResampled(units, opts, result, files, sets, error);
+    if (res != 0 && res != 11) return res;
+  }
+  if (!error.empty()) {
+    wxString mess = wxString::Format(
+        _("%s:%d Cannot make a statistical model of the units for %s: %s."),
+        __FILE__, __LINE__, out.GetFullPath(), error);
+    HandleMessage(mess, result.GetQuiet());
+    return 11;
+  }
+
+  const int ports = files[0]->nPorts();
+  UnitSpread spread;
+  {
+    TRACE_SCOPE("spread");
+    spread = SpreadOfUnits(sets, ports, explainedVariance,
+                           result.GetScheduler());
+  }
+  wxArrayString comments;
+  comments.Add("! Mean of the units");
+  for (auto& unit : units) comments.Add("!   " + unit.GetFullPath());
+  string params;
+  vector<string> weights(1, "1"), labels(1, "mean");
+  for (size_t k = 0; k < spread.components.size(); k++) {
+    string name = stringFormat("MC%d", (int)k + 1);
+    comments.Add(wxString::Format(
+        "! plus %s times a component of %.1f%% of their variance",
+        wxString(name), 100 * spread.fractions[k]));
+    params += (k > 0 ? " " : "") + name + "=0";
+    weights.push_back(name);
+    labels.push_back(name);
+  }
+  result.SetOutputOptions(opts.output);
+  if (!result.SetData(out, *files[0], ports, spread.mean, comments)) return 1;
+  result.SetWeightedSets(params, vector<string>(), weights, labels,
+                         spread.components);
+  ConvertOptions write = opts;
+  write.lib = true;
+  write.stream = false;
+  return WriteOutputs(result, write);
+}
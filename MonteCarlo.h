@@ -0,0 +1,66 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Statistical model of several units of one part (--monte-carlo).
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+#if !defined(__MONTECARLO)
+#define __MONTECARLO
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#include "Convert.h"
+
+#include <string>
+#include <vector>
+
+class TaskScheduler;
+
+// The spread of the data of several units: each unit is the mean plus a
+// sum of components weighted by its scores, which have a mean of 0 and a
+// variance of 1 over the units.  Independent draws of gauss(1) as scores
+// therefore make units with the covariance of those measured.
+struct UnitSpread {
+  std::vector<Sparam> mean;
+  std::vector<std::vector<Sparam>> components;  // the largest first
+  std::vector<double> fractions;  // of the variance, for each component
+};
+
+// The principal components of the sets of data of the units (at the same
+// frequencies and ports), all S-parameters at all frequencies of a unit
+// taken as one vector of real and imaginary parts, so the scores are real
+// and a few of them sample whole curves.  Components are kept until they
+// explain the fraction variance of the spread, as tasks of scheduler if
+// given.
+UnitSpread SpreadOfUnits(const std::vector<std::vector<Sparam>>& sets,
+                         int ports, double variance,
+                         TaskScheduler* scheduler);
+
+// Read units, files of several units of one part, and write one LIB model
+// (and the other outputs of opts) of their spread as if read from out: the
+// mean plus the components scaled by the subcircuit parameters MC1, MC2,
+// ... that are 0 by default.  Returns 0 or the exit code: 1 if a file
+// cannot be read, 11 if there are not at least two units with the same
+// ports or else that of WriteOutputs().
+int MonteCarloFiles(const std::vector<wxFileName>& units,
+                    const wxFileName& out, const ConvertOptions& opts,
+                    SObject& result);
+
+#endif
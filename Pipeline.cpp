@@ -0,0 +1,271 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Batch conversion pipeline with separate read, convert and
+ *           write stages (--pipeline).
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+
+#include "Pipeline.h"
+#include "Trace.h"
+#include "stringformat.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static uint64_t Nanoseconds(Clock::time_point since) {
+  return chrono::duration_cast<chrono::nanoseconds>(Clock::now() - since)
+      .count();
+}
+
+// Waiting for a queue spins briefly, then sleeps so an idle stage does not
+// take a CPU from a busy one
+static void Backoff(int& tries) {
+  if (++tries < 64)
+    this_thread::yield();
+  else
+    this_thread::sleep_for(chrono::microseconds(100));
+}
+
+bool ParsePipelineThreads(const string& spec, PipelineThreads& threads) {
+  istringstream in(spec);
+  char comma1 = 0, comma2 = 0;
+  int r, c, w;
+  if (!(in >> r >> comma1 >> c >> comma2 >> w) || comma1 != ',' ||
+      comma2 != ',' || r < 0 || c < 0 || w < 0 || !(in >> ws).eof())
+    return false;
+  threads.read = r;
+  threads.convert = c;
+  threads.write = w;
+  return true;
+}
+
+BatchPipeline::BatchPipeline(const ConvertOptions& o, bool f,
+                             const PipelineThreads& n)
+    : opts(o), force(f), nextJob(0), ioDepth(n.ioDepth), seconds(0) {
+  int cpus = max(1u, thread::hardware_concurrency());
+  const char* names[STAGE_COUNT] = {"read", "convert", "write"};
+  if (n.ioDepth > 0) {
+    readIO = AsyncIO::Create(n.ioDepth);
+    writeIO = AsyncIO::Create(n.ioDepth);
+  }
+  int counts[STAGE_COUNT] = {n.read > 0 ? n.read : (readIO ? 1 : 2),
+                             n.convert > 0 ? n.convert : cpus,
+                             n.write > 0 ? n.write : 2};
+  for (int i = 0; i < STAGE_COUNT; i++) {
+    stages[i].name = names[i];
+    stages[i].threads = counts[i];
+    stages[i].running = 0;
+    stages[i].jobs = 0;
+    stages[i].busy = stages[i].starved = stages[i].blocked = 0;
+  }
+  // Enough to keep the next stage busy, few enough to bound the memory
+  for (int i = 0; i < STAGE_COUNT - 1; i++)
+    queues[i].reset(
+        new BoundedQueue<Job*>(max(4, 2 * stages[i + 1].threads)));
+}
+
+int BatchPipeline::Run(const vector<wxFileName>& files) {
+  for (auto& file : files) {
+    jobs.emplace_back(new Job);
+    jobs.back()->file = file;
+  }
+  nextJob = 0;
+  Clock::time_point start = Clock::now();
+  vector<thread> pool;
+  for (int i = 0; i < STAGE_COUNT; i++) stages[i].running = stages[i].threads;
+  for (int i = 0; i < STAGE_COUNT; i++) {
+    for (int j = 0; j < stages[i].threads; j++)
+      pool.emplace_back(&BatchPipeline::Worker, this, i);
+  }
+  for (auto& t : pool) t.join();
+  if (writeIO) writeIO->Flush();
+  seconds = Nanoseconds(start) * 1e-9;
+
+  for (auto& job : jobs) {
+    if (job->code != 0) return job->code;
+  }
+  return 0;
+}
+
+void BatchPipeline::Worker(int stage) {
+  // Messages of the conversions stay with their job
+  JobLog log;
+  wxLog::SetThreadActiveTarget(&log);
+  Stage& s = stages[stage];
+  Job* job;
+  bool async = stage == STAGE_READ && readIO && !opts.stream;
+  while ((job = Take(stage)) != NULL) {
+    Clock::time_point start = Clock::now();
+    if (async) {
+      ReadAsync(job);  // passed on once read
+      s.busy += Nanoseconds(start);
+      s.jobs++;
+      continue;
+    }
+    Work(stage, *job);
+    s.busy += Nanoseconds(start);
+    s.jobs++;
+    for (size_t i = 0; i < log.messages.GetCount(); i++)
+      job->messages.Add(log.messages[i]);
+    log.messages.Clear();
+    Pass(stage, job);
+  }
+  // The stage is done when the last read has been passed on
+  if (async) readIO->Flush();
+  s.running--;
+  wxLog::SetThreadActiveTarget(NULL);
+}
+
+void BatchPipeline::Work(int stage, Job& job) {
+  switch (stage) {
+    case STAGE_READ: {
+      // Streaming reads the file itself, line by line
+      if (opts.stream) break;
+      TRACE_SCOPE("read", job.file.GetFullPath().ToStdString());
+      ifstream in(job.file.GetFullPath().ToStdString(), ios::binary);
+      if (!in) break;  // reading it again reports the error
+      in.seekg(0, ios::end);
+      streamoff size = in.tellg();
+      in.seekg(0, ios::beg);
+      if (size < 0) break;
+      job.contents.resize((size_t)size);
+      job.loaded = (bool)in.read(&job.contents[0], size);
+      break;
+    }
+    case STAGE_CONVERT:
+      job.SD.SetQuiet(false);
+      job.SD.SetForce(force);
+      job.code = ReadInput(job.SD, job.file, opts,
+                           job.loaded ? &job.contents : NULL);
+      string().swap(job.contents);
+      break;
+    case STAGE_WRITE:
+      if (job.code == 0) {
+        if (writeIO) {
+          job.code = FormatOutputs(job.SD, opts, job.outputs);
+          if (job.code != 0) job.outputs.clear();
+        } else {
+          job.code = WriteOutputs(job.SD, opts);
+        }
+      }
+      job.SD.Clean();
+      break;
+  }
+}
+
+BatchPipeline::Job* BatchPipeline::Take(int stage) {
+  if (stage == STAGE_READ) {
+    size_t i = nextJob++;
+    return i < jobs.size() ? jobs[i].get() : NULL;
+  }
+  BoundedQueue<Job*>& queue = *queues[stage - 1];
+  Stage& previous = stages[stage - 1];
+  Clock::time_point start = Clock::now();
+  Job* job = NULL;
+  int tries = 0;
+  for (;;) {
+    if (queue.TryPop(job)) break;
+    // Nothing more comes once the previous stage is done; check the queue
+    // again as its last job may have been pushed after the TryPop()
+    if (previous.running == 0) {
+      if (!queue.TryPop(job)) job = NULL;
+      break;
+    }
+    Backoff(tries);
+  }
+  stages[stage].starved += Nanoseconds(start);
+  return job;
+}
+
+void BatchPipeline::Pass(int stage, Job* job) {
+  if (stage == STAGE_WRITE) {
+    if (writeIO) WriteAsync(job);
+    return;
+  }
+  BoundedQueue<Job*>& queue = *queues[stage];
+  Clock::time_point start = Clock::now();
+  int tries = 0;
+  while (!queue.TryPush(job)) Backoff(tries);
+  stages[stage].blocked += Nanoseconds(start);
+}
+
+void BatchPipeline::ReadAsync(Job* job) {
+  TRACE_SCOPE("read", job->file.GetFullPath().ToStdString());
+  readIO->Read(job->file.GetFullPath().ToStdString(),
+               [this, job](int err, string& contents) {
+                 // If it failed, reading it again reports the error
+                 if (err == 0) {
+                   job->contents.swap(contents);
+                   job->loaded = true;
+                 }
+                 Pass(STAGE_READ, job);
+               });
+}
+
+void BatchPipeline::WriteAsync(Job* job) {
+  for (auto& output : job->outputs) {
+    string path = output.name.GetFullPath().ToStdString();
+    int failCode = output.failCode;
+    writeIO->Write(path, std::move(output.contents),
+                   [this, job, path, failCode](int err) {
+                     if (err == 0) return;
+                     lock_guard<mutex> lock(writeLock);
+                     if (job->code == 0) job->code = failCode;
+                     job->messages.Add(wxString::Format(
+                         _("%s:%d Cannot write file '%s': %s"), __FILE__,
+                         __LINE__, path, strerror(err)));
+                   });
+  }
+  job->outputs.clear();
+}
+
+void BatchPipeline::WriteReport(ostream& out) const {
+  int failed = 0;
+  for (auto& job : jobs) {
+    if (job->code == 0) continue;
+    failed++;
+    out << stringFormat("%s failed (%d)\n",
+                        job->file.GetFullPath().ToStdString(), job->code);
+    for (size_t i = 0; i < job->messages.GetCount(); i++)
+      out << "  " << job->messages[i] << "\n";
+  }
+  out << stringFormat("pipeline: %d files in %.3f s, %d failed\n",
+                      (int)jobs.size(), seconds, failed);
+  if (readIO)
+    out << stringFormat("I/O: %s, up to %d reads and %d writes in flight\n",
+                        readIO->Name(), ioDepth, ioDepth);
+  out << "stage    threads   jobs   busy  starved  blocked\n";
+  for (int i = 0; i < STAGE_COUNT; i++) {
+    const Stage& s = stages[i];
+    double total = seconds * 1e9 * s.threads;
+    if (total <= 0) total = 1;
+    out << stringFormat("%-8s %7d %6d %5.1f%% %7.1f%% %7.1f%%\n", s.name,
+                        s.threads, (int)s.jobs, 100 * s.busy / total,
+                        100 * s.starved / total, 100 * s.blocked / total);
+  }
+}
@@ -0,0 +1,117 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Batch conversion pipeline with separate read, convert and
+ *           write stages (--pipeline).
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+#if !defined(__PIPELINE)
+#define __PIPELINE
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#include "AsyncIO.h"
+#include "BoundedQueue.h"
+#include "Convert.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Threads of each stage; 0 picks the default.  With ioDepth > 0 the files
+// are read and written through AsyncIO with up to ioDepth requests of each
+// kind in flight; one read thread is then enough to keep it busy.
+struct PipelineThreads {
+  int read = 0;
+  int convert = 0;
+  int write = 0;
+  int ioDepth = 0;
+};
+
+// Parse "R,C,W" (e.g. "2,8,2") into threads.  Returns false if malformed.
+bool ParsePipelineThreads(const std::string& spec, PipelineThreads& threads);
+
+// Converts a batch of files in three stages connected by bounded queues:
+//
+//   read     read each file into memory, ahead of the converters
+//   convert  readSFile() on the bytes read
+//   write    WriteLIB() and WriteASY()
+//
+// so slow storage and the CPU-heavy conversion overlap.  The queues are
+// short, which limits how many files are held in memory at once.  Each
+// stage keeps track of the time its threads were busy, starved for input
+// and blocked on a full output queue.
+class BatchPipeline {
+public:
+  BatchPipeline(const ConvertOptions& opts, bool force,
+                const PipelineThreads& threads);
+  BatchPipeline(const BatchPipeline&) = delete;
+  BatchPipeline& operator=(const BatchPipeline&) = delete;
+
+  // Convert all files, continuing after failures.  Returns 0 or the exit
+  // code of the first file (in the given order) that failed.
+  int Run(const std::vector<wxFileName>& files);
+
+  // The failed files with their messages and the use of each stage
+  void WriteReport(std::ostream& out) const;
+
+private:
+  struct Job {
+    wxFileName file;
+    std::string contents;
+    bool loaded = false;  // contents holds the file
+    SObject SD;
+    int code = 0;
+    wxArrayString messages;
+    std::vector<OutputFile> outputs;  // formatted, for AsyncIO
+  };
+  enum { STAGE_READ, STAGE_CONVERT, STAGE_WRITE, STAGE_COUNT };
+  struct Stage {
+    const char* name;
+    int threads;
+    std::atomic<int> running;  // threads not finished
+    std::atomic<uint64_t> jobs;
+    std::atomic<uint64_t> busy, starved, blocked;  // ns
+  };
+
+  void Worker(int stage);
+  void Work(int stage, Job& job);
+  Job* Take(int stage);
+  void Pass(int stage, Job* job);
+  void ReadAsync(Job* job);
+  void WriteAsync(Job* job);
+
+  ConvertOptions opts;
+  bool force;
+  Stage stages[STAGE_COUNT];
+  std::vector<std::unique_ptr<Job>> jobs;
+  std::atomic<size_t> nextJob;  // next job to read
+  std::unique_ptr<BoundedQueue<Job*>> queues[STAGE_COUNT - 1];
+  std::unique_ptr<AsyncIO> readIO, writeIO;
+  std::mutex writeLock;  // guards the jobs in the writeIO callbacks
+  int ioDepth;
+  double seconds;
+};
+
+#endif
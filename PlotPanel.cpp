@@ -0,0 +1,325 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Plot of |Sij| or phase of the loaded S-parameter data.
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+
+#include "PlotPanel.h"
+
+#include <wx/dcbuffer.h>
+
+#include <algorithm>
+#include <cmath>
+
+// Space around the plot area for the axis labels
+static const int marginLeft = 60;
+static const int marginRight = 10;
+static const int marginTop = 10;
+static const int marginBottom = 25;
+
+// Each notch of the mouse wheel zooms by this factor
+static const double zoomStep = 0.8;
+
+wxBEGIN_EVENT_TABLE(PlotPanel, wxPanel)
+  EVT_PAINT(PlotPanel::OnPaint)
+  EVT_SIZE(PlotPanel::OnSize)
+  EVT_MOUSEWHEEL(PlotPanel::OnMouseWheel)
+  EVT_LEFT_DOWN(PlotPanel::OnLeftDown)
+  EVT_LEFT_UP(PlotPanel::OnLeftUp)
+  EVT_MOTION(PlotPanel::OnMotion)
+  EVT_LEFT_DCLICK(PlotPanel::OnLeftDClick)
+  EVT_MOUSE_CAPTURE_LOST(PlotPanel::OnCaptureLost)
+wxEND_EVENT_TABLE()
+
+PlotPanel::PlotPanel(wxWindow* parent, wxWindowID id)
+    : wxPanel(parent, id, wxDefaultPosition, wxSize(400, 250)),
+      SData(NULL),
+      phase(false),
+      viewX0(0),
+      viewX1(0),
+      dragging(false),
+      dragStart(0),
+      dragX0(0),
+      dragX1(0) {
+  SetBackgroundStyle(wxBG_STYLE_PAINT);
+}
+
+void PlotPanel::SetData(const SObject* SD) {
+  SData = SD;
+  curves.clear();
+  pairs.clear();
+  ResetZoom();
+}
+
+void PlotPanel::SetPairs(const vector<pair<int, int>>& newPairs) {
+  pairs = newPairs;
+  Refresh();
+}
+
+void PlotPanel::SetPhase(bool showPhase) {
+  phase = showPhase;
+  Refresh();
+}
+
+void PlotPanel::ResetZoom() {
+  viewX0 = viewX1 = 0;
+  if (SData != NULL && !SData->getSData().empty()) {
+    viewX0 = SData->getSData().front().Freq;
+    viewX1 = SData->getSData().back().Freq;
+  }
+  Refresh();
+}
+
+void PlotPanel::ClampView() {
+  if (SData == NULL || SData->getSData().empty()) return;
+  double first = SData->getSData().front().Freq;
+  double last = SData->getSData().back().Freq;
+  double span = min(viewX1 - viewX0, last - first);
+  if (viewX0 < first) viewX0 = first;
+  if (viewX0 + span > last) viewX0 = last - span;
+  viewX1 = viewX0 + span;
+}
+
+const MinMaxPyramid& PlotPanel::Curve(int i, int j) {
+  const vector<Sparam>& data = SData->getSData();
+  int ports = data.empty() ? 0 : data.front().ports();
+  MinMaxPyramid& curve = curves[(i * ports + j) * 2 + (phase ? 1 : 0)];
+  if (curve.size() == 0 && !data.empty()) {
+    vector<double> x(data.size()), y(data.size());
+    for (size_t n = 0; n < data.size(); n++) {
+      x[n] = data[n].Freq;
+      y[n] = phase ? data[n].phaseAt(i, j) : data[n].dBAt(i, j);
+    }
+    curve.Build(x, y);
+  }
+  return curve;
+}
+
+wxRect PlotPanel::PlotArea() const {
+  wxSize size = GetClientSize();
+  return wxRect(marginLeft, marginTop,
+                max(1, size.x - marginLeft - marginRight),
+                max(1, size.y - marginTop - marginBottom));
+}
+
+// Frequency axis labels use the unit that suits the visible range
+static wxString FreqLabel(double f, double span) {
+  if (span >= 1e9) return wxString::Format("%gG", f / 1e9);
+  if (span >= 1e6) return wxString::Format("%gM", f / 1e6);
+  if (span >= 1e3) return wxString::Format("%gk", f / 1e3);
+  return wxString::Format("%g", f);
+}
+
+// Round step for about n ticks over span
+static double TickStep(double span, int n) {
+  double raw = span / max(n, 1);
+  double mag = pow(10.0, floor(log10(raw)));
+  double norm = raw / mag;
+  if (norm < 2) return 2 * mag;
+  if (norm < 5) return 5 * mag;
+  return 10 * mag;
+}
+
+void PlotPanel::OnPaint(wxPaintEvent& event) {
+  wxAutoBufferedPaintDC dc(this);
+  dc.SetBackground(*wxWHITE_BRUSH);
+  dc.Clear();
+
+  wxRect area = PlotArea();
+  dc.SetPen(*wxBLACK_PEN);
+  dc.SetBrush(*wxTRANSPARENT_BRUSH);
+  dc.DrawRectangle(area);
+
+  if (SData == NULL || SData->getSData().empty() || pairs.empty() ||
+      !(viewX1 > viewX0)) {
+    dc.DrawText(_("Open an S-parameter file and select port pairs to plot."),
+                area.x + 10, area.y + 10);
+    return;
+  }
+
+  // The y axis fits the visible part of the selected curves
+  double yMin = INFINITY, yMax = -INFINITY;
+  for (auto& p : pairs) {
+    const MinMaxPyramid& curve = Curve(p.first, p.second);
+    size_t first, last;
+    curve.Range(viewX0, viewX1, first, last);
+    // Include the neighbours so lines leaving the view are in range
+    if (first > 0) first--;
+    if (last < curve.size()) last++;
+    if (last <= first) continue;
+    double lo, hi;
+    curve.MinMax(first, last, lo, hi);
+    yMin = min(yMin, lo);
+    yMax = max(yMax, hi);
+  }
+  if (!std::isfinite(yMin) || !std::isfinite(yMax)) return;
+  if (yMax - yMin < 1e-9) {
+    yMin -= 1;
+    yMax += 1;
+  }
+  double pad = 0.05 * (yMax - yMin);
+  yMin -= pad;
+  yMax += pad;
+
+  const double xScale = area.width / (viewX1 - viewX0);
+  const double yScale = area.height / (yMax - yMin);
+  auto px = [&](double f) {
+    return area.x + (int)lround((f - viewX0) * xScale);
+  };
+  auto py = [&](double v) {
+    return area.GetBottom() - (int)lround((v - yMin) * yScale);
+  };
+
+  // Grid and labels
+  dc.SetFont(*wxSMALL_FONT);
+  dc.SetTextForeground(*wxBLACK);
+  wxPen gridPen(wxColour(220, 220, 220), 1, wxPENSTYLE_DOT);
+  double xStep = TickStep(viewX1 - viewX0, max(2, area.width / 100));
+  for (double f = ceil(viewX0 / xStep) * xStep; f <= viewX1; f += xStep) {
+    int x = px(f);
+    dc.SetPen(gridPen);
+    dc.DrawLine(x, area.y, x, area.GetBottom());
+    wxString label = FreqLabel(f, viewX1 - viewX0);
+    wxSize ext = dc.GetTextExtent(label);
+    dc.DrawText(label, x - ext.x / 2, area.GetBottom() + 4);
+  }
+  double yStep = TickStep(yMax - yMin, max(2, area.height / 40));
+  for (double v = ceil(yMin / yStep) * yStep; v <= yMax; v += yStep) {
+    int y = py(v);
+    dc.SetPen(gridPen);
+    dc.DrawLine(area.x, y, area.GetRight(), y);
+    wxString label = wxString::Format("%g", fabs(v) < 1e-12 ? 0.0 : v);
+    wxSize ext = dc.GetTextExtent(label);
+    dc.DrawText(label, area.x - ext.x - 4, y - ext.y / 2);
+  }
+  wxString unit = phase ? _("deg") : _("dB");
+  dc.DrawText(unit, 4, area.y);
+
+  static const wxColour colours[] = {
+      wxColour(0, 90, 200),  wxColour(200, 40, 40),  wxColour(0, 150, 60),
+      wxColour(150, 80, 0),  wxColour(130, 0, 160),  wxColour(0, 150, 150),
+      wxColour(90, 90, 90),  wxColour(220, 120, 0)};
+  const size_t nColours = sizeof(colours) / sizeof(colours[0]);
+  int ports = SData->getSData().front().ports();
+
+  dc.SetClippingRegion(area);
+  int legendY = area.y + 4;
+  for (size_t k = 0; k < pairs.size(); k++) {
+    const MinMaxPyramid& curve = Curve(pairs[k].first, pairs[k].second);
+    wxPen pen(colours[k % nColours], 1);
+    dc.SetPen(pen);
+    size_t first, last;
+    curve.Range(viewX0, viewX1, first, last);
+    if (first > 0) first--;
+    if (last < curve.size()) last++;
+
+    if (last - first <= (size_t)area.width) {
+      // Fewer samples than pixels: draw them all
+      const vector<double>& x = curve.X();
+      const vector<double>& y = curve.Y();
+      for (size_t n = first + 1; n < last; n++) {
+        dc.DrawLine(px(x[n - 1]), py(y[n - 1]), px(x[n]), py(y[n]));
+      }
+    } else {
+      // One vertical min/max line per pixel column, joined to the previous
+      // column where they do not overlap
+      vector<double> lo, hi;
+      curve.Columns(viewX0, viewX1, area.width, lo, hi);
+      int prevLo = 0, prevHi = 0;
+      bool havePrev = false;
+      for (int c = 0; c < area.width; c++) {
+        if (std::isnan(lo[c])) continue;
+        int x = area.x + c;
+        int yLo = py(lo[c]);  // bottom (larger y)
+        int yHi = py(hi[c]);
+        dc.DrawLine(x, yLo, x, yHi - 1);
+        if (havePrev) {
+          if (yLo < prevHi) dc.DrawLine(x - 1, prevHi, x, yLo);
+          if (yHi > prevLo) dc.DrawLine(x - 1, prevLo, x, yHi);
+        }
+        prevLo = yLo;
+        prevHi = yHi;
+        havePrev = true;
+      }
+    }
+
+    wxString name = wxString::Format(ports < 10 ? "S%d%d" : "S%d,%d",
+                                     pairs[k].first + 1, pairs[k].second + 1);
+    dc.SetTextForeground(colours[k % nColours]);
+    dc.DrawText(name, area.GetRight() - 50, legendY);
+    legendY += dc.GetCharHeight();
+  }
+  dc.DestroyClippingRegion();
+}
+
+void PlotPanel::OnSize(wxSizeEvent& event) {
+  Refresh();
+  event.Skip();
+}
+
+void PlotPanel::OnMouseWheel(wxMouseEvent& event) {
+  if (SData == NULL || !(viewX1 > viewX0)) return;
+  wxRect area = PlotArea();
+  double f = viewX0 + (event.GetX() - area.x) * (viewX1 - viewX0) / area.width;
+  f = min(max(f, viewX0), viewX1);
+  double notches = (double)event.GetWheelRotation() / event.GetWheelDelta();
+  double scale = pow(zoomStep, notches);
+  // Do not zoom in beyond a few samples across the plot
+  const vector<Sparam>& data = SData->getSData();
+  double minSpan = 0;
+  if (data.size() > 1)
+    minSpan = 4 * (data.back().Freq - data.front().Freq) / data.size();
+  double span = max((viewX1 - viewX0) * scale, minSpan);
+  scale = span / (viewX1 - viewX0);
+  viewX0 = f - (f - viewX0) * scale;
+  viewX1 = viewX0 + span;
+  ClampView();
+  Refresh();
+}
+
+void PlotPanel::OnLeftDown(wxMouseEvent& event) {
+  dragging = true;
+  dragStart = event.GetX();
+  dragX0 = viewX0;
+  dragX1 = viewX1;
+  CaptureMouse();
+}
+
+void PlotPanel::OnLeftUp(wxMouseEvent& event) {
+  if (!dragging) return;
+  dragging = false;
+  if (HasCapture()) ReleaseMouse();
+}
+
+void PlotPanel::OnMotion(wxMouseEvent& event) {
+  if (!dragging || !event.LeftIsDown()) return;
+  wxRect area = PlotArea();
+  double shift = (dragStart - event.GetX()) * (dragX1 - dragX0) / area.width;
+  viewX0 = dragX0 + shift;
+  viewX1 = dragX1 + shift;
+  ClampView();
+  Refresh();
+}
+
+void PlotPanel::OnLeftDClick(wxMouseEvent& event) { ResetZoom(); }
+
+void PlotPanel::OnCaptureLost(wxMouseCaptureLostEvent& event) {
+  dragging = false;
+}
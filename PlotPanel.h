@@ -0,0 +1,81 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Plot of |Sij| or phase of the loaded S-parameter data.
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+#if !defined(__PLOTPANEL)
+#define __PLOTPANEL
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#include "SObject.h"
+#include "MinMaxPyramid.h"
+
+#include <map>
+#include <utility>
+#include <vector>
+
+// Draws the selected port pairs of an SObject against frequency.  Each
+// curve is drawn from a MinMaxPyramid, one vertical min/max line per pixel
+// column, so large files stay fast at any zoom.  The mouse wheel zooms
+// around the cursor, dragging pans and a double click shows everything.
+class PlotPanel : public wxPanel {
+public:
+  PlotPanel(wxWindow* parent, wxWindowID id = wxID_ANY);
+
+  // Plot the data of SD.  Call with NULL before SD is changed.
+  void SetData(const SObject* SD);
+  // Port pairs (i, j) to draw, 0 based
+  void SetPairs(const std::vector<std::pair<int, int>>& newPairs);
+  // Draw the phase in degrees instead of the magnitude in dB
+  void SetPhase(bool showPhase);
+  void ResetZoom();
+
+private:
+  const SObject* SData;
+  std::vector<std::pair<int, int>> pairs;
+  bool phase;
+  // Curves built so far, keyed by (i * ports + j) * 2 + phase
+  std::map<int, MinMaxPyramid> curves;
+  double viewX0, viewX1;  // visible frequency range in Hz
+  bool dragging;
+  int dragStart;  // mouse x where the drag started
+  double dragX0, dragX1;
+
+  const MinMaxPyramid& Curve(int i, int j);
+  // Part of the window inside the axes
+  wxRect PlotArea() const;
+  // Keep the visible range inside the data
+  void ClampView();
+
+  void OnPaint(wxPaintEvent& event);
+  void OnSize(wxSizeEvent& event);
+  void OnMouseWheel(wxMouseEvent& event);
+  void OnLeftDown(wxMouseEvent& event);
+  void OnLeftUp(wxMouseEvent& event);
+  void OnMotion(wxMouseEvent& event);
+  void OnLeftDClick(wxMouseEvent& event);
+  void OnCaptureLost(wxMouseCaptureLostEvent& event);
+
+  wxDECLARE_EVENT_TABLE();
+};
+
+#endif
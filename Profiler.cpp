@@ -0,0 +1,188 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Per-stage timers and byte/allocation counters for --profile.
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+
+#include "Profiler.h"
+#include "stringformat.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#if defined(_MSC_VER)
+#pragma comment(lib, "psapi.lib")
+#endif
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+
+atomic<bool> Profiler::enabled{false};
+Profiler::Counters Profiler::counters[PROF_STAGES];
+thread_local ProfileScope* ProfileScope::current = nullptr;
+
+void Profiler::Reset() {
+  for (auto& c : counters) {
+    c.ns.store(0, relaxed);
+    c.calls.store(0, relaxed);
+    c.bytes.store(0, relaxed);
+    c.allocs.store(0, relaxed);
+    c.allocBytes.store(0, relaxed);
+  }
+#if defined(__linux__)
+  // Writing 5 resets the peak RSS (VmHWM) of the process
+  FILE* fp = fopen("/proc/self/clear_refs", "w");
+  if (fp != NULL) {
+    fputs("5", fp);
+    fclose(fp);
+  }
+#endif
+}
+
+ProfileRecord Profiler::Snapshot(const string& file, bool ok) {
+  ProfileRecord rec;
+  rec.file = file;
+  rec.ok = ok;
+  for (int s = 0; s < PROF_STAGES; s++) {
+    rec.stages[s].ns = counters[s].ns.load(relaxed);
+    rec.stages[s].calls = counters[s].calls.load(relaxed);
+    rec.stages[s].bytes = counters[s].bytes.load(relaxed);
+    rec.stages[s].allocs = counters[s].allocs.load(relaxed);
+    rec.stages[s].allocBytes = counters[s].allocBytes.load(relaxed);
+  }
+  rec.peakRSS = PeakRSS();
+  return rec;
+}
+
+void Profiler::AddTime(ProfileStage stage, int64_t ns) {
+  counters[stage].ns.fetch_add(ns, relaxed);
+  counters[stage].calls.fetch_add(1, relaxed);
+}
+
+void Profiler::CountAlloc(size_t size) {
+  ProfileScope* scope = ProfileScope::Current();
+  if (scope == nullptr) return;
+  counters[scope->Stage()].allocs.fetch_add(1, relaxed);
+  counters[scope->Stage()].allocBytes.fetch_add(size, relaxed);
+}
+
+const char* Profiler::StageName(ProfileStage stage) {
+  static const char* names[PROF_STAGES] = {"read",      "tokenize",
+                                           "convert",   "h2s",
+                                           "write_lib", "write_asy"};
+  return names[stage];
+}
+
+uint64_t Profiler::PeakRSS() {
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS pmc;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+    return pmc.PeakWorkingSetSize;
+  return 0;
+#else
+#if defined(__linux__)
+  ifstream status("/proc/self/status");
+  string line;
+  while (getline(status, line)) {
+    if (line.compare(0, 6, "VmHWM:") == 0)
+      return strtoull(line.c_str() + 6, NULL, 10) * 1024;
+  }
+#endif
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__)
+  return usage.ru_maxrss;  // bytes
+#else
+  return (uint64_t)usage.ru_maxrss * 1024;  // kilobytes
+#endif
+#endif
+}
+
+void Profiler::WriteText(ostream& out, const ProfileRecord& rec) {
+  out << "Profile of " << rec.file << (rec.ok ? "" : " (failed)") << "\n";
+  out << stringFormat("  %-10s %12s %8s %14s %10s %12s\n", "stage", "time(ms)",
+                      "calls", "bytes", "allocs", "alloc(KB)");
+  int64_t total = 0;
+  for (int s = 0; s < PROF_STAGES; s++) {
+    const ProfileCounters& c = rec.stages[s];
+    total += c.ns;
+    out << stringFormat("  %-10s %12.3f %8llu %14llu %10llu %12.1f\n",
+                        StageName((ProfileStage)s), c.ns / 1e6,
+                        (unsigned long long)c.calls,
+                        (unsigned long long)c.bytes,
+                        (unsigned long long)c.allocs, c.allocBytes / 1024.0);
+  }
+  out << stringFormat("  %-10s %12.3f\n", "total", total / 1e6);
+  out << stringFormat("  peak RSS %.1f MB\n", rec.peakRSS / 1048576.0);
+}
+
+void Profiler::WriteJSON(ostream& out, const vector<ProfileRecord>& records) {
+  out << "{\n  \"files\": [\n";
+  for (size_t i = 0; i < records.size(); i++) {
+    const ProfileRecord& rec = records[i];
+    string file;
+    for (char c : rec.file) {
+      if (c == '"' || c == '\\') file += '\\';
+      file += c;
+    }
+    int64_t total = 0;
+    out << "    {\"file\": \"" << file << "\", \"ok\": "
+        << (rec.ok ? "true" : "false") << ", \"peak_rss\": " << rec.peakRSS
+        << ", \"stages\": {";
+    for (int s = 0; s < PROF_STAGES; s++) {
+      const ProfileCounters& c = rec.stages[s];
+      total += c.ns;
+      out << stringFormat(
+          "%s\"%s\": {\"ms\": %.6f, \"calls\": %llu, \"bytes\": %llu, "
+          "\"allocs\": %llu, \"alloc_bytes\": %llu}",
+          s ? ", " : "", StageName((ProfileStage)s), c.ns / 1e6,
+          (unsigned long long)c.calls, (unsigned long long)c.bytes,
+          (unsigned long long)c.allocs, (unsigned long long)c.allocBytes);
+    }
+    out << stringFormat("}, \"total_ms\": %.6f}%s\n", total / 1e6,
+                        i + 1 < records.size() ? "," : "");
+  }
+  out << "  ]\n}\n";
+}
+
+// Replacement allocation functions so allocations can be charged to the
+// active stage.  They are left out of MSVC debug builds, which rely on the
+// CRT debug heap for leak detection.
+#if !(defined(_MSC_VER) && !defined(NDEBUG))
+void* operator new(size_t size) {
+  if (Profiler::Enabled()) Profiler::CountAlloc(size);
+  void* p = malloc(size ? size : 1);
+  if (p == NULL) throw bad_alloc();
+  return p;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+#endif
@@ -0,0 +1,144 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Per-stage timers and byte/allocation counters for --profile.
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+#if !defined(__PROFILER)
+#define __PROFILER
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// The stages of a conversion.  Time spent in a stage does not include the
+// time of stages nested inside it, so the stage times add up to the total.
+enum ProfileStage {
+  PROF_READ,      // reading and splitting the input lines
+  PROF_TOKENIZE,  // turning the data text into numbers
+  PROF_CONVERT,   // converting records to internal dB/phase
+  PROF_H2S,       // H to S parameter math
+  PROF_WRITE_LIB,
+  PROF_WRITE_ASY,
+  PROF_STAGES
+};
+
+// Totals of one stage
+struct ProfileCounters {
+  int64_t ns = 0;       // exclusive time in nanoseconds
+  uint64_t calls = 0;   // number of times the stage was entered
+  uint64_t bytes = 0;   // bytes read or written by the stage
+  uint64_t allocs = 0;  // heap allocations made inside the stage
+  uint64_t allocBytes = 0;
+};
+
+// Results for one input file
+struct ProfileRecord {
+  std::string file;
+  bool ok = true;
+  ProfileCounters stages[PROF_STAGES];
+  uint64_t peakRSS = 0;  // bytes
+};
+
+class Profiler {
+public:
+  static void Enable(bool on) { enabled.store(on, std::memory_order_relaxed); }
+  static bool Enabled() { return enabled.load(std::memory_order_relaxed); }
+
+  // Start a new set of counters (and, where the OS allows it, a new peak
+  // RSS measurement)
+  static void Reset();
+  // Counters collected since the last Reset()
+  static ProfileRecord Snapshot(const std::string& file, bool ok);
+
+  static void AddTime(ProfileStage stage, int64_t ns);
+  static void AddBytes(ProfileStage stage, uint64_t bytes) {
+    if (Enabled()) counters[stage].bytes.fetch_add(bytes, relaxed);
+  }
+  // Called by the replacement operator new
+  static void CountAlloc(size_t size);
+
+  static const char* StageName(ProfileStage stage);
+  static uint64_t PeakRSS();
+
+  // Human readable table and JSON summary of a batch of files
+  static void WriteText(std::ostream& out, const ProfileRecord& rec);
+  static void WriteJSON(std::ostream& out,
+                        const std::vector<ProfileRecord>& records);
+
+private:
+  static constexpr std::memory_order relaxed = std::memory_order_relaxed;
+  struct Counters {
+    std::atomic<int64_t> ns{0};
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> allocs{0};
+    std::atomic<uint64_t> allocBytes{0};
+  };
+  static std::atomic<bool> enabled;
+  static Counters counters[PROF_STAGES];
+};
+
+// Times the enclosing block as the given stage.  When profiling is off the
+// cost is one relaxed atomic load.
+class ProfileScope {
+public:
+  explicit ProfileScope(ProfileStage s) : stage(s), active(Profiler::Enabled()) {
+    if (!active) return;
+    parent = current;
+    current = this;
+    start = std::chrono::steady_clock::now();
+  }
+  ~ProfileScope() {
+    if (!active) return;
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+    Profiler::AddTime(stage, elapsed - child);
+    if (parent != nullptr) parent->child += elapsed;
+    current = parent;
+  }
+  ProfileScope(const ProfileScope&) = delete;
+  ProfileScope& operator=(const ProfileScope&) = delete;
+
+  // Innermost active scope of the calling thread
+  static ProfileScope* Current() { return current; }
+  ProfileStage Stage() const { return stage; }
+
+private:
+  ProfileStage stage;
+  bool active;
+  ProfileScope* parent = nullptr;
+  int64_t child = 0;  // time spent in nested scopes
+  std::chrono::steady_clock::time_point start;
+  static thread_local ProfileScope* current;
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_SCOPE(stage) \
+  ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(stage)
+
+#endif
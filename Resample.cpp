@@ -0,0 +1,157 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  S-parameter data of several files on one frequency grid.
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+
+#include "Resample.h"
+#include "Scheduler.h"
+#include "Trace.h"
+#include "stringformat.hpp"
+
+#include <algorithm>
+
+using namespace std;
+
+// Frequencies resampled by one task
+static const size_t blockRecords = 256;
+
+vector<double> CommonFrequencies(const vector<const vector<Sparam>*>& sets) {
+  vector<double> freqs;
+  if (sets.empty()) return freqs;
+  double fLow = 0, fHigh = HUGE_VAL;
+  for (auto data : sets) {
+    if (data->empty()) return freqs;
+    fLow = max(fLow, data->front().Freq);
+    fHigh = min(fHigh, data->back().Freq);
+  }
+  for (auto& s : *sets[0]) {
+    if (s.Freq >= fLow && s.Freq <= fHigh) freqs.push_back(s.Freq);
+  }
+  return freqs;
+}
+
+void Resample(const vector<Sparam>& data, const vector<double>& freqs,
+              size_t begin, size_t end, vector<MatrixXcd>& out) {
+  out.resize(end - begin);
+  if (begin >= end) return;
+  // The first record at or above each frequency
+  size_t next = lower_bound(data.begin(), data.end(), freqs[begin],
+                            [](const Sparam& s, double f) {
+                              return s.Freq < f;
+                            }) -
+                data.begin();
+  if (next == data.size()) next--;
+  // The records around the last interpolated frequency, converted once
+  size_t below = data.size();
+  MatrixXcd sBelow, sAbove;
+  for (size_t k = begin; k < end; k++) {
+    const double f = freqs[k];
+    while (next + 1 < data.size() && data[next].Freq < f) next++;
+    if (next == 0 || data[next].Freq <= f) {
+      out[k - begin] = data[next].Scplx();
+      continue;
+    }
+    if (below != next - 1) {
+      sBelow = below == next - 2 ? sAbove : data[next - 1].Scplx();
+      sAbove = data[next].Scplx();
+      below = next - 1;
+    }
+    double t = (f - data[next - 1].Freq) /
+               (data[next].Freq - data[next - 1].Freq);
+    out[k - begin] = sBelow + t * (sAbove - sBelow);
+  }
+}
+
+int ReadResampled(const vector<wxFileName>& names, const ConvertOptions& opts,
+                  SObject& result, vector<unique_ptr<SObject>>& files,
+                  vector<vector<Sparam>>& sets, string& error) {
+  const bool quiet = result.GetQuiet();
+  TaskScheduler* scheduler = result.GetScheduler();
+  // The frequency range applies to the files, the other options to the
+  // model
+  ConvertOptions read;
+  read.output.fMin = opts.output.fMin;
+  read.output.fMax = opts.output.fMax;
+  files.clear();
+  files.resize(names.size());
+  vector<int> codes(names.size(), 0);
+  auto load = [&](size_t m) {
+    files[m].reset(new SObject);
+    files[m]->SetQuiet(quiet);
+    files[m]->SetScheduler(scheduler);
+    wxFileName file = names[m];
+    codes[m] = ReadInput(*files[m], file, read);
+  };
+  if (scheduler != NULL) {
+    TaskGroup group;
+    for (size_t m = 0; m < names.size(); m++)
+      scheduler->Spawn(group, [&load, m] { load(m); });
+    scheduler->Wait(group);
+  } else {
+    for (size_t m = 0; m < names.size(); m++) load(m);
+  }
+  for (int code : codes) {
+    if (code != 0) return code;
+  }
+
+  vector<const vector<Sparam>*> data;
+  for (size_t m = 0; m < files.size() && error.empty(); m++) {
+    SObject& SD = *files[m];
+    string name = SD.getSNPfile().GetFullPath().ToStdString();
+    data.push_back(&SD.getSData());
+    if (SD.nPorts() != files[0]->nPorts())
+      error = stringFormat("%s has %d ports, %s %d", name, SD.nPorts(),
+                           files[0]->getSNPfile().GetFullPath().ToStdString(),
+                           files[0]->nPorts());
+    else if (SD.Zref() != files[0]->Zref())
+      error = stringFormat("%s is referenced to %g ohms, %s to %g", name,
+                           SD.Zref(),
+                           files[0]->getSNPfile().GetFullPath().ToStdString(),
+                           files[0]->Zref());
+  }
+  vector<double> freqs;
+  if (error.empty() && !data.empty()) {
+    freqs = CommonFrequencies(data);
+    if (freqs.empty()) error = "the files have no frequencies in common";
+  }
+  if (!error.empty()) return 11;
+
+  // One pass over the frequencies resamples all files
+  const int ports = files.empty() ? 0 : files[0]->nPorts();
+  sets.assign(files.size(),
+              vector<Sparam>(freqs.size(), Sparam((size_t)ports)));
+  auto body = [&](size_t begin, size_t end) {
+    vector<MatrixXcd> S;
+    for (size_t m = 0; m < sets.size(); m++) {
+      Resample(*data[m], freqs, begin, end, S);
+      for (size_t n = begin; n < end; n++) {
+        sets[m][n].Freq = freqs[n];
+        sets[m][n].cplxStore(S[n - begin]);
+      }
+    }
+  };
+  TRACE_SCOPE("resample");
+  if (scheduler != NULL)
+    scheduler->ParallelFor(freqs.size(), blockRecords, body);
+  else
+    body(0, freqs.size());
+  return 0;
+}
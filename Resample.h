@@ -0,0 +1,71 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  S-parameter data of several files on one frequency grid.
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+#if !defined(__RESAMPLE)
+#define __RESAMPLE
+#if defined(_MSC_VER)
+#pragma once
+// Read files at once (as tasks of the scheduler of result) with the
+// frequency range of opts, check that they have the same ports and
+// reference impedance and resample them in one pass onto the frequencies
+// of the first file that every file covers: sets[m] are those of files[m].
+// Returns 0, 1 if a file cannot be read or 11 with the reason in error.
+// The models of several files (--cascade, --temperature, --monte-carlo)
+// start from this.
+int ReadResampled(const std::vector<wxFileName>& names,
+                  const ConvertOptions& opts, SObject& result,
+                  std::vector<std::unique_ptr<SObject>>& files,
+                  std::vector<std::vector<Sparam>>& sets, std::string& error);
+
+#endif
+
+#include "Convert.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// The frequencies of the first data set that lie within the range of every
+// one of them; empty if they have none in common
+std::vector<double> CommonFrequencies(
+    const std::vector<const std::vector<Sparam>*>& sets);
+
+// The S matrices of data at the frequencies freqs[begin, end), which are
+// ascending and within the range of data, interpolated linearly in the real
+// and imaginary parts.  Frequencies of data are taken as they are.
+void Resample(const std::vector<Sparam>& data,
+              const std::vector<double>& freqs, size_t begin, size_t end,
+              std::vector<MatrixXcd>& out);
+
+// Read files at once (as tasks of the scheduler of result) with the
+// frequency range of opts, check that they have the same ports and
+// reference impedance and resample them in one pass onto the frequencies
+// of the first file that every file covers: sets[m] are those of files[m].
+// Returns 0, 1 if a file cannot be read or 11 with the reason in error.
+// The models of several files (--cascade, --temperature, --monte-carlo)
+// start from this.
+int ReadResampled(const std::vector<wxFileName>& names,
+                  const ConvertOptions& opts, SObject& result,
+                  std::vector<std::unique_ptr<SObject>>& files,
+                  std::vector<std::vector<Sparam>>& sets, std::string& error);
+
+#endif
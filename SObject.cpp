@@ -26,12 +26,163 @@
  ***************************************************************************/
 
 #include "SObject.h"
+#include "Profiler.h"
+#include "Scheduler.h"
+#include "Trace.h"
 #include "stringformat.hpp"
 #include <wx/tokenzr.h>
+#include <wx/mstream.h>
 #include <fstream>
+#include <sstream>
 #include <complex>
 #include <algorithm>
 #include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <atomic>
+#include <cfloat>
+#include <mutex>
+
+// Node numbering multiplier for the internal port nodes of the subcircuit
+static const int npMult = 100;
+
+// Memory StreamLIB() may use to hold formatted rows before spilling them
+static const size_t streamBufferBytes = 16 * 1024 * 1024;
+
+// Work done between two progress reports
+static const size_t progressLines = 4096;
+static const size_t progressRecords = 1024;
+static const size_t progressRows = 16384;
+
+// Smallest work worth splitting into tasks with a scheduler, and the size
+// of each task
+static const size_t parallelBytes = 1024 * 1024;
+static const size_t parallelRecords = 1024;
+static const size_t recordsPerTask = 256;
+static const size_t parallelRows = 16384;
+
+string PartFileName(const string& fileName) {
+  static atomic<unsigned> count(0);
+  return stringFormat("%s.%lu-%u.part", fileName,
+                      (unsigned long)wxGetProcessId(), count++);
+}
+
+// An output file that is written under a temporary name and renamed to its
+// real name by Commit().  Until then the previous file, if any, is left
+// alone, and the temporary file is removed if Commit() is never reached.
+class PartialFile {
+public:
+  explicit PartialFile(const string& fileName)
+      : name(fileName), partName(PartFileName(fileName)), committed(false) {}
+  ~PartialFile() {
+    if (committed) return;
+    if (stream.is_open()) stream.close();
+    wxRemoveFile(partName);
+  }
+  ofstream& Open() {
+    stream.open(partName);
+    return stream;
+  }
+  bool Commit() {
+    stream.close();
+    if (!stream || !wxRenameFile(partName, name, true)) return false;
+    committed = true;
+    return true;
+  }
+
+private:
+  string name;
+  string partName;
+  ofstream stream;
+  bool committed;
+};
+
+bool ModeMatrix(const string& order, int ports, MatrixXd& M, string& error) {
+  istringstream iss(order);
+  vector<string> modes{istream_iterator<string>{iss},
+                       istream_iterator<string>{}};
+  if ((int)modes.size() != ports) {
+    error = stringFormat("%d modes for %d ports", (int)modes.size(), ports);
+    return false;
+  }
+  M = MatrixXd::Zero(ports, ports);
+  for (int m = 0; m < ports; m++) {
+    char kind = (char)toupper((unsigned char)modes[m][0]);
+    int p = 0, n = 0;
+    char extra;
+    bool ok;
+    if (kind == 'S') {
+      ok = sscanf(modes[m].c_str() + 1, "%d%c", &p, &extra) == 1 &&
+           p >= 1 && p <= ports;
+    } else {
+      ok = (kind == 'D' || kind == 'C') &&
+           sscanf(modes[m].c_str() + 1, "%d,%d%c", &p, &n, &extra) == 2 &&
+           p >= 1 && p <= ports && n >= 1 && n <= ports && p != n;
+    }
+    if (!ok) {
+      error = "mode '" + modes[m] + "' unknown";
+      return false;
+    }
+    if (kind == 'S') {
+      M(m, p - 1) = 1;
+    } else {
+      M(m, p - 1) = M_SQRT1_2;
+      M(m, n - 1) = kind == 'D' ? -M_SQRT1_2 : M_SQRT1_2;
+    }
+  }
+  // Each port once and each differential mode with its common mode
+  if (!(M * M.transpose()).isIdentity(1e-12)) {
+    error = "modes '" + order + "' do not cover each port once";
+    return false;
+  }
+  return true;
+}
+
+bool ParseTerminations(const string& spec, int ports, double Z0,
+                       vector<Termination>& terms, string& error) {
+  terms.clear();
+  string list = spec;
+  replace(list.begin(), list.end(), ',', ' ');
+  istringstream iss(list);
+  vector<bool> used(ports, false);
+  string item;
+  while (iss >> item) {
+    size_t eq = item.find('=');
+    int port = 0;
+    char extra;
+    if (sscanf(item.substr(0, eq).c_str(), "%d%c", &port, &extra) != 1 ||
+        port < 1 || port > ports) {
+      error = "port '" + item.substr(0, eq) + "' unknown";
+      return false;
+    }
+    if (used[port - 1]) {
+      error = stringFormat("port %d terminated twice", port);
+      return false;
+    }
+    used[port - 1] = true;
+    double gamma = 0;
+    if (eq != string::npos) {
+      string load = item.substr(eq + 1);
+      double Z = 0;
+      if (load == "open") {
+        gamma = 1;
+      } else if (sscanf(load.c_str(), "%lf%c", &Z, &extra) == 1 && Z >= 0) {
+        gamma = (Z - Z0) / (Z + Z0);
+      } else {
+        error = "load '" + load + "' of port " + item.substr(0, eq) +
+                " unknown";
+        return false;
+      }
+    }
+    terms.push_back(Termination{port - 1, gamma});
+  }
+  if ((int)terms.size() >= ports) {
+    error = "no port left";
+    return false;
+  }
+  return true;
+}
 
 SObject::SObject() {
   Clean();
@@ -40,6 +191,9 @@ SObject::SObject() {
   Z0 = 50;
   be_quiet = false;
   error = false;
+  cancelled = false;
+  input_size = 0;
+  scheduler = NULL;
   // Assume V1.0 until we see otherwise
   Swap = true;
 }
@@ -50,40 +204,61 @@ void SObject::Clean() {
   SData.clear();
   data_strings.clear();
   comment_strings.clear();
+  setParams.clear();
+  setLines.clear();
+  setWeights.clear();
+  setLabels.clear();
+  setData.clear();
   data_saved = true;
   error = false;
 }
 
+bool SObject::Progress(const char* step, double done, uint64_t bytes) {
+  if (cancelled) return false;
+  if (progress && !progress(step, done, bytes)) cancelled = true;
+  return !cancelled;
+}
+
 bool SObject::openSFile(wxWindow* parent) {
+  wxFileName fileName;
+  if (!chooseSFile(parent, fileName)) return false;
+  wxBusyCursor wait;
+  return readSFile(fileName);
+}
+
+const char* SObject::SFileWildcard() {
 #if defined(_WIN32) || defined(_WIN64)
-  char const* WildcardStr =
-      "Touchstone S|*.S?P;*.S??P;*.TS|H paramter (*.hnp)|*.H?P;H??P|All files "
-      "(*.*)|*.*";
+  return "Touchstone S|*.S?P;*.S??P;*.TS|H paramter (*.hnp)|*.H?P;H??P|All "
+         "files (*.*)|*.*";
 #else
   // On non-Windows platforms we try to find mostly snp files but
   // they don't all allow ? as a wildcard
-  char const* WildcardStr = "Touchstone S|*p;*P;*ts;*TS|All files (*)|*";
+  return "Touchstone S|*p;*P;*ts;*TS|All files (*)|*";
 #endif
+}
+
+bool SObject::chooseSFile(wxWindow* parent, wxFileName& fileName) {
   if (!dataSaved()) {
     if (wxMessageBox(
             _("Current content has not been saved!\nDiscard current data?"),
             _("Please confirm"), wxICON_QUESTION | wxYES_NO, parent) == wxNO)
       return false;
   }
-  wxFileDialog openFileDialog(parent, _("Open SnP file"), "", "", WildcardStr,
+  wxFileDialog openFileDialog(parent, _("Open SnP file"), "", "",
+                              SFileWildcard(),
                               wxFD_OPEN | wxFD_FILE_MUST_EXIST);
 
   if (openFileDialog.ShowModal() == wxID_CANCEL)
     return false;  // the user changed idea...
 
-  wxBusyCursor wait;
-  wxFileName fileName = openFileDialog.GetPath();
-  return readSFile(fileName);
+  fileName = openFileDialog.GetPath();
+  return true;
 }
 
 bool SObject::readSFile(wxFileName& SFile) {
   Clean();
   snp_file = SFile;
+  cancelled = false;
 
   InitTargetsAndDefaults(SFile);
 
@@ -99,15 +274,43 @@ bool SObject::readSFile(wxFileName& SFile) {
     return false;
   }
 
+  bool tracing = Trace::Enabled();
+  if (tracing) Trace::Begin("open");
+  wxFileInputStream input_stream(snp_file.GetFullPath());
+  if (tracing) Trace::End("open");
+  if (!input_stream.IsOk()) {
+    wxString mess =
+        wxString::Format(_("%s:%d Cannot open file '%s'."), __FILE__,
+                         __LINE__, snp_file.GetFullPath());
+    return HandleMessage(mess, be_quiet);
+  }
+  input_size = input_stream.GetLength() == wxInvalidOffset
+                   ? 0
+                   : (uint64_t)input_stream.GetLength();
+  return Import(input_stream);
+}
+
+bool SObject::readSFile(wxFileName& SFile, const char* contents,
+                        size_t size) {
+  Clean();
+  snp_file = SFile;
+  cancelled = false;
+
+  InitTargetsAndDefaults(SFile);
+  if (!DeterminePortsAndVersionFromExt()) {
+    return false;
+  }
+
+  wxMemoryInputStream input_stream(contents, size);
+  input_size = size;
+  return Import(input_stream);
+}
+
+bool SObject::Import(wxInputStream& input_stream) {
   {
-    wxFileInputStream input_stream(snp_file.GetFullPath());
-    if (!input_stream.IsOk()) {
-      wxString mess =
-          wxString::Format(_("%s:%d Cannot open file '%s'."), __FILE__,
-                           __LINE__, snp_file.GetFullPath());
-      return HandleMessage(mess, be_quiet);
-    }
     wxTextInputStream text_input(input_stream);
+    TRACE_SCOPE("parse");
+    PROFILE_SCOPE(PROF_READ);
     if (!ParseTouchstone(text_input)) {
       error = true;
       return false;
@@ -118,20 +321,76 @@ bool SObject::readSFile(wxFileName& SFile) {
     error = true;
     return false;
   }
-  if (!ValidateAfterParse()) {
+  if (!ValidateAfterParse() || !PlanModes() || !PlanPorts()) {
     return false;
   }
 
   if (Convert2S()) {
     data_saved = true;
     data_strings.clear();
+    ConvertPorts();
+    if (output.fMin > 0 || output.fMax > 0) {
+      SData.erase(remove_if(SData.begin(), SData.end(),
+                            [this](const Sparam& s) {
+                              return !InFrequencyRange(s.Freq);
+                            }),
+                  SData.end());
+      if (SData.empty()) {
+        wxString mess = wxString::Format(
+            _("%s:%d %s has no frequencies between %g and %g Hz."), __FILE__,
+            __LINE__, snp_file.GetFullPath(), output.fMin,
+            output.fMax > 0 ? output.fMax : HUGE_VAL);
+        return HandleMessage(mess, be_quiet);
+      }
+    }
     return true;
   } else {
+    // Nothing of a cancelled import is kept
+    if (cancelled) {
+      Clean();
+      return false;
+    }
     data_saved = false;
     return false;
   }
 }
 
+bool SObject::SetData(const wxFileName& fileName, const SObject& like,
+                      int ports, vector<Sparam>& data,
+                      const wxArrayString& comments) {
+  Clean();
+  snp_file = fileName;
+  cancelled = false;
+  InitTargetsAndDefaults(fileName);
+  inputFormat = like.inputFormat;
+  fUnits = like.fUnits;
+  Z0 = like.Z0;
+  Ver = like.Ver;
+  option_string = like.option_string;
+  numPorts = ports;
+  comment_strings = comments;
+  SData.swap(data);
+  data.clear();
+  data_saved = false;
+  if (!PlanModes() || !PlanPorts()) return false;
+  ConvertPorts();
+  return true;
+}
+
+void SObject::SetWeightedSets(const string& params,
+                              const vector<string>& lines,
+                              const vector<string>& weights,
+                              const vector<string>& labels,
+                              vector<vector<Sparam>>& others) {
+  setParams = params;
+  setLines = lines;
+  setWeights = weights;
+  setLabels = labels;
+  setData.swap(others);
+  others.clear();
+  for (auto& set : setData) ConvertPorts(set);
+}
+
 void SObject::InitTargetsAndDefaults(const wxFileName& SFile) {
   lib_file = SFile;
   asy_file = SFile;
@@ -147,10 +406,17 @@ void SObject::InitTargetsAndDefaults(const wxFileName& SFile) {
   lib_file.SetExt("inc");
   asy_file.SetName(lib_name);
   asy_file.SetExt("asy");
+  if (!output.libFile.IsEmpty()) lib_file = wxFileName(output.libFile);
+  if (!output.asyFile.IsEmpty()) asy_file = wxFileName(output.asyFile);
 
   inputFormat = "MAG";  // default mag/angle
   fUnits = 1e9;         // default GHz
   parameterType = "S";
+  matrixFormat = MATRIX_FULL;
+  inputModes.clear();
+  modeMatrix.resize(0, 0);
+  keptPorts.clear();
+  terminations.clear();
   numPorts = 2;  // default to 2 ports (may be overridden)
   Z0 = 50;
   Ver = 1.0;    // Assume version 1.0 until found otherwise
@@ -189,17 +455,27 @@ bool SObject::DeterminePortsAndVersionFromExt() {
   return HandleMessage(mess, be_quiet);
 }
 
-bool SObject::ParseTouchstone(wxTextInputStream& text_input) {
+bool SObject::ParseTouchstone(wxTextInputStream& text_input,
+                              const DataSink& sink) {
   bool Trigger = false;
+  size_t data_length = 0;
   // re-init containers just in case
   comment_strings.Empty();
   option_string.Clear();
   data_strings.clear();
 
   wxString line;
+  uint64_t bytes_read = 0;
+  size_t lines = 0;
   while (!text_input.GetInputStream().Eof()) {
+    if (++lines % progressLines == 0 &&
+        !Progress("Reading",
+                  input_size ? (double)bytes_read / input_size : 0.0,
+                  bytes_read))
+      return false;
     line.Empty();
     line = text_input.ReadLine();
+    bytes_read += line.length() + 1;
     line.Trim();
     line.Trim(wxFalse);
 
@@ -293,7 +569,13 @@ bool SObject::ParseTouchstone(wxTextInputStream& text_input) {
     }
     if (line.StartsWith("[Matrix Format]")) {
       wxString matrix_format_str = line.AfterFirst(']').Trim().Trim(wxFalse);
-      if (!(matrix_format_str.StartsWith("Full"))) {
+      if (matrix_format_str.StartsWith("Full")) {
+        matrixFormat = MATRIX_FULL;
+      } else if (matrix_format_str.StartsWith("Lower")) {
+        matrixFormat = MATRIX_LOWER;
+      } else if (matrix_format_str.StartsWith("Upper")) {
+        matrixFormat = MATRIX_UPPER;
+      } else {
         wxString mess =
             wxString::Format(_("%s:%d SObject::ParseTouchstone:Cannot process file "
                                "'%s'. [Matrix Format] Unknown"),
@@ -303,19 +585,23 @@ bool SObject::ParseTouchstone(wxTextInputStream& text_input) {
       continue;
     }
     if (line.StartsWith("[Mixed Mode Order]")) {
-      wxString mess =
-          wxString::Format(_("%s:%d SObject::ParseTouchstone:Cannot Process file "
-                             "'%s'.[Mixed Mode Order] Not supported"),
-                           __FILE__, __LINE__, snp_file.GetFullPath());
-      return HandleMessage(mess, be_quiet);
+      inputModes = line.AfterFirst(']').Trim().Trim(wxFalse).ToStdString();
+      continue;
     }
     if (Trigger) {
+      data_length += line.length() + 1;
+      if (sink) {
+        if (!sink(line)) return false;
+        continue;
+      }
       data_strings.append(line.ToStdString());
       data_strings.append(" ");
     }
   }
 
-  if (data_strings.length() < 2) {
+  Profiler::AddBytes(PROF_READ, bytes_read);
+
+  if (data_length < 2) {
     wxString mess = wxString::Format(
         _("%s:%d SObject::ParseTouchstone:Cannot process file '%s'."), __FILE__,
         __LINE__, snp_file.GetFullPath());
@@ -369,6 +655,11 @@ bool SObject::ValidateAfterParse() const {
 }
 
 bool SObject::writeLibFile(wxWindow* parent) {
+  if (!confirmLibFile(parent)) return false;
+  return WriteLIB();
+}
+
+bool SObject::confirmLibFile(wxWindow* parent) {
   if (lib_file.FileExists() && !GetForce()) {
     wxString mess = wxString::Format(_("Library file '%s' exists. Overwrite?"),
                                      lib_file.GetFullPath());
@@ -376,7 +667,7 @@ bool SObject::writeLibFile(wxWindow* parent) {
                      parent) == wxNO)
       return false;
   }
-  return WriteLIB();
+  return true;
 }
 
 // Convert the stored S-parameter data (dB/phase) format
@@ -405,24 +696,356 @@ void SObject::Convert2Input(double& A, double& B) {
 }
 
 bool SObject::WriteLIB() {
+  TRACE_SCOPE("write LIB");
+  PROFILE_SCOPE(PROF_WRITE_LIB);
   string libName(lib_file.GetFullPath().ToStdString());
-  int npMult = 100;
+  cancelled = false;
+  if (!CheckLIBType()) return false;
+
+  PartialFile lib(libName);
+  ofstream& output_stream = lib.Open();
+  if (!output_stream) {
+    wxString mess =
+        wxString::Format(_("%s:%d SObject::WriteLIB:Cannot create file '%s'."),
+                         __FILE__, __LINE__, libName);
+    return HandleMessage(mess, be_quiet);
+  }
+  if (!WriteLIBBody(output_stream)) return false;
+  if (!lib.Commit()) {
+    wxString mess =
+        wxString::Format(_("%s:%d SObject::WriteLIB:Cannot write file '%s'."),
+                         __FILE__, __LINE__, libName);
+    return HandleMessage(mess, be_quiet);
+  }
+  data_saved = true;
+  return !error;
+}
+
+bool SObject::FormatLIB(string& contents) {
+  TRACE_SCOPE("format LIB");
+  PROFILE_SCOPE(PROF_WRITE_LIB);
+  cancelled = false;
+  if (!CheckLIBType()) return false;
+  ostringstream output_stream;
+  if (!WriteLIBBody(output_stream)) return false;
+  contents = output_stream.str();
+  return !error;
+}
+
+bool SObject::CheckLIBType() {
   if (parameterType.compare("S") != 0) {
     wxString mess = wxString::Format(
         _("%s:%d SObject::WriteLIB:Cannot handle %s format data file."),
         __FILE__, __LINE__, wxString(parameterType));
     return HandleMessage(mess, be_quiet);
   }
+  return true;
+}
 
-  ofstream output_stream(libName);
-  if (!output_stream) {
-    wxString mess =
-        wxString::Format(_("%s:%d SObject::WriteLIB:Cannot create file '%s'."),
-                         __FILE__, __LINE__, libName);
-    return HandleMessage(mess, be_quiet);
+bool SObject::WriteLIBBody(ostream& output_stream) {
+  PlanTables(true);
+  if (!setWeights.empty()) return WriteWeightedBody(output_stream);
+  if (scheduler != NULL &&
+      (size_t)numPorts * numPorts * SData.size() >= parallelRows)
+    return WriteLIBTablesParallel(output_stream);
+  size_t nTables = count(libTables.begin(), libTables.end(), TABLE_OWN) +
+                   count(libTables.begin(), libTables.end(), TABLE_SHARED);
+  const double totalRows = (double)nTables * SData.size();
+  size_t rows = 0;
+  // Shared tables are subcircuits of their own, ahead of the one using them
+  for (int i = 0; i < numPorts; i++) {
+    for (int j = 0; j < numPorts; j++) {
+      if (libTables[i * numPorts + j] != TABLE_SHARED) continue;
+      WriteSharedTableHeader(output_stream, i, j);
+      for (auto s = SData.begin(); s != SData.end(); s++) {
+        output_stream << LIBRow(*s, i, j);
+        if (++rows % progressRows == 0 &&
+            !Progress("Writing LIB", rows / totalRows,
+                      (uint64_t)output_stream.tellp()))
+          return false;
+      }
+      WriteSharedTableFooter(output_stream, i, j);
+    }
+  }
+  WriteLIBHeader(output_stream);
+  for (int i = 0; i < numPorts; i++) {
+    for (int j = 0; j < numPorts; j++) {
+      if (libTables[i * numPorts + j] != TABLE_OWN) {
+        WriteLIBTableRef(output_stream, i, j);
+        continue;
+      }
+      WriteLIBTableHeader(output_stream, i, j);
+      for (auto s = SData.begin(); s != SData.end(); s++) {
+        output_stream << LIBRow(*s, i, j);
+        if (++rows % progressRows == 0 &&
+            !Progress("Writing LIB", rows / totalRows,
+                      (uint64_t)output_stream.tellp()))
+          return false;
+      }
+    }
+    output_stream << "\n";
+  }
+  WriteLIBFooter(output_stream);
+  Profiler::AddBytes(PROF_WRITE_LIB, output_stream.tellp());
+  return true;
+}
+
+// Each table is formatted by a task.  To bound the memory, a few tables
+// per worker are formatted at a time and written in order before the next.
+bool SObject::WriteLIBTablesParallel(ostream& output_stream) {
+  const size_t nTables = (size_t)numPorts * numPorts;
+  const size_t window = 2 * scheduler->Threads();
+  vector<size_t> shared, all;
+  for (size_t k = 0; k < nTables; k++) {
+    if (libTables[k] == TABLE_SHARED) shared.push_back(k);
+    all.push_back(k);
+  }
+  const double total = (double)(shared.size() + all.size());
+  size_t done = 0;
+  vector<string> tables;
+  // The shared tables in their own subcircuits, or those of the subcircuit
+  auto writeTables = [&](const vector<size_t>& list, bool own) {
+    for (size_t first = 0; first < list.size(); first += window) {
+      size_t count = min(window, list.size() - first);
+      tables.assign(count, string());
+      scheduler->ParallelFor(count, 1, [&](size_t begin, size_t end) {
+        for (size_t t = begin; t < end; t++) {
+          size_t k = list[first + t];
+          int i = (int)(k / numPorts), j = (int)(k % numPorts);
+          ostringstream table;
+          if (own && libTables[k] != TABLE_OWN) {
+            WriteLIBTableRef(table, i, j);
+            tables[t] = table.str();
+            continue;
+          }
+          if (own)
+            WriteLIBTableHeader(table, i, j);
+          else
+            WriteSharedTableHeader(table, i, j);
+          for (auto s = SData.begin(); s != SData.end(); s++)
+            table << LIBRow(*s, i, j);
+          if (!own) WriteSharedTableFooter(table, i, j);
+          tables[t] = table.str();
+        }
+      });
+      for (size_t t = 0; t < count; t++) {
+        output_stream << tables[t];
+        if (own && list[first + t] % numPorts == (size_t)numPorts - 1)
+          output_stream << "\n";
+      }
+      done += count;
+      if (!Progress("Writing LIB", done / total,
+                    (uint64_t)output_stream.tellp()))
+        return false;
+    }
+    return true;
+  };
+  if (!writeTables(shared, false)) return false;
+  WriteLIBHeader(output_stream);
+  if (!writeTables(all, true)) return false;
+  WriteLIBFooter(output_stream);
+  Profiler::AddBytes(PROF_WRITE_LIB, output_stream.tellp());
+  return true;
+}
+
+// Every S_ij is the sum of a source per set, with the table of that set,
+// scaled by the weight of the set.  Like the tables of WriteLIBBody(), the
+// tables are formatted a few per worker at a time if there is a scheduler.
+bool SObject::WriteWeightedBody(ostream& output_stream) {
+  const size_t nSets = setWeights.size();
+  const size_t nTables = (size_t)numPorts * numPorts * nSets;
+  WriteLIBHeader(output_stream);
+  for (auto& line : setLines) output_stream << line << "\n";
+  if (!setLines.empty()) output_stream << "\n";
+  // Table t is that of set t % nSets for S_ij at t / nSets
+  auto formatTable = [&](size_t t) {
+    size_t k = t % nSets;
+    int i = (int)(t / nSets / numPorts), j = (int)(t / nSets % numPorts);
+    ostringstream table;
+    if (libTables[i * numPorts + j] != TABLE_OWN) {
+      if (k == 0) WriteLIBTableRef(table, i, j);
+      return table.str();
+    }
+    table << stringFormat("* S%d%d FREQ %s (%s)\n ", i + 1, j + 1,
+                          inputFormat, setLabels[k]);
+    string weight = setWeights[k] == "1" ? "" : "*" + setWeights[k];
+    table << stringFormat("G%02d%02d_%d %d %d FREQ {V(%d,%d)%s}= %s\n",
+                          i + 1, j + 1, (int)k + 1, numPorts + 1,
+                          npMult * (i + 1), npMult * (j + 1), numPorts + 1,
+                          weight, inputFormat);
+    const vector<Sparam>& set = k == 0 ? SData : setData[k - 1];
+    for (auto s = set.begin(); s != set.end(); s++)
+      table << LIBRow(*s, i, j);
+    return table.str();
+  };
+  const size_t window =
+      scheduler != NULL ? 2 * (size_t)scheduler->Threads() : 1;
+  vector<string> tables;
+  for (size_t first = 0; first < nTables; first += window) {
+    size_t count = min(window, nTables - first);
+    tables.assign(count, string());
+    if (scheduler != NULL) {
+      scheduler->ParallelFor(count, 1, [&](size_t begin, size_t end) {
+        for (size_t t = begin; t < end; t++)
+          tables[t] = formatTable(first + t);
+      });
+    } else {
+      tables[0] = formatTable(first);
+    }
+    for (size_t t = 0; t < count; t++) {
+      output_stream << tables[t];
+      // A blank line after the tables into each port
+      if ((first + t + 1) % (nSets * numPorts) == 0) output_stream << "\n";
+    }
+    if (!Progress("Writing LIB", (first + count) / (double)nTables,
+                  (uint64_t)output_stream.tellp()))
+      return false;
+  }
+  WriteLIBFooter(output_stream);
+  Profiler::AddBytes(PROF_WRITE_LIB, output_stream.tellp());
+  return true;
+}
+
+// Merge the largest |S_ij| of s into peak and, if err is given, the largest
+// relative difference between S_ij and S_ji
+static void TrackRecord(const Sparam& s, ArrayXXd& peak, ArrayXXd* err) {
+  MatrixXcd c = s.Scplx();
+  ArrayXXd mag = c.cwiseAbs().array();
+  peak = peak.max(mag);
+  if (err == NULL || s.symmetric) return;
+  ArrayXXd diff = (c - c.transpose()).cwiseAbs().array();
+  *err = err->max(diff / mag.max(mag.transpose()).max(DBL_MIN));
+}
+
+void SObject::ResetTables() {
+  reciprocalError = ArrayXXd::Zero(numPorts, numPorts);
+  peakMag = ArrayXXd::Zero(numPorts, numPorts);
+}
+
+void SObject::TrackTables(const Sparam& s) {
+  if (output.reciprocal <= 0 && output.prune == 0) return;
+  TrackRecord(s, peakMag, output.reciprocal > 0 ? &reciprocalError : NULL);
+}
+
+void SObject::PlanTables(bool fromData) {
+  libTables.assign((size_t)numPorts * numPorts, TABLE_OWN);
+  if (output.reciprocal <= 0 && output.prune == 0) return;
+  if (fromData) {
+    ResetTables();
+    if (scheduler != NULL && SData.size() >= parallelRecords) {
+      mutex lock;
+      scheduler->ParallelFor(
+          SData.size(), recordsPerTask, [&](size_t begin, size_t end) {
+            ArrayXXd peak = ArrayXXd::Zero(numPorts, numPorts);
+            ArrayXXd err = ArrayXXd::Zero(numPorts, numPorts);
+            for (size_t n = begin; n < end; n++)
+              TrackRecord(SData[n], peak, output.reciprocal > 0 ? &err : NULL);
+            lock_guard<mutex> hold(lock);
+            peakMag = peakMag.max(peak);
+            reciprocalError = reciprocalError.max(err);
+          });
+    } else {
+      for (auto& s : SData) TrackTables(s);
+    }
+    // A table of weighted sets is left out only if small in every set
+    for (auto& set : setData) {
+      for (auto& s : set) TrackTables(s);
+    }
+  }
+  if (output.prune != 0) {
+    // The level is in dB below 1, whichever sign it was given with
+    const double level = pow(10.0, -fabs(output.prune) / 20);
+    for (size_t k = 0; k < libTables.size(); k++) {
+      if (peakMag(k / numPorts, k % numPorts) < level)
+        libTables[k] = TABLE_PRUNED;
+    }
+  }
+  // The sources of weighted sets each have their own tables
+  if (output.reciprocal <= 0 || !setWeights.empty()) return;
+  for (int i = 0; i < numPorts; i++) {
+    for (int j = 0; j < i; j++) {
+      if (libTables[i * numPorts + j] != TABLE_OWN ||
+          libTables[j * numPorts + i] != TABLE_OWN ||
+          !(reciprocalError(i, j) <= output.reciprocal))
+        continue;
+      libTables[i * numPorts + j] = TABLE_SHARED;
+      libTables[j * numPorts + i] = TABLE_MIRROR;
+    }
   }
-  output_stream << ".SUBCKT " << lib_file.GetName() << " ";
+}
+
+// Which tables were left out and the largest error that introduces: the
+// largest pruned |S_ij|, and the largest sum of them into one port (an
+// upper bound on the error of the wave leaving it)
+void SObject::WritePruneReport(ostream& output_stream) const {
+  size_t pruned = count(libTables.begin(), libTables.end(), TABLE_PRUNED);
+  if (pruned == 0) return;
+  double worst = 0, worstRow = 0;
+  vector<string> terms;
+  for (int i = 0; i < numPorts; i++) {
+    double row = 0;
+    for (int j = 0; j < numPorts; j++) {
+      if (libTables[i * numPorts + j] != TABLE_PRUNED) continue;
+      terms.push_back(stringFormat("S%d%d", i + 1, j + 1));
+      worst = max(worst, peakMag(i, j));
+      row += peakMag(i, j);
+    }
+    worstRow = max(worstRow, row);
+  }
+  output_stream << stringFormat("* %d of %d tables below -%g dB left out:",
+                                (int)pruned, numPorts * numPorts,
+                                fabs(output.prune));
+  for (size_t t = 0; t < terms.size(); t++) {
+    if (t % 12 == 0) output_stream << "\n*";
+    output_stream << " " << terms[t];
+  }
+  output_stream << "\n";
+  output_stream << stringFormat(
+      "* Worst case error: %.1f dB per term, %.1f dB into one port\n",
+      20 * log10(max(worst, DBL_MIN)), 20 * log10(max(worstRow, DBL_MIN)));
+}
+
+// The subcircuit of a shared table has the pins reference, output and input
+string SObject::SharedTableName(int i, int j) const {
+  return stringFormat("%s_S%02d%02d", SubcktName(), i + 1, j + 1);
+}
+
+void SObject::WriteSharedTableHeader(ostream& output_stream, int i,
+                                     int j) const {
+  output_stream << ".SUBCKT " << SharedTableName(i, j) << " 1 2 3\n";
+  output_stream << stringFormat("* S%d%d and S%d%d FREQ %s\n ", i + 1, j + 1,
+                                j + 1, i + 1, inputFormat);
+  output_stream << stringFormat("G1 1 2 FREQ {V(3,1)}= %s\n", inputFormat);
+}
+
+void SObject::WriteSharedTableFooter(ostream& output_stream, int i,
+                                     int j) const {
+  output_stream << ".ENDS ; " << SharedTableName(i, j) << "\n\n";
+}
+
+void SObject::WriteLIBTableRef(ostream& output_stream, int i, int j) const {
+  if (libTables[i * numPorts + j] == TABLE_PRUNED) {
+    output_stream << stringFormat("* S%d%d left out, at most %.1f dB\n",
+                                  i + 1, j + 1,
+                                  20 * log10(max(peakMag(i, j), DBL_MIN)));
+    return;
+  }
+  output_stream << stringFormat("* S%d%d FREQ %s\n ", i + 1, j + 1,
+                                inputFormat);
+  output_stream << stringFormat(
+      "X%02d%02d %d %d %d %s\n", i + 1, j + 1, numPorts + 1, npMult * (i + 1),
+      npMult * (j + 1), SharedTableName(max(i, j), min(i, j)));
+}
+
+string SObject::SubcktName() const {
+  if (!output.subckt.empty()) return output.subckt;
+  return lib_file.GetName().ToStdString();
+}
+
+void SObject::WriteLIBHeader(ostream& output_stream) const {
+  output_stream << ".SUBCKT " << SubcktName() << " ";
   for (int i = 0; i < numPorts + 1; i++) output_stream << " " << i + 1;
+  if (!setParams.empty()) output_stream << " PARAMS: " << setParams;
   output_stream << "\n";
   output_stream
       << "* Pin " << numPorts + 1
@@ -438,6 +1061,24 @@ bool SObject::WriteLIB() {
     output_stream << " Z" << i + 1 << " = " << Z0;
   }
   output_stream << "\n";
+  if (!inputModes.empty())
+    output_stream << "* Mixed mode order of the file: " << inputModes << "\n";
+  if (!output.mixedMode.empty()) {
+    output_stream << "* Ports in order are the modes " << output.mixedMode
+                  << "\n";
+  }
+  if (!terminations.empty()) {
+    output_stream << "* Ports in order are ports";
+    for (int p : keptPorts) output_stream << " " << p + 1;
+    output_stream << " of the data; terminated: " << output.terminate << "\n";
+  }
+  size_t shared = count(libTables.begin(), libTables.end(), TABLE_SHARED);
+  if (shared > 0) {
+    output_stream << stringFormat(
+        "* %d reciprocal port pairs share one table (tolerance %g)\n",
+        (int)shared, output.reciprocal);
+  }
+  WritePruneReport(output_stream);
 
   /* define resistances for Spice model */
 
@@ -449,31 +1090,336 @@ bool SObject::WriteLIB() {
   }
 
   output_stream << "\n";
+}
+
+void SObject::WriteLIBTableHeader(ostream& output_stream, int i, int j) const {
+  output_stream << stringFormat("* S%d%d FREQ %s\n ", i + 1, j + 1,
+                                inputFormat);
+  output_stream << stringFormat(
+      "G%02d%02d %d %d FREQ {V(%d,%d)}= %s\n", i + 1, j + 1, numPorts + 1,
+      npMult * (i + 1), npMult * (j + 1), numPorts + 1, inputFormat);
+}
+
+string SObject::LIBRow(const Sparam& s, int i, int j) {
+  double A = s.dBAt(i, j);
+  A = A - 20 * log10(2 * Z0);
+  double B = s.phaseAt(i, j);
+  Convert2Input(A, B);
+  if (output.precision > 0) {
+    int w = output.precision + 8;
+    return stringFormat("+(%*.*eHz,%*.*e,%*.*e)\n", w, output.precision,
+                        s.Freq, w, output.precision, A, w, output.precision,
+                        B);
+  }
+  return stringFormat("+(%14eHz,%14e,%14e)\n", s.Freq, A, B);
+}
+
+void SObject::WriteLIBFooter(ostream& output_stream) const {
+  output_stream << ".ENDS ; " << SubcktName() << "\n";
+}
+
+// Spill area used by StreamLIB().  The LIB file lists every frequency of
+// table (1,1) before table (1,2) but the Touchstone file delivers all tables
+// of one frequency at a time.  Rows are therefore collected for a chunk of
+// frequencies, grouped by table, and each chunk is appended to a temporary
+// file.  Every row has the same width so a table's rows can be read back
+// from each chunk with a single seek.
+class LIBSpill {
+public:
+  LIBSpill(size_t nTables, size_t budget)
+      : tables(nTables),
+        budget(budget),
+        rowLen(0),
+        chunkRows(0),
+        filled(0),
+        fp(NULL) {}
+  ~LIBSpill() {
+    if (fp != NULL) fclose(fp);
+    if (!tmpName.IsEmpty()) wxRemoveFile(tmpName);
+  }
+  bool Open() {
+    tmpName = wxFileName::CreateTempFileName("s2spice");
+    if (tmpName.IsEmpty()) return false;
+    fp = fopen(tmpName.mb_str(), "w+b");
+    return fp != NULL;
+  }
+  // Store the row for one table of the current frequency
+  bool AddRow(size_t table, const string& row) {
+    if (rowLen == 0) {
+      rowLen = row.length();
+      chunkRows = max<size_t>(1, budget / (tables * rowLen));
+      buffer.resize(tables * chunkRows * rowLen);
+    }
+    if (row.length() != rowLen) return false;
+    memcpy(&buffer[(table * chunkRows + filled) * rowLen], row.data(), rowLen);
+    return true;
+  }
+  // All tables of the current frequency have been stored
+  bool EndRecord() {
+    if (++filled < chunkRows) return true;
+    return Flush();
+  }
+  bool Flush() {
+    if (filled == 0) return true;
+    chunks.push_back(filled);
+    size_t len = buffer.size();
+    filled = 0;
+    return fwrite(buffer.data(), 1, len, fp) == len;
+  }
+  // Append all rows of one table to the output in frequency order
+  bool CopyTable(size_t table, ostream& out) {
+    long long chunkOffset = 0;
+    long long chunkLen = (long long)tables * chunkRows * rowLen;
+    for (auto n : chunks) {
+      long long offset = chunkOffset + (long long)table * chunkRows * rowLen;
+      if (Seek(offset) != 0) return false;
+      size_t len = n * rowLen;
+      if (fread(&buffer[0], 1, len, fp) != len) return false;
+      out.write(buffer.data(), len);
+      chunkOffset += chunkLen;
+    }
+    return true;
+  }
+
+private:
+  int Seek(long long offset) {
+#if defined(_MSC_VER)
+    return _fseeki64(fp, offset, SEEK_SET);
+#else
+    return fseeko(fp, (off_t)offset, SEEK_SET);
+#endif
+  }
+  size_t tables;     // number of (i,j) tables
+  size_t budget;     // bytes of rows held in memory
+  size_t rowLen;     // every row has this width
+  size_t chunkRows;  // frequencies per chunk
+  size_t filled;     // frequencies in the current chunk
+  vector<char> buffer;
+  vector<size_t> chunks;  // number of frequencies in each spilled chunk
+  wxString tmpName;
+  FILE* fp;
+};
+
+bool SObject::StreamLIB(wxFileName& SFile) {
+  Clean();
+  snp_file = SFile;
+  cancelled = false;
+
+  InitTargetsAndDefaults(SFile);
+
+  if (!snp_file.FileExists()) {
+    wxString mess = wxString::Format(_("[%s:%d]\nFile '%s' does not exist.\n"
+                                       "Current working directory: '%s'"),
+                                     __FILE__, __LINE__, snp_file.GetFullPath(),
+                                     wxGetCwd());
+    return HandleMessage(mess, be_quiet);
+  }
+
+  if (!DeterminePortsAndVersionFromExt()) {
+    return false;
+  }
+
+  // Ports are only terminated with the data in memory
+  if (!output.terminate.empty()) {
+    wxString mess = wxString::Format(
+        _("%s:%d SObject::StreamLIB:Cannot terminate ports of '%s' while "
+          "streaming."),
+        __FILE__, __LINE__, snp_file.GetFullPath());
+    return HandleMessage(mess, be_quiet);
+  }
+
+  if (lib_file.Exists() && !GetForce()) {
+    wxString mess = wxString::Format(
+        _("%s:%d LIB file %s already exists.  Delete it first."), __FILE__,
+        __LINE__, lib_file.GetFullPath());
+    return HandleMessage(mess, be_quiet);
+  }
+
+  std::unique_ptr<LIBSpill> spill;
+  vector<double> record;
+  size_t recLen = 0;
+  size_t nValues = 0;
+  int nFrequencies = 0;
+  int nWritten = 0;  // within the frequency range
+  double prevFreq = 0;
+  Sparam S;
+
+  // Each data line is tokenized as it arrives and every completed frequency
+  // record is converted and formatted straight into the spill area.
+  auto sink = [&](const wxString& line) -> bool {
+    PROFILE_SCOPE(PROF_TOKENIZE);
+    Profiler::AddBytes(PROF_TOKENIZE, line.length() + 1);
+    if (!spill) {
+      // The option line precedes the data so the header is complete now
+      if (!ParseOptionsFromHeader() || !ValidateAfterParse() || !PlanModes())
+        return false;
+      recLen = RecordLength();
+      record.resize(recLen);
+      S = NewRecord();
+      ResetTables();
+      spill.reset(DBG_NEW LIBSpill(numPorts * numPorts, streamBufferBytes));
+      if (!spill->Open()) {
+        wxString mess = wxString::Format(
+            _("%s:%d SObject::StreamLIB:Cannot create temporary file."),
+            __FILE__, __LINE__);
+        return HandleMessage(mess, be_quiet);
+      }
+    }
+    istringstream iss(line.ToStdString());
+    string token;
+    while (iss >> token) {
+      try {
+        record[nValues] = stod(token);
+      } catch (std::invalid_argument const& ex) {
+        wxString mess = wxString::Format(
+            "%s:%d WARNING: %s contains invalid non-numeric characters",
+            __FILE__, __LINE__, snp_file.GetFullPath());
+        return HandleMessage(mess, be_quiet);
+      }
+      if (++nValues < recLen) continue;
+      nValues = 0;
+      {
+        PROFILE_SCOPE(PROF_CONVERT);
+        if (!ConvertRecord(record.data(), S, prevFreq)) return false;
+        if (modeMatrix.size() > 0) TransformModes(&S, 1);
+      }
+      nFrequencies++;
+      if (!InFrequencyRange(S.Freq)) continue;
+      nWritten++;
+      TrackTables(S);
+      PROFILE_SCOPE(PROF_WRITE_LIB);
+      for (int i = 0; i < numPorts; i++) {
+        for (int j = 0; j < numPorts; j++) {
+          if (!spill->AddRow(i * numPorts + j, LIBRow(S, i, j))) {
+            wxString mess = wxString::Format(
+                _("%s:%d SObject::StreamLIB:Write to temporary file failed."),
+                __FILE__, __LINE__);
+            return HandleMessage(mess, be_quiet);
+          }
+        }
+      }
+      if (!spill->EndRecord()) {
+        wxString mess = wxString::Format(
+            _("%s:%d SObject::StreamLIB:Write to temporary file failed."),
+            __FILE__, __LINE__);
+        return HandleMessage(mess, be_quiet);
+      }
+    }
+    return true;
+  };
+
+  {
+    bool tracing = Trace::Enabled();
+    if (tracing) Trace::Begin("open");
+    wxFileInputStream input_stream(snp_file.GetFullPath());
+    if (tracing) Trace::End("open");
+    if (!input_stream.IsOk()) {
+      wxString mess =
+          wxString::Format(_("%s:%d Cannot open file '%s'."), __FILE__,
+                           __LINE__, snp_file.GetFullPath());
+      return HandleMessage(mess, be_quiet);
+    }
+    input_size = input_stream.GetLength() == wxInvalidOffset
+                     ? 0
+                     : (uint64_t)input_stream.GetLength();
+    wxTextInputStream text_input(input_stream);
+    TRACE_SCOPE("stream LIB");
+    PROFILE_SCOPE(PROF_READ);
+    if (!ParseTouchstone(text_input, sink)) {
+      error = true;
+      return false;
+    }
+  }
+
+  if (nValues != 0 || ((nFrequencies != numFreq) && (Ver >= 2.0))) {
+    wxString mess =
+        wxString::Format(_("%s:%d WARNING: %s contains wrong number of values"),
+                         __FILE__, __LINE__, snp_file.GetFullPath());
+    return HandleMessage(mess, be_quiet);
+  }
+  if (parameterType.compare("S") != 0) {
+    wxString mess = wxString::Format(
+        _("%s:%d SObject::WriteLIB:Cannot handle %s format data file."),
+        __FILE__, __LINE__, wxString(parameterType));
+    return HandleMessage(mess, be_quiet);
+  }
+  if (nWritten == 0 && nFrequencies > 0) {
+    wxString mess = wxString::Format(
+        _("%s:%d %s has no frequencies between %g and %g Hz."), __FILE__,
+        __LINE__, snp_file.GetFullPath(), output.fMin,
+        output.fMax > 0 ? output.fMax : HUGE_VAL);
+    return HandleMessage(mess, be_quiet);
+  }
+  if (!spill->Flush()) {
+    wxString mess = wxString::Format(
+        _("%s:%d SObject::StreamLIB:Write to temporary file failed."),
+        __FILE__, __LINE__);
+    return HandleMessage(mess, be_quiet);
+  }
+
+  TRACE_SCOPE("write LIB");
+  PROFILE_SCOPE(PROF_WRITE_LIB);
+  string libName(lib_file.GetFullPath().ToStdString());
+  PartialFile lib(libName);
+  ofstream& output_stream = lib.Open();
+  if (!output_stream) {
+    wxString mess =
+        wxString::Format(_("%s:%d SObject::StreamLIB:Cannot create file '%s'."),
+                         __FILE__, __LINE__, libName);
+    return HandleMessage(mess, be_quiet);
+  }
+  PlanTables(false);
   for (int i = 0; i < numPorts; i++) {
     for (int j = 0; j < numPorts; j++) {
-      output_stream << stringFormat("* S%d%d FREQ %s\n ", i + 1, j + 1,
-                                    inputFormat);
-      output_stream << stringFormat(
-          "G%02d%02d %d %d FREQ {V(%d,%d)}= %s\n", i + 1, j + 1, numPorts + 1,
-          npMult * (i + 1), npMult * (j + 1), numPorts + 1, inputFormat);
-      for (auto s = SData.begin(); s != SData.end(); s++) {
-        double A = s->dB(i, j);
-        A = A - 20 * log10(2 * Z0);
-        double B = s->Phase(i, j);
-        Convert2Input(A, B);
-        output_stream << stringFormat("+(%14eHz,%14e,%14e)\n", s->Freq, A, B);
+      if (libTables[i * numPorts + j] != TABLE_SHARED) continue;
+      WriteSharedTableHeader(output_stream, i, j);
+      if (!spill->CopyTable(i * numPorts + j, output_stream)) {
+        wxString mess = wxString::Format(
+            _("%s:%d SObject::StreamLIB:Read from temporary file failed."),
+            __FILE__, __LINE__);
+        return HandleMessage(mess, be_quiet);
+      }
+      WriteSharedTableFooter(output_stream, i, j);
+    }
+  }
+  WriteLIBHeader(output_stream);
+  for (int i = 0; i < numPorts; i++) {
+    for (int j = 0; j < numPorts; j++) {
+      if (libTables[i * numPorts + j] != TABLE_OWN) {
+        WriteLIBTableRef(output_stream, i, j);
+        continue;
+      }
+      WriteLIBTableHeader(output_stream, i, j);
+      if (!spill->CopyTable(i * numPorts + j, output_stream)) {
+        wxString mess = wxString::Format(
+            _("%s:%d SObject::StreamLIB:Read from temporary file failed."),
+            __FILE__, __LINE__);
+        return HandleMessage(mess, be_quiet);
       }
+      if (!Progress("Writing LIB",
+                    (i * numPorts + j + 1) / (double)(numPorts * numPorts),
+                    (uint64_t)output_stream.tellp()))
+        return false;
     }
     output_stream << "\n";
   }
-
-  output_stream << ".ENDS ; " << lib_file.GetName() << "\n";
-  output_stream.close();
-  data_saved = true;
+  WriteLIBFooter(output_stream);
+  Profiler::AddBytes(PROF_WRITE_LIB, output_stream.tellp());
+  if (!lib.Commit()) {
+    wxString mess =
+        wxString::Format(_("%s:%d SObject::StreamLIB:Cannot write file '%s'."),
+                         __FILE__, __LINE__, libName);
+    return HandleMessage(mess, be_quiet);
+  }
   return !error;
 }
 
 bool SObject::writeSymFile(wxWindow* parent) {
+  if (!confirmSymFile(parent)) return false;
+  return WriteASY();
+}
+
+bool SObject::confirmSymFile(wxWindow* parent) {
   if (asy_file.FileExists() && !GetForce()) {
     wxString mess = wxString::Format(_("Symbol file '%s' exists. Overwrite?"),
                                      asy_file.GetFullPath());
@@ -481,10 +1427,52 @@ bool SObject::writeSymFile(wxWindow* parent) {
                      parent) == wxNO)
       return false;
   }
-  return WriteASY();
+  return true;
 }
 
 bool SObject::WriteASY() {
+  TRACE_SCOPE("write ASY");
+  PROFILE_SCOPE(PROF_WRITE_ASY);
+  cancelled = false;
+  list<string> sym;
+  if (!SymbolLines(sym)) return false;
+
+  string symName(asy_file.GetFullPath().ToStdString());
+  PartialFile asy(symName);
+  ofstream& output_stream = asy.Open();
+  if (!output_stream) {
+    wxString mess = wxString::Format(_("%s:%d Cannot create file '%s'."),
+                                     __FILE__, __LINE__, symName);
+    return HandleMessage(mess, be_quiet);
+  }
+  for (auto i = sym.begin(); i != sym.end(); i++) {
+    output_stream << *i << "\n";
+  }
+  Profiler::AddBytes(PROF_WRITE_ASY, output_stream.tellp());
+  if (!asy.Commit()) {
+    wxString mess = wxString::Format(_("%s:%d Cannot write file '%s'."),
+                                     __FILE__, __LINE__, symName);
+    return HandleMessage(mess, be_quiet);
+  }
+  return !error;
+}
+
+bool SObject::FormatASY(string& contents) {
+  TRACE_SCOPE("format ASY");
+  PROFILE_SCOPE(PROF_WRITE_ASY);
+  cancelled = false;
+  list<string> sym;
+  if (!SymbolLines(sym)) return false;
+  contents.clear();
+  for (auto i = sym.begin(); i != sym.end(); i++) {
+    contents += *i;
+    contents += "\n";
+  }
+  Profiler::AddBytes(PROF_WRITE_ASY, contents.size());
+  return !error;
+}
+
+bool SObject::SymbolLines(list<string>& sym) {
   if (numPorts < 1) {
     wxString mess = wxString::Format(
         _("%s:%d No data. Please open SnP file and make LIB first."), __FILE__,
@@ -492,47 +1480,42 @@ bool SObject::WriteASY() {
     return HandleMessage(mess, be_quiet);
   }
 
-  list<string> sym;
-
-  sym = Symbol(asy_file.GetName().ToStdString());
+  sym = Symbol(SubcktName());
 
   if (sym.empty()) {
     wxString mess = wxString::Format(_("%s:%d Error creating symbol '%s'."),
                                      __FILE__, __LINE__, asy_file.GetName());
     return HandleMessage(mess, be_quiet);
   }
-
-  string symName(asy_file.GetFullPath().ToStdString());
-  ofstream output_stream(symName);
-  if (!output_stream) {
-    wxString mess = wxString::Format(_("%s:%d Cannot create file '%s'."),
-                                     __FILE__, __LINE__, symName);
-    return HandleMessage(mess, be_quiet);
-  }
-  for (auto i = sym.begin(); i != sym.end(); i++) {
-    output_stream << *i << "\n";
-  }
-  return !error;
+  return true;
 }
 
 bool SObject::Convert2S() {
+  TRACE_SCOPE("convert");
   vector<double> raw_data;
   // Since we know the number of ports we can know the amount
   // of data that should be in the data section.  So we tokenize
   // the numbers and then make sure we get exactly the right #.
   {
+    PROFILE_SCOPE(PROF_TOKENIZE);
+    Profiler::AddBytes(PROF_TOKENIZE, data_strings.length());
+    if (!Progress("Converting", 0.0, 0)) return false;
     int warning = 0;
-    istringstream iss(data_strings);
-    vector<string> tokens{istream_iterator<string>{iss},
-                          istream_iterator<string>{}};
-    data_strings.clear();
-    for (auto i = tokens.begin(); i != tokens.end(); i++) {
-      try {
-        raw_data.push_back(stod(*i));
-      } catch (std::invalid_argument const& ex) {
-        warning++;
+    if (scheduler != NULL && data_strings.length() >= 2 * parallelBytes) {
+      warning = TokenizeParallel(raw_data);
+    } else {
+      istringstream iss(data_strings);
+      vector<string> tokens{istream_iterator<string>{iss},
+                            istream_iterator<string>{}};
+      for (auto i = tokens.begin(); i != tokens.end(); i++) {
+        try {
+          raw_data.push_back(stod(*i));
+        } catch (std::invalid_argument const& ex) {
+          warning++;
+        }
       }
     }
+    data_strings.clear();
     if (warning > 0) {
       wxString mess = wxString::Format(
           "%s:%d WARNING: %s contains invalid non-numeric characters", __FILE__,
@@ -541,8 +1524,8 @@ bool SObject::Convert2S() {
     }
   }
 
-  int nFreqs = raw_data.size() / (numPorts * numPorts * 2 + 1);
-  if ((nFreqs * (numPorts * numPorts * 2 + 1) != raw_data.size()) ||
+  int nFreqs = raw_data.size() / RecordLength();
+  if ((nFreqs * RecordLength() != raw_data.size()) ||
       ((nFreqs != numFreq) && (Ver >= 2.0))) {
     // Maybe the file has an incomplete last frequency.  If not, it will reveal
     // itself later on because frequency will be non-monotonic and then fail
@@ -552,77 +1535,319 @@ bool SObject::Convert2S() {
     return HandleMessage(mess, be_quiet);
   }
 
-  Sparam S((size_t)numPorts);
+  PROFILE_SCOPE(PROF_CONVERT);
+  if (scheduler != NULL && (size_t)nFreqs >= parallelRecords)
+    return ConvertParallel(raw_data, nFreqs) && !error;
+  Sparam S = NewRecord();
   double prevFreq = 0;
-  int nFrequencies = 0;
-  for (auto rd = raw_data.begin(); rd != raw_data.end();) {
-    if (++nFrequencies > nFreqs) break;
-    S.Freq = fUnits * *rd++;
-    // frequencies must be monotonically increasing
-    if (S.Freq < prevFreq) {
+  const size_t recLen = RecordLength();
+  for (int n = 0; n < nFreqs; n++) {
+    if (!ConvertRecord(&raw_data[n * recLen], S, prevFreq)) return false;
+    SData.push_back(S);
+    if ((n + 1) % progressRecords == 0 &&
+        !Progress("Converting", (n + 1) / (double)nFreqs,
+                  (uint64_t)(n + 1) * recLen * sizeof(double)))
+      return false;
+  }
+  return !error;
+}
+
+// data_strings is cut into chunks at white space and each chunk tokenized
+// by a task; the numbers are then joined in order.  Returns the number of
+// tokens that are not numbers.
+int SObject::TokenizeParallel(vector<double>& raw_data) {
+  vector<size_t> cuts(1, 0);
+  while (cuts.back() < data_strings.length()) {
+    size_t cut = min(data_strings.length(), cuts.back() + parallelBytes);
+    while (cut < data_strings.length() && !isspace((unsigned char)data_strings[cut]))
+      cut++;
+    cuts.push_back(cut);
+  }
+  const size_t nChunks = cuts.size() - 1;
+  vector<vector<double>> values(nChunks);
+  vector<int> warnings(nChunks, 0);
+  scheduler->ParallelFor(nChunks, 1, [&](size_t begin, size_t end) {
+    for (size_t c = begin; c < end; c++) {
+      istringstream iss(data_strings.substr(cuts[c], cuts[c + 1] - cuts[c]));
+      string token;
+      while (iss >> token) {
+        try {
+          values[c].push_back(stod(token));
+        } catch (std::invalid_argument const& ex) {
+          warnings[c]++;
+        }
+      }
+    }
+  });
+  size_t total = 0;
+  for (auto& v : values) total += v.size();
+  raw_data.reserve(total);
+  int warning = 0;
+  for (size_t c = 0; c < nChunks; c++) {
+    raw_data.insert(raw_data.end(), values[c].begin(), values[c].end());
+    warning += warnings[c];
+  }
+  return warning;
+}
+
+// Records are independent once the frequencies are known to increase, so
+// they are converted in ranges by tasks.  The first record is converted
+// first, on its own, because converting H-parameters changes
+// parameterType.
+bool SObject::ConvertParallel(const vector<double>& raw_data, int nFreqs) {
+  const size_t recLen = RecordLength();
+  double prevFreq = 0;
+  for (int n = 0; n < nFreqs; n++) {
+    if (fUnits * raw_data[n * recLen] < prevFreq) {
       wxString mess = wxString::Format(
           _("%s:%d ERROR: %s contains decreasing frequency values"), __FILE__,
           __LINE__, snp_file.GetFullPath());
       return HandleMessage(mess, be_quiet);
     }
-    prevFreq = S.Freq;
+    prevFreq = fUnits * raw_data[n * recLen];
+  }
 
-    // Step 1: Convert data from input specified type to internal dB/phase deg
-    if (inputFormat.compare("MAG") == 0) {
-      for (size_t i = 0; i < numPorts; i++) {
-        for (size_t j = 0; j < numPorts; j++) {
-          // convert raw mag to dB
-          S.dB(i, j) = (20.0 * log10(*rd++));
-          // copy the phase in degrees
-          S.Phase(i, j) = *rd++;
-        }
-      }
-    } else if (inputFormat.compare("R_I") == 0) {
-      // Move data into complex matrix ri
-      MatrixXcd ri(numPorts, numPorts);
-      for (size_t i = 0; i < numPorts; i++) {
-        for (size_t j = 0; j < numPorts; j++) {
-          double a = *rd++;
-          double b = *rd++;
-          ri(i, j) = dcomplex(a, b);
+  SData.assign(nFreqs, NewRecord());
+  prevFreq = 0;
+  if (!ConvertRecord(&raw_data[0], SData[0], prevFreq)) return false;
+  if (!Progress("Converting", 0.0, 0)) return false;
+  scheduler->ParallelFor(nFreqs - 1, recordsPerTask,
+                         [&](size_t begin, size_t end) {
+                           double prev = 0;
+                           for (size_t n = begin + 1; n <= end; n++)
+                             ConvertRecord(&raw_data[n * recLen], SData[n],
+                                           prev);
+                         });
+  return Progress("Converting", 1.0, raw_data.size() * sizeof(double));
+}
+
+bool SObject::PlanModes() {
+  modeMatrix.resize(0, 0);
+  MatrixXd M = MatrixXd::Identity(numPorts, numPorts);
+  string error;
+  if (!inputModes.empty()) {
+    MatrixXd in;
+    if (!ModeMatrix(inputModes, numPorts, in, error)) {
+      wxString mess = wxString::Format(
+          _("%s:%d SObject::PlanModes:Cannot process file '%s'. "
+            "[Mixed Mode Order] %s"),
+          __FILE__, __LINE__, snp_file.GetFullPath(), error);
+      return HandleMessage(mess, be_quiet);
+    }
+    // The modes are orthonormal, so the inverse is the transpose
+    M = in.transpose();
+  }
+  if (!output.mixedMode.empty()) {
+    MatrixXd out;
+    if (!ModeMatrix(output.mixedMode, numPorts, out, error)) {
+      wxString mess = wxString::Format(
+          _("%s:%d SObject::PlanModes:Cannot convert file '%s' to mixed "
+            "modes: %s"),
+          __FILE__, __LINE__, snp_file.GetFullPath(), error);
+      return HandleMessage(mess, be_quiet);
+    }
+    M = out * M;
+  }
+  // Modes read as they are written need nothing
+  if (!M.isIdentity(1e-12)) modeMatrix = M.cast<dcomplex>();
+  return true;
+}
+
+// The records side by side are multiplied from the left, then stacked on
+// top of each other and multiplied from the right
+void SObject::TransformModes(Sparam* records, size_t count) const {
+  const int n = modeMatrix.rows();
+  MatrixXcd side(n, n * count);
+  for (size_t k = 0; k < count; k++)
+    side.middleCols(k * n, n) = records[k].Scplx();
+  side = modeMatrix * side;
+  MatrixXcd stack(n * count, n);
+  for (size_t k = 0; k < count; k++)
+    stack.middleRows(k * n, n) = side.middleCols(k * n, n);
+  stack = stack * modeMatrix.transpose();
+  for (size_t k = 0; k < count; k++)
+    records[k].cplxStore(stack.middleRows(k * n, n));
+}
+
+bool SObject::PlanPorts() {
+  keptPorts.clear();
+  terminations.clear();
+  if (output.terminate.empty()) return true;
+  string error;
+  if (!ParseTerminations(output.terminate, numPorts, Z0, terminations,
+                         error)) {
+    wxString mess = wxString::Format(
+        _("%s:%d SObject::PlanPorts:Cannot terminate ports of file '%s': "
+          "%s"),
+        __FILE__, __LINE__, snp_file.GetFullPath(), error);
+    return HandleMessage(mess, be_quiet);
+  }
+  vector<bool> terminated(numPorts, false);
+  for (auto& t : terminations) terminated[t.port] = true;
+  for (int p = 0; p < numPorts; p++) {
+    if (!terminated[p]) keptPorts.push_back(p);
+  }
+  return true;
+}
+
+// The loads reflect a_q = G b_q into the terminated ports q, so the kept
+// ports p see the Schur complement S_pp + S_pq G (I - S_qq G)^-1 S_qp
+void SObject::ReducePorts(Sparam* records, size_t count) const {
+  const int m = keptPorts.size(), t = terminations.size();
+  VectorXcd G(t);
+  for (int b = 0; b < t; b++) G(b) = terminations[b].gamma;
+  const bool matched = G.isZero();
+  MatrixXcd Spp(m, m), Spq(m, t), Sqp(t, m), Sqq(t, t);
+  for (size_t k = 0; k < count; k++) {
+    MatrixXcd S = records[k].Scplx();
+    for (int a = 0; a < m; a++) {
+      for (int b = 0; b < m; b++) Spp(a, b) = S(keptPorts[a], keptPorts[b]);
+    }
+    if (!matched) {
+      for (int a = 0; a < m; a++) {
+        for (int b = 0; b < t; b++) {
+          Spq(a, b) = S(keptPorts[a], terminations[b].port);
+          Sqp(b, a) = S(terminations[b].port, keptPorts[a]);
         }
       }
-      // Extract dB from matrix ri
-      S.dB = 20.0 * log10(abs(ri.array()));
-      // Extract phase in degrees from ri
-      S.Phase = (180 / M_PI) * ri.cwiseArg();
-    } else if (inputFormat.compare("DB") == 0) {
-      // input == internal form so just copy each value
-      for (size_t i = 0; i < numPorts; i++) {
-        for (size_t j = 0; j < numPorts; j++) {
-          S.dB(i, j) = *rd++;
-          S.Phase(i, j) = *rd++;
-        }
+      for (int a = 0; a < t; a++) {
+        for (int b = 0; b < t; b++)
+          Sqq(a, b) = S(terminations[a].port, terminations[b].port);
       }
-    } else {
+      MatrixXcd loaded = MatrixXcd::Identity(t, t) - Sqq * G.asDiagonal();
+      Spp += Spq * G.asDiagonal() * loaded.partialPivLu().solve(Sqp);
+    }
+    records[k].cplxStore(Spp);
+  }
+}
+
+// Both conversions for a block of records before the next block
+void SObject::ConvertPorts(vector<Sparam>& data) const {
+  if (modeMatrix.size() == 0 && terminations.empty()) return;
+  PROFILE_SCOPE(PROF_CONVERT);
+  auto body = [&](size_t begin, size_t end) {
+    for (size_t n = begin; n < end; n += recordsPerTask) {
+      size_t count = min(recordsPerTask, end - n);
+      if (modeMatrix.size() > 0) TransformModes(&data[n], count);
+      if (!terminations.empty()) ReducePorts(&data[n], count);
+    }
+  };
+  if (scheduler != NULL && data.size() >= parallelRecords)
+    scheduler->ParallelFor(data.size(), recordsPerTask, body);
+  else
+    body(0, data.size());
+}
+
+void SObject::ConvertPorts() {
+  ConvertPorts(SData);
+  if (!terminations.empty()) numPorts = keptPorts.size();
+}
+
+size_t SObject::RecordLength() const {
+  size_t values = matrixFormat == MATRIX_FULL ? numPorts * numPorts
+                                              : numPorts * (numPorts + 1) / 2;
+  return values * 2 + 1;
+}
+
+Sparam SObject::NewRecord() const {
+  if (matrixFormat == MATRIX_FULL) return Sparam((size_t)numPorts);
+  return Sparam::Symmetric(numPorts);
+}
+
+bool SObject::ConvertRecord(const double* rd, Sparam& S, double& prevFreq) {
+  // H to S conversion leaves a full matrix behind
+  if (matrixFormat != MATRIX_FULL && !S.symmetric) S = NewRecord();
+  S.Freq = fUnits * *rd++;
+  // frequencies must be monotonically increasing
+  if (S.Freq < prevFreq) {
+    wxString mess = wxString::Format(
+        _("%s:%d ERROR: %s contains decreasing frequency values"), __FILE__,
+        __LINE__, snp_file.GetFullPath());
+    return HandleMessage(mess, be_quiet);
+  }
+  prevFreq = S.Freq;
+
+  // Step 1: Convert data from input specified type to internal dB/phase deg
+  if (S.symmetric) {
+    // A triangle, row by row; Sparam keeps it packed as the lower one
+    bool upper = matrixFormat == MATRIX_UPPER;
+    bool mag = inputFormat.compare("MAG") == 0;
+    bool ri = inputFormat.compare("R_I") == 0;
+    if (!mag && !ri && inputFormat.compare("DB") != 0) {
       wxString mess = wxString::Format(
           _("%s:%d Data format '%s' unsupported in file '%s'."), __FILE__,
           __LINE__, wxString(inputFormat), snp_file.GetFullPath());
       return HandleMessage(mess, be_quiet);
     }
-
-    // Step 2: Convert from input parameter type H to S
-    if (parameterType.compare("H") == 0) {
-      auto H = S.Scplx();
-      // convert H to S-parameters
-      MatrixXcd Slocal = h2s(H, Z0, 1 / Z0);
-      S.cplxStore(Slocal);
-      parameterType = "S";
+    for (size_t i = 0; i < numPorts; i++) {
+      for (size_t j = upper ? i : 0; j < (upper ? numPorts : i + 1); j++) {
+        size_t k = Sparam::Packed(i, j);
+        double a = *rd++;
+        double b = *rd++;
+        if (ri) {
+          dcomplex c(a, b);
+          S.dB(k, 0) = 20.0 * log10(abs(c));
+          S.Phase(k, 0) = (180 / M_PI) * arg(c);
+        } else {
+          S.dB(k, 0) = mag ? 20.0 * log10(a) : a;
+          S.Phase(k, 0) = b;
+        }
+      }
+    }
+  } else if (inputFormat.compare("MAG") == 0) {
+    for (size_t i = 0; i < numPorts; i++) {
+      for (size_t j = 0; j < numPorts; j++) {
+        // convert raw mag to dB
+        S.dB(i, j) = (20.0 * log10(*rd++));
+        // copy the phase in degrees
+        S.Phase(i, j) = *rd++;
+      }
     }
-    // Step 3: Fixup 2-port data locations
-    //         Touchstone V1.0 treats 2-ports uniquely
-    if (numPorts == 2 && Swap) {
-      std::swap(S.dB(0, 1), S.dB(1, 0));
-      std::swap(S.Phase(0, 1), S.Phase(1, 0));
+  } else if (inputFormat.compare("R_I") == 0) {
+    // Move data into complex matrix ri
+    MatrixXcd ri(numPorts, numPorts);
+    for (size_t i = 0; i < numPorts; i++) {
+      for (size_t j = 0; j < numPorts; j++) {
+        double a = *rd++;
+        double b = *rd++;
+        ri(i, j) = dcomplex(a, b);
+      }
     }
-    SData.push_back(S);
+    // Extract dB from matrix ri
+    S.dB = 20.0 * log10(abs(ri.array()));
+    // Extract phase in degrees from ri
+    S.Phase = (180 / M_PI) * ri.cwiseArg();
+  } else if (inputFormat.compare("DB") == 0) {
+    // input == internal form so just copy each value
+    for (size_t i = 0; i < numPorts; i++) {
+      for (size_t j = 0; j < numPorts; j++) {
+        S.dB(i, j) = *rd++;
+        S.Phase(i, j) = *rd++;
+      }
+    }
+  } else {
+    wxString mess = wxString::Format(
+        _("%s:%d Data format '%s' unsupported in file '%s'."), __FILE__,
+        __LINE__, wxString(inputFormat), snp_file.GetFullPath());
+    return HandleMessage(mess, be_quiet);
   }
-  return !error;
+
+  // Step 2: Convert from input parameter type H to S
+  if (parameterType.compare("H") == 0) {
+    PROFILE_SCOPE(PROF_H2S);
+    auto H = S.Scplx();
+    // convert H to S-parameters
+    MatrixXcd Slocal = h2s(H, Z0, 1 / Z0);
+    S.cplxStore(Slocal);
+    parameterType = "S";
+  }
+  // Step 3: Fixup 2-port data locations
+  //         Touchstone V1.0 treats 2-ports uniquely
+  if (numPorts == 2 && Swap && !S.symmetric) {
+    std::swap(S.dB(0, 1), S.dB(1, 0));
+    std::swap(S.Phase(0, 1), S.Phase(1, 0));
+  }
+  return true;
 }
 
 MatrixXcd SObject::h2s(const MatrixXcd& H, double Z0, double Y0) const {
@@ -642,7 +1867,8 @@ list<string> SObject::Symbol2port(const string& symname) const {
   symbol.push_back("TEXT 0 -48 Center 2 " + symname);
   symbol.push_back("SYMATTR Prefix X");
   symbol.push_back("SYMATTR SpiceModel " + symname);
-  symbol.push_back("SYMATTR ModelFile " + symname + ".inc");
+  symbol.push_back("SYMATTR ModelFile " +
+                   lib_file.GetFullName().ToStdString());
   symbol.push_back("PIN -48 0 LEFT 8");
   symbol.push_back("PINATTR PinName 1");
   symbol.push_back("PINATTR SpiceOrder 1");
@@ -663,7 +1889,8 @@ list<string> SObject::Symbol1port(const string& symname) const {
   symbol.push_back("TEXT 0 -48 Center 2 " + symname);
   symbol.push_back("SYMATTR Prefix X");
   symbol.push_back("SYMATTR SpiceModel " + symname);
-  symbol.push_back("SYMATTR ModelFile " + symname + ".inc");
+  symbol.push_back("SYMATTR ModelFile " +
+                   lib_file.GetFullName().ToStdString());
   symbol.push_back("PIN -48 0 LEFT 8");
   symbol.push_back("PINATTR PinName 1");
   symbol.push_back("PINATTR SpiceOrder 1");
@@ -707,7 +1934,8 @@ list<string> SObject::Symbol(const string& symname) const {
       symbol.push_back("TEXT 0 -48 Center 2 " + symname);
       symbol.push_back("SYMATTR Prefix X");
       symbol.push_back("SYMATTR SpiceModel " + symname);
-      symbol.push_back("SYMATTR ModelFile " + symname + ".inc");
+      symbol.push_back("SYMATTR ModelFile " +
+                       lib_file.GetFullName().ToStdString());
       // Do the left pins
       int yPin;
       int pinName = -1;
@@ -69,6 +69,8 @@
 #include <iomanip>
 #include <list>
 #include <string>
+#include <cstdint>
+#include <functional>
 #include <Eigen/Dense>
 
 using namespace std;
@@ -97,41 +99,108 @@ inline bool HandleMessage(const wxString& mess, bool be_quiet) {
   return false;
 }
 
+inline void HandleWarning(const wxString& mess, bool be_quiet) {
+  if (be_quiet) {
+    std::cout << mess << std::endl;
+  } else {
+    wxLogWarning(mess);
+  }
+}
+
+// The temporary name an output file is written under until it is complete.
+// Every call gives a new name, so two threads writing the same output never
+// share one.
+string PartFileName(const string& fileName);
+
+// The matrix taking the waves of the single-ended ports to those of the
+// modes listed in order, one row per mode, as in [Mixed Mode Order]:
+// "D1,3 C1,3 S2" is the differential and common mode of ports 1 and 3 and
+// port 2 on its own.  Every one of the ports must be used by exactly one
+// mode or pair of modes.  Returns false with the reason in error if not.
+bool ModeMatrix(const string& order, int ports, MatrixXd& M, string& error);
+
+// A port terminated in a load instead of being a port of the LIB model
+struct Termination {
+  int port;      // 0 based
+  double gamma;  // reflection coefficient of the load
+};
+
+// The ports terminated by spec, port numbers separated by spaces or commas,
+// each optionally with the impedance of its load in ohms: "2 3=75 5=open"
+// terminates port 2 in Z0, port 3 in 75 ohms and leaves port 5 open (0 is
+// a short).  At least one port must be left.  Returns false with the
+// reason in error if spec is malformed.
+bool ParseTerminations(const string& spec, int ports, double Z0,
+                       vector<Termination>& terms, string& error);
+
 class Sparam {
 public:
   Sparam() {
     Freq = 0;
     dB = ArrayXXd::Zero(2, 2);
     Phase = ArrayXXd::Zero(2, 2);
+    symmetric = false;
   }
   Sparam(int _n) {
     Freq = 0;
     dB = ArrayXXd::Zero(_n, _n);
     Phase = ArrayXXd::Zero(_n, _n);
+    symmetric = false;
   }
   Sparam(size_t _n) {
     Freq = 0;
     dB = ArrayXXd::Zero(_n, _n);
     Phase = ArrayXXd::Zero(_n, _n);
+    symmetric = false;
   }
   Sparam(double _f, size_t _n = 2) {
     Freq = _f;
     dB = ArrayXXd::Zero(_n, _n);
     Phase = ArrayXXd::Zero(_n, _n);
+    symmetric = false;
   }
   Sparam(double _f, const MatrixXd& _dB, const MatrixXd& _Phase) {
     Freq = _f;
     dB = _dB;
     Phase = _Phase;
+    symmetric = false;
   }
-  Sparam(const Sparam& _s) : Freq(_s.Freq), dB(_s.dB), Phase(_s.Phase) {}
+  Sparam(const Sparam& _s)
+      : Freq(_s.Freq), dB(_s.dB), Phase(_s.Phase), symmetric(_s.symmetric) {}
   Sparam& operator=(const Sparam& _s) {
     if (&_s == this) return *this;
     Freq = _s.Freq;
     dB = _s.dB;
     Phase = _s.Phase;
+    symmetric = _s.symmetric;
     return *this;
   }
+  // Data of a reciprocal network (S_ij == S_ji, e.g. read from a Lower or
+  // Upper [Matrix Format] file) keeps only the lower triangle: dB and
+  // Phase are then columns of _n(_n+1)/2 entries, row after row.  Use
+  // ports(), dBAt() and phaseAt() to read either form.
+  static Sparam Symmetric(size_t _n) {
+    Sparam s;
+    s.dB = ArrayXXd::Zero(_n * (_n + 1) / 2, 1);
+    s.Phase = ArrayXXd::Zero(_n * (_n + 1) / 2, 1);
+    s.symmetric = true;
+    return s;
+  }
+  // Where S_ij is kept in the packed lower triangle
+  static size_t Packed(size_t i, size_t j) {
+    if (i < j) std::swap(i, j);
+    return i * (i + 1) / 2 + j;
+  }
+  int ports() const {
+    if (!symmetric) return (int)dB.rows();
+    return (int)((sqrt(8.0 * dB.rows() + 1) - 1) / 2 + 0.5);
+  }
+  double dBAt(int i, int j) const {
+    return symmetric ? dB(Packed(i, j), 0) : dB(i, j);
+  }
+  double phaseAt(int i, int j) const {
+    return symmetric ? Phase(Packed(i, j), 0) : Phase(i, j);
+  }
   MatrixXd phaseRad() const { return (Phase * M_PI / 180.0); }
   MatrixXd phaseDeg() const { return (Phase); }
   MatrixXd mag() const {
@@ -139,9 +208,21 @@ public:
     MatrixXd res = pow(10, x.array());
     return res;
   }
+  // Always the full matrix
   MatrixXcd Scplx() const {
     auto m = mag();
     auto p = phaseRad();
+    if (symmetric) {
+      int n = ports();
+      MatrixXcd res(n, n);
+      for (int i = 0; i < n; i++) {
+        for (int j = 0; j <= i; j++) {
+          size_t k = Packed(i, j);
+          res(i, j) = res(j, i) = std::polar(m(k, 0), p(k, 0));
+        }
+      }
+      return res;
+    }
     MatrixXcd res(dB.rows(), dB.cols());
     res.real() = m.array() * cos(p.array());
     res.imag() = m.array() * sin(p.array());
@@ -150,10 +231,43 @@ public:
   void cplxStore(const MatrixXcd& cp) {
     dB = 20.0 * log10(cp.cwiseAbs().array());
     Phase = (180.0 / M_PI) * cp.cwiseArg();
+    symmetric = false;
   }
   double Freq;     // Freq is stored as Hz
   MatrixXd dB;     // dB is stored as 20*log10(magnitude)
   MatrixXd Phase;  // Phase is stored as degrees
+  bool symmetric;  // only the lower triangle is kept, see Symmetric()
+};
+
+class TaskScheduler;
+
+// Settings of the output files that replace the defaults taken from the
+// input file, e.g. for one job of a manifest.  Empty or 0 keeps the default.
+struct OutputOptions {
+  wxString libFile;   // instead of <input name>.inc
+  wxString asyFile;   // instead of <input name>.asy
+  string subckt;      // subcircuit name instead of the LIB file name
+  int precision = 0;  // digits after the point in the LIB tables (6)
+  double fMin = 0;    // drop the frequencies below fMin Hz
+  double fMax = 0;    // and above fMax Hz
+  // Write S_ij and S_ji once, in a shared subcircuit, if they differ by at
+  // most this much relative to the larger at every frequency; 0 never
+  double reciprocal = 0;
+  // Leave out the S_ij that stay below this level (dB) at every frequency;
+  // 0 never
+  double prune = 0;
+  // Ports of the LIB model as mixed modes (see ModeMatrix()) instead of
+  // the single-ended ports
+  string mixedMode;
+  // Check that the data are causal before writing the LIB file and warn
+  // about the S_ij that are off by more than this, relative; 0 never
+  double causality = 0;
+  // Also write the impulse and step responses next to the LIB file, as
+  // <name>.td.csv ("csv") or <name>.td.bin ("bin"); see TimeDomain.h
+  string timeDomain;
+  // Terminate these ports (see ParseTerminations()) and write a model of
+  // the others only
+  string terminate;
 };
 
 class SObject {
@@ -166,8 +280,10 @@ public:
   // Accessors
   int nPorts(void) { return numPorts; }
   int nFreq(void) { return SData.size(); }
+  double Zref(void) { return Z0; }
   double fBegin(void) { return SData.begin()->Freq; }
   double fEnd(void) { return (SData.end() - 1)->Freq; }
+  const vector<Sparam>& getSData() const { return SData; }
   bool dataSaved(void) { return (SData.empty() || data_saved); }
   bool SetQuiet(bool flag) {
     bool res = be_quiet;
@@ -185,18 +301,79 @@ public:
   wxFileName getASYfile() { return asy_file; }
   wxFileName getLIBfile() { return lib_file; }
 
+  // Used by every following read; the defaults are restored by passing
+  // OutputOptions()
+  void SetOutputOptions(const OutputOptions& options) { output = options; }
+
+  // Long operations report progress through this function: the step being
+  // done, the fraction of the step that is complete and the bytes handled
+  // so far in the step.  Returning false stops the operation; it then
+  // returns false and Cancelled() is true.  Output files are only replaced
+  // once they are complete, so a cancel never leaves a partial file.
+  typedef std::function<bool(const char* step, double done, uint64_t bytes)>
+      ProgressFunc;
+  void SetProgress(const ProgressFunc& func) { progress = func; }
+  bool Cancelled() { return cancelled; }
+
+  // With a scheduler, large files are converted and formatted as many
+  // tasks (chunks of numbers, ranges of frequencies, LIB tables) that idle
+  // workers can take.  The results are the same, but progress is only
+  // reported between the steps.
+  void SetScheduler(TaskScheduler* tasks) { scheduler = tasks; }
+  TaskScheduler* GetScheduler() const { return scheduler; }
+
+  // Dialogs used by openSFile(), writeLibFile() and writeSymFile().  They
+  // let the GUI ask its questions first and do the work elsewhere.
+  bool chooseSFile(wxWindow* parent, wxFileName& fileName);
+  static const char* SFileWildcard();
+  bool confirmLibFile(wxWindow* parent);
+  bool confirmSymFile(wxWindow* parent);
+
   // Data processors
   bool openSFile(wxWindow* parent);
   bool readSFile(wxFileName& fileName);
+  // As above, but the file has already been read into contents
+  bool readSFile(wxFileName& fileName, const char* contents, size_t size);
   bool writeLibFile(wxWindow* parent);
   bool writeSymFile(wxWindow* parent);
   bool WriteASY();
   bool WriteLIB();
+  // Same as WriteASY() and WriteLIB() but the file is returned in contents
+  // for the caller to write
+  bool FormatASY(string& contents);
+  bool FormatLIB(string& contents);
+
+  // Convert a Touchstone file straight to a LIB file without keeping the
+  // S-parameter data in memory.  The output is identical to readSFile()
+  // followed by WriteLIB().
+  bool StreamLIB(wxFileName& fileName);
+
+  // Hold data computed from other files (e.g. a cascade of them) as if
+  // read from fileName: the outputs are named after it and the tables have
+  // the format and reference impedance of like.  data is taken over, and
+  // comments (Touchstone "!" lines) go to the header of the LIB file.  The
+  // ports are converted as the output options ask, like those of a file
+  // read.  false if that is not possible.
+  bool SetData(const wxFileName& fileName, const SObject& like, int ports,
+               vector<Sparam>& data, const wxArrayString& comments);
+  // After SetData(), make every S_ij of the LIB model a sum of sources,
+  // one for the data and one for each of others (at the same frequencies
+  // and ports), the source of set k scaled by weights[k].  params are the
+  // subcircuit parameters with their defaults (e.g. "TEMP=25"), lines go
+  // into the subcircuit ahead of the sources (e.g. .param lines) and labels
+  // tell the sets apart in the comments.  others is taken over.
+  void SetWeightedSets(const string& params, const vector<string>& lines,
+                       const vector<string>& weights,
+                       const vector<string>& labels,
+                       vector<vector<Sparam>>& others);
 
   // Clean out the object and prep to import another
   void Clean();
 
 private:
+  // The benchmark program times the individual conversion steps
+  friend class SObjectBench;
+
   // Step 0: file targets + defaults
   void InitTargetsAndDefaults(const wxFileName& SFile);
 
@@ -204,7 +381,14 @@ private:
   bool DeterminePortsAndVersionFromExt();
 
   // Step 2: scan lines and collect metadata + raw data strings
-  bool ParseTouchstone(wxTextInputStream& in);
+  // If a sink is given the data lines are handed to it instead of being
+  // collected in data_strings.
+  typedef std::function<bool(const wxString&)> DataSink;
+  bool ParseTouchstone(wxTextInputStream& in,
+                       const DataSink& sink = DataSink());
+
+  // Steps 2 to 4 and the conversion, shared by both readSFile()
+  bool Import(wxInputStream& input_stream);
 
   // Step 3: parse the "# ..." header options for units/format/type/Z0
   bool ParseOptionsFromHeader();
@@ -231,15 +415,100 @@ private:
   double Ver;              // S-parameter file version
   string inputFormat;      // data format (DB, MA or RI)
   string parameterType;    // type of parameter (S is the only allowed type)
+  // [Matrix Format] of V2 files; Lower and Upper give only a triangle
+  enum MatrixFormat { MATRIX_FULL, MATRIX_LOWER, MATRIX_UPPER } matrixFormat;
+  string inputModes;  // [Mixed Mode Order] of V2 files
+  // Every record S becomes modeMatrix S modeMatrix^T, which takes the modes
+  // of the file to single-ended ports and those to the modes of the
+  // output; empty if neither has modes
+  MatrixXcd modeMatrix;
+  // The weighted sets of SetWeightedSets(), SData being the first; empty
+  // for a LIB model of SData only
+  string setParams;
+  vector<string> setLines, setWeights, setLabels;
+  vector<vector<Sparam>> setData;  // the sets after SData
+  // The ports of the data left after the terminations, in order, if any
+  vector<int> keptPorts;
+  vector<Termination> terminations;
   wxString option_string;  // meta data strings
+  OutputOptions output;
+  ProgressFunc progress;
+  TaskScheduler* scheduler;
+  bool cancelled;       // the last operation was stopped by progress
+  uint64_t input_size;  // size of snp_file in bytes
+
+  // Report progress; false if the operation must stop
+  bool Progress(const char* step, double done, uint64_t bytes);
 
   // These functions create a string list describing a LTspice symbol
   list<string> Symbol(const string& symname) const;
   list<string> Symbol1port(const string& symname) const;
   list<string> Symbol2port(const string& symname) const;
+  // The lines of the ASY file, or false after reporting why there are none
+  bool SymbolLines(list<string>& sym);
 
   // Convert text to S-parameters
   bool Convert2S();
+  // Numbers per frequency record (the frequency and numPorts^2 value
+  // pairs, or a triangle of them) and an empty record to convert into
+  size_t RecordLength() const;
+  Sparam NewRecord() const;
+
+  // Convert one frequency record (freq followed by numPorts^2 value pairs)
+  // to internal dB/phase form.  prevFreq guards frequency ordering.
+  bool ConvertRecord(const double* rd, Sparam& S, double& prevFreq);
+  // Convert2S() steps split into tasks for the scheduler
+  int TokenizeParallel(vector<double>& raw_data);
+  bool ConvertParallel(const vector<double>& raw_data, int nFreqs);
+  // Set up modeMatrix once the header is read
+  bool PlanModes();
+  // Apply modeMatrix to count records, all in one product
+  void TransformModes(Sparam* records, size_t count) const;
+  // Set up keptPorts and terminations once the modes are planned
+  bool PlanPorts();
+  // Reduce count records to the kept ports
+  void ReducePorts(Sparam* records, size_t count) const;
+  // Both of the above for all records of data; without data for SData,
+  // setting numPorts to the ports left
+  void ConvertPorts(vector<Sparam>& data) const;
+  void ConvertPorts();
+
+  // The name of the subcircuit in the LIB and ASY files
+  string SubcktName() const;
+  // false if output drops frequency f
+  bool InFrequencyRange(double f) const {
+    return !(output.fMin > 0 && f < output.fMin) &&
+           !(output.fMax > 0 && f > output.fMax);
+  }
+
+  // Pieces of the LIB file shared by WriteLIB() and StreamLIB()
+  void WriteLIBHeader(ostream& out) const;
+  void WriteLIBTableHeader(ostream& out, int i, int j) const;
+  string LIBRow(const Sparam& s, int i, int j);
+  void WriteLIBFooter(ostream& out) const;
+  // How each S_ij table goes to the LIB file: in the subcircuit, in a
+  // subcircuit of its own that is used for S_ij (shared) and S_ji (mirror),
+  // or not at all because it is negligible (pruned)
+  enum LIBTable { TABLE_OWN, TABLE_SHARED, TABLE_MIRROR, TABLE_PRUNED };
+  vector<char> libTables;    // LIBTable of S_ij at i * numPorts + j
+  ArrayXXd reciprocalError;  // largest |S_ij - S_ji| / max(|S_ij|, |S_ji|)
+  ArrayXXd peakMag;          // largest |S_ij|
+  void WritePruneReport(ostream& out) const;
+  // libTables is planned from the errors of all records, collected from
+  // SData by PlanTables() or by TrackTables() while streaming
+  void ResetTables();
+  void TrackTables(const Sparam& s);
+  void PlanTables(bool fromData);
+  string SharedTableName(int i, int j) const;
+  void WriteSharedTableHeader(ostream& out, int i, int j) const;
+  void WriteSharedTableFooter(ostream& out, int i, int j) const;
+  void WriteLIBTableRef(ostream& out, int i, int j) const;
+  // Checks and body of the LIB file shared by WriteLIB() and FormatLIB()
+  bool CheckLIBType();
+  bool WriteLIBBody(ostream& out);
+  bool WriteLIBTablesParallel(ostream& out);
+  // The body of the LIB file of weighted sets, see SetWeightedSets()
+  bool WriteWeightedBody(ostream& out);
 
   // Convert H to S-parameters
   MatrixXcd h2s(const MatrixXcd& H, double Z0, double Y0) const;
@@ -0,0 +1,155 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Work-stealing task scheduler used to balance batches of large
+ *           and small files.
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+
+#include "Scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+// The worker index of this thread and the scheduler it belongs to
+static thread_local const TaskScheduler* currentScheduler = NULL;
+static thread_local int currentWorker = -1;
+// Time spent in the tasks run inside the task this thread is running, which
+// is not counted as busy time of that task (ns)
+static thread_local uint64_t nestedTime = 0;
+
+TaskScheduler::TaskScheduler(int threads)
+    : nThreads(threads), queued(0), nextWorker(0), stopping(false) {
+  if (nThreads <= 0) nThreads = max(1u, thread::hardware_concurrency());
+  for (int i = 0; i <= nThreads; i++) workers.emplace_back(new Worker);
+  for (int i = 0; i < nThreads; i++)
+    pool.emplace_back(&TaskScheduler::Loop, this, i);
+}
+
+TaskScheduler::~TaskScheduler() {
+  {
+    lock_guard<mutex> lock(sleepLock);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto& t : pool) t.join();
+}
+
+int TaskScheduler::Self() const {
+  if (currentScheduler == this) return currentWorker;
+  return Threads();  // not a worker
+}
+
+void TaskScheduler::Spawn(TaskGroup& group, Task task) {
+  group.pending++;
+  int self = Self();
+  // Other threads hand their tasks to the workers in turn
+  if (self == Threads()) self = nextWorker++ % Threads();
+  {
+    lock_guard<mutex> lock(workers[self]->lock);
+    workers[self]->tasks.push_back(Entry{std::move(task), &group});
+  }
+  queued++;
+  { lock_guard<mutex> lock(sleepLock); }
+  wake.notify_one();
+}
+
+void TaskScheduler::Wait(TaskGroup& group) {
+  int self = Self();
+  while (group.pending > 0) {
+    if (RunOne(self)) continue;
+    unique_lock<mutex> lock(sleepLock);
+    wake.wait_for(lock, chrono::milliseconds(1),
+                  [&] { return group.pending == 0 || queued > 0; });
+  }
+}
+
+void TaskScheduler::ParallelFor(
+    size_t n, size_t grain, const function<void(size_t, size_t)>& body) {
+  grain = max<size_t>(grain, 1);
+  TaskGroup group;
+  for (size_t begin = 0; begin < n; begin += grain) {
+    size_t end = min(n, begin + grain);
+    Spawn(group, [&body, begin, end] { body(begin, end); });
+  }
+  Wait(group);
+}
+
+void TaskScheduler::Loop(int self) {
+  currentScheduler = this;
+  currentWorker = self;
+  for (;;) {
+    if (RunOne(self)) continue;
+    unique_lock<mutex> lock(sleepLock);
+    wake.wait(lock, [this] { return stopping || queued > 0; });
+    if (stopping) break;
+  }
+}
+
+bool TaskScheduler::RunOne(int self) {
+  Entry entry;
+  bool found = false, stolen = false;
+  if (self < Threads()) {
+    Worker& own = *workers[self];
+    lock_guard<mutex> lock(own.lock);
+    if (!own.tasks.empty()) {
+      entry = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      found = true;
+    }
+  }
+  for (int i = 1; !found && i <= Threads(); i++) {
+    Worker& victim = *workers[(self + i) % Threads()];
+    lock_guard<mutex> lock(victim.lock);
+    if (!victim.tasks.empty()) {
+      entry = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      found = stolen = true;
+    }
+  }
+  if (!found) return false;
+  queued--;
+
+  uint64_t outer = nestedTime;
+  nestedTime = 0;
+  auto start = chrono::steady_clock::now();
+  entry.task();
+  uint64_t elapsed = chrono::duration_cast<chrono::nanoseconds>(
+                         chrono::steady_clock::now() - start)
+                         .count();
+  Worker& me = *workers[self];
+  me.busy += elapsed - min(elapsed, nestedTime);
+  nestedTime = outer + elapsed;
+  me.run++;
+  if (stolen) me.stolen++;
+  if (--entry.group->pending == 0) {
+    { lock_guard<mutex> lock(sleepLock); }
+    wake.notify_all();
+  }
+  return true;
+}
+
+vector<TaskScheduler::WorkerStats> TaskScheduler::Stats() const {
+  vector<WorkerStats> stats;
+  for (auto& w : workers)
+    stats.push_back(WorkerStats{w->run, w->stolen, w->busy * 1e-9});
+  return stats;
+}
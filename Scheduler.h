@@ -0,0 +1,112 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Work-stealing task scheduler used to balance batches of large
+ *           and small files.
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+#if !defined(__SCHEDULER)
+#define __SCHEDULER
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Tasks waited for together
+class TaskGroup {
+public:
+  TaskGroup() : pending(0) {}
+  TaskGroup(const TaskGroup&) = delete;
+  TaskGroup& operator=(const TaskGroup&) = delete;
+
+private:
+  friend class TaskScheduler;
+  std::atomic<int> pending;
+};
+
+// Each worker thread has its own deque of tasks.  A worker takes the task
+// it spawned last from its own deque, and when that is empty steals the
+// oldest task of another worker, so a task that splits itself into many
+// small ones (e.g. the tables of a big file) spreads over all idle
+// workers.  A thread waiting for a group runs other tasks meanwhile, so
+// tasks may wait for the tasks they spawn.
+class TaskScheduler {
+public:
+  typedef std::function<void()> Task;
+
+  // threads <= 0 uses one thread per CPU
+  explicit TaskScheduler(int threads);
+  ~TaskScheduler();
+  TaskScheduler(const TaskScheduler&) = delete;
+  TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+  int Threads() const { return nThreads; }
+
+  void Spawn(TaskGroup& group, Task task);
+  void Wait(TaskGroup& group);
+
+  // Call body(begin, end) for pieces of about grain items covering [0, n)
+  // and wait for all of them
+  void ParallelFor(size_t n, size_t grain,
+                   const std::function<void(size_t, size_t)>& body);
+
+  // What each worker did; the last entry is for threads that only waited
+  struct WorkerStats {
+    uint64_t run;     // tasks run
+    uint64_t stolen;  // of which taken from another worker
+    double busy;      // seconds running tasks
+  };
+  std::vector<WorkerStats> Stats() const;
+
+private:
+  struct Entry {
+    Task task;
+    TaskGroup* group;
+  };
+  struct Worker {
+    std::mutex lock;
+    std::deque<Entry> tasks;
+    std::atomic<uint64_t> run{0}, stolen{0}, busy{0};  // busy in ns
+  };
+
+  void Loop(int self);
+  // Run one task, own or stolen; false if there was none
+  bool RunOne(int self);
+  int Self() const;
+
+  int nThreads;
+  std::vector<std::unique_ptr<Worker>> workers;  // one more for waiters
+  std::vector<std::thread> pool;
+  std::atomic<int> queued;
+  std::atomic<unsigned> nextWorker;
+  std::mutex sleepLock;
+  std::condition_variable wake;
+  bool stopping;
+};
+
+#endif
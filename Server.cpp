@@ -0,0 +1,471 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Conversion server on a Unix domain socket (--serve) and its
+ *           client (--connect).
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+
+#include "Server.h"
+#include "Trace.h"
+#include "stringformat.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#if !defined(_WIN32)
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// Number of parsed files the server keeps
+static const size_t cacheEntries = 32;
+// Number of request latencies kept for the percentiles
+static const size_t latencySamples = 100000;
+// How often blocked threads check for shutdown (ms)
+static const int pollInterval = 200;
+// Exit code when the server cannot be started or reached
+static const int serverError = 6;
+
+#if defined(_WIN32)
+
+ConvertServer::ConvertServer(const string& path, int n)
+    : socketPath(path), threads(n), listenFd(-1), stopping(false) {}
+ConvertServer::~ConvertServer() {}
+
+int ConvertServer::Run() {
+  cout << "s2spice: --serve is not supported on this platform\n";
+  return serverError;
+}
+
+int ServerRequest(const string& socketPath, const string& request,
+                  ostream& out) {
+  out << "s2spice: --connect is not supported on this platform\n";
+  return serverError;
+}
+
+#else
+
+static volatile sig_atomic_t stopSignal = 0;
+static void OnStopSignal(int) { stopSignal = 1; }
+
+// Reads lines from a socket.  Returns false on end of file, error or, if
+// stop is given, when it becomes true.
+class LineReader {
+public:
+  explicit LineReader(int fd) : fd(fd) {}
+  bool ReadLine(string& line, const atomic<bool>* stop = NULL) {
+    for (;;) {
+      size_t eol = buffer.find('\n');
+      if (eol != string::npos) {
+        line = buffer.substr(0, eol);
+        buffer.erase(0, eol + 1);
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        return true;
+      }
+      if (stop != NULL) {
+        struct pollfd p = {fd, POLLIN, 0};
+        int r = poll(&p, 1, pollInterval);
+        if (*stop) return false;
+        if (r == 0) continue;
+        if (r < 0 && errno == EINTR) continue;
+      }
+      char chunk[4096];
+      ssize_t n = read(fd, chunk, sizeof(chunk));
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      buffer.append(chunk, n);
+    }
+  }
+
+private:
+  int fd;
+  string buffer;
+};
+
+static bool WriteAll(int fd, const string& data) {
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t n = write(fd, data.data() + done, data.size() - done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    done += n;
+  }
+  return true;
+}
+
+static bool MakeAddress(const string& path, struct sockaddr_un& addr) {
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.empty() || path.length() >= sizeof(addr.sun_path)) return false;
+  strcpy(addr.sun_path, path.c_str());
+  return true;
+}
+
+// Messages may span lines; each line becomes one "M" line of the reply
+static void AddMessage(string& reply, const wxString& mess) {
+  istringstream lines(mess.ToStdString());
+  string line;
+  while (getline(lines, line)) reply += "M " + line + "\n";
+}
+
+ConvertServer::ConvertServer(const string& path, int n)
+    : socketPath(path),
+      threads(n),
+      listenFd(-1),
+      stopping(false),
+      hits(0),
+      misses(0),
+      nextLatency(0),
+      requests(0),
+      failed(0) {
+  if (threads <= 0) threads = max(1u, thread::hardware_concurrency());
+}
+
+ConvertServer::~ConvertServer() {
+  if (listenFd >= 0) close(listenFd);
+}
+
+int ConvertServer::Run() {
+  struct sockaddr_un addr;
+  if (!MakeAddress(socketPath, addr)) {
+    cout << "s2spice: bad socket path '" << socketPath << "'\n";
+    return serverError;
+  }
+  // A socket file left by a server that is gone is removed; a live server
+  // is left alone
+  int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (probe >= 0 && connect(probe, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+    close(probe);
+    cout << "s2spice: a server is already running on " << socketPath << "\n";
+    return serverError;
+  }
+  if (probe >= 0) close(probe);
+  unlink(socketPath.c_str());
+
+  listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listenFd < 0 || bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+      listen(listenFd, 64) != 0) {
+    cout << "s2spice: cannot listen on " << socketPath << ": "
+         << strerror(errno) << "\n";
+    return serverError;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, OnStopSignal);
+  signal(SIGTERM, OnStopSignal);
+  stopSignal = 0;
+
+  for (int i = 0; i < threads; i++) pool.emplace_back(&ConvertServer::Worker, this);
+  cout << "s2spice: serving on " << socketPath << " with " << threads
+       << " threads\n"
+       << flush;
+
+  while (!stopSignal) {
+    struct pollfd p = {listenFd, POLLIN, 0};
+    if (poll(&p, 1, pollInterval) <= 0) continue;
+    int fd = accept(listenFd, NULL, NULL);
+    if (fd < 0) continue;
+    lock_guard<mutex> lock(queueLock);
+    connections.push_back(fd);
+    queueReady.notify_one();
+  }
+
+  stopping = true;
+  queueReady.notify_all();
+  for (auto& t : pool) t.join();
+  pool.clear();
+  for (int fd : connections) close(fd);
+  connections.clear();
+  close(listenFd);
+  listenFd = -1;
+  unlink(socketPath.c_str());
+  PrintStats(cout);
+  return 0;
+}
+
+void ConvertServer::Worker() {
+  // Messages of the conversions are collected per request
+  JobLog log;
+  wxLog::SetThreadActiveTarget(&log);
+  for (;;) {
+    int fd;
+    {
+      unique_lock<mutex> lock(queueLock);
+      queueReady.wait(lock, [this] { return stopping || !connections.empty(); });
+      if (stopping) break;
+      fd = connections.front();
+      connections.pop_front();
+    }
+    HandleConnection(fd, log);
+    close(fd);
+  }
+  wxLog::SetThreadActiveTarget(NULL);
+}
+
+void ConvertServer::HandleConnection(int fd, JobLog& log) {
+  LineReader reader(fd);
+  string line;
+  while (reader.ReadLine(line, &stopping)) {
+    if (line.empty()) continue;
+    auto start = chrono::steady_clock::now();
+    log.messages.Clear();
+    string reply;
+    int res = HandleRequest(line, reply);
+    for (size_t i = 0; i < log.messages.GetCount(); i++)
+      AddMessage(reply, log.messages[i]);
+    reply += stringFormat("E %d\n", res);
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() -
+                                                start)
+                    .count();
+    AddLatency(ms, res == 0);
+    if (!WriteAll(fd, reply)) return;
+  }
+}
+
+int ConvertServer::HandleRequest(const string& line, string& reply) {
+  TRACE_SCOPE("request", line);
+  string command, rest;
+  size_t space = line.find(' ');
+  command = line.substr(0, space);
+  if (space != string::npos) rest = line.substr(space + 1);
+
+  if (command == "CONVERT") {
+    space = rest.find(' ');
+    if (space == string::npos) {
+      reply += "M usage: CONVERT <flags> <path>\n";
+      return 1;
+    }
+    return Convert(rest.substr(0, space), rest.substr(space + 1));
+  }
+  if (command == "INFO") return Info(rest, reply);
+  if (command == "STATS") {
+    Stats(reply);
+    return 0;
+  }
+  reply += "M unknown request '" + command + "'\n";
+  return 1;
+}
+
+static bool GetStamp(const string& path, int64_t& size, int64_t& mtime) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) return false;
+  size = st.st_size;
+#if defined(__APPLE__)
+  mtime = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+  mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+  return true;
+}
+
+shared_ptr<ConvertServer::CachedFile> ConvertServer::Load(
+    const string& path, const ConvertOptions& opts, int& res) {
+  res = 0;
+  FileStamp stamp;
+  shared_ptr<CachedFile> file;
+  if (GetStamp(path, stamp.size, stamp.mtime)) {
+    lock_guard<mutex> lock(cacheLock);
+    auto it = cache.find(path);
+    if (it != cache.end() && it->second.file->stamp == stamp) {
+      hits++;
+      lru.splice(lru.begin(), lru, it->second.pos);
+      file = it->second.file;
+    } else {
+      misses++;
+      file = make_shared<CachedFile>();
+      file->stamp = stamp;
+      if (it != cache.end()) {
+        lru.erase(it->second.pos);
+        cache.erase(it);
+      }
+      lru.push_front(path);
+      cache[path] = CacheSlot{file, lru.begin()};
+      while (cache.size() > cacheEntries) {
+        cache.erase(lru.back());
+        lru.pop_back();
+      }
+    }
+  } else {
+    // Not cached; reading it reports the error
+    file = make_shared<CachedFile>();
+  }
+
+  // Requests for the same file wait here until it has been read once
+  lock_guard<mutex> lock(file->lock);
+  if (!file->loaded) {
+    wxFileName fileName(path);
+    file->SD.SetQuiet(false);
+    res = ReadInput(file->SD, fileName, opts);
+    if (res != 0) {
+      Forget(path, file);
+      return NULL;
+    }
+    file->loaded = true;
+  }
+  return file;
+}
+
+void ConvertServer::Forget(const string& path,
+                           const shared_ptr<CachedFile>& file) {
+  lock_guard<mutex> lock(cacheLock);
+  auto it = cache.find(path);
+  if (it == cache.end() || it->second.file != file) return;
+  lru.erase(it->second.pos);
+  cache.erase(it);
+}
+
+int ConvertServer::Convert(const string& flags, const string& path) {
+  ConvertOptions opts;
+  bool force = false;
+  for (char c : flags) {
+    if (c == 'l') opts.lib = true;
+    if (c == 's') opts.asy = true;
+    if (c == 'f') force = true;
+    if (c == 't') opts.stream = true;
+  }
+  opts.stream = opts.stream && opts.lib;
+  wxFileName fileName(path);
+
+  // Streaming never holds the data so there is nothing to cache
+  if (opts.stream) {
+    SObject SD;
+    SD.SetQuiet(false);
+    SD.SetForce(force);
+    return ConvertFile(SD, fileName, opts);
+  }
+
+  int res;
+  shared_ptr<CachedFile> file = Load(path, opts, res);
+  if (!file) return res;
+  lock_guard<mutex> lock(file->lock);
+  file->SD.SetForce(force);
+  return WriteOutputs(file->SD, opts);
+}
+
+int ConvertServer::Info(const string& path, string& reply) {
+  int res;
+  shared_ptr<CachedFile> file = Load(path, ConvertOptions(), res);
+  if (!file) return res;
+  lock_guard<mutex> lock(file->lock);
+  SObject& SD = file->SD;
+  reply += stringFormat("M ports %d\n", SD.nPorts());
+  reply += stringFormat("M frequencies %d\n", SD.nFreq());
+  if (SD.nFreq() > 0) {
+    reply += stringFormat("M first %.9g Hz\n", SD.fBegin());
+    reply += stringFormat("M last %.9g Hz\n", SD.fEnd());
+  }
+  reply += "M lib " + SD.getLIBfile().GetFullPath().ToStdString() + "\n";
+  reply += "M asy " + SD.getASYfile().GetFullPath().ToStdString() + "\n";
+  return 0;
+}
+
+void ConvertServer::AddLatency(double ms, bool ok) {
+  lock_guard<mutex> lock(statsLock);
+  requests++;
+  if (!ok) failed++;
+  if (latencies.size() < latencySamples) {
+    latencies.push_back(ms);
+  } else {
+    latencies[nextLatency] = ms;
+    nextLatency = (nextLatency + 1) % latencySamples;
+  }
+}
+
+void ConvertServer::Stats(string& reply) {
+  ostringstream out;
+  PrintStats(out);
+  istringstream lines(out.str());
+  string line;
+  while (getline(lines, line)) reply += "M " + line + "\n";
+}
+
+void ConvertServer::PrintStats(ostream& out) {
+  vector<double> sorted;
+  uint64_t nRequests, nFailed;
+  {
+    lock_guard<mutex> lock(statsLock);
+    sorted = latencies;
+    nRequests = requests;
+    nFailed = failed;
+  }
+  uint64_t nHits, nMisses;
+  size_t nEntries;
+  {
+    lock_guard<mutex> lock(cacheLock);
+    nHits = hits;
+    nMisses = misses;
+    nEntries = cache.size();
+  }
+  out << stringFormat("requests %llu, failed %llu\n",
+                      (unsigned long long)nRequests,
+                      (unsigned long long)nFailed);
+  out << stringFormat("cache hits %llu, misses %llu, entries %zu of %zu\n",
+                      (unsigned long long)nHits, (unsigned long long)nMisses,
+                      nEntries, cacheEntries);
+  if (sorted.empty()) return;
+  sort(sorted.begin(), sorted.end());
+  auto percentile = [&](double p) {
+    size_t i = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[i];
+  };
+  out << stringFormat(
+      "latency ms: p50 %.3f, p90 %.3f, p99 %.3f, max %.3f (last %zu)\n",
+      percentile(0.5), percentile(0.9), percentile(0.99), sorted.back(),
+      sorted.size());
+}
+
+int ServerRequest(const string& socketPath, const string& request,
+                  ostream& out) {
+  struct sockaddr_un addr;
+  int fd = -1;
+  if (MakeAddress(socketPath, addr)) fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    out << "s2spice: cannot connect to server on " << socketPath << "\n";
+    if (fd >= 0) close(fd);
+    return serverError;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  int res = serverError;
+  if (WriteAll(fd, request + "\n")) {
+    LineReader reader(fd);
+    string line;
+    while (reader.ReadLine(line)) {
+      if (line.compare(0, 2, "M ") == 0) {
+        out << line.substr(2) << "\n";
+      } else if (line.compare(0, 2, "E ") == 0) {
+        res = atoi(line.c_str() + 2);
+        break;
+      }
+    }
+  }
+  close(fd);
+  return res;
+}
+
+#endif
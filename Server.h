@@ -0,0 +1,130 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Conversion server on a Unix domain socket (--serve) and its
+ *           client (--connect).
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+#if !defined(__SERVER)
+#define __SERVER
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#include "Convert.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// The protocol is line based.  A client sends one request per line:
+//
+//   CONVERT <flags> <path>  convert a file; flags is "-" or any of
+//                           l (LIB), s (ASY), f (overwrite), t (stream)
+//   INFO <path>             describe the data of a file
+//   STATS                   request counts, cache use and latencies
+//
+// and the server answers with any number of "M <message>" lines followed
+// by "E <exit code>", using the exit codes of the command line.
+//
+// Parsed files are kept in an LRU cache keyed by path and modification
+// time, so converting a file again (e.g. to write the ASY file after the
+// LIB file) does not read it again.
+class ConvertServer {
+public:
+  // threads <= 0 uses one thread per CPU
+  ConvertServer(const std::string& socketPath, int threads);
+  ~ConvertServer();
+  ConvertServer(const ConvertServer&) = delete;
+  ConvertServer& operator=(const ConvertServer&) = delete;
+
+  // Serve requests until SIGINT or SIGTERM.  Returns 0 or an exit code.
+  int Run();
+
+private:
+  // Size and modification time of a file
+  struct FileStamp {
+    int64_t size = -1;
+    int64_t mtime = 0;  // nanoseconds
+    bool operator==(const FileStamp& s) const {
+      return size == s.size && mtime == s.mtime;
+    }
+  };
+  struct CachedFile {
+    std::mutex lock;  // held while the file is used
+    SObject SD;
+    FileStamp stamp;
+    bool loaded = false;
+  };
+  typedef std::list<std::string> LRUList;
+  struct CacheSlot {
+    std::shared_ptr<CachedFile> file;
+    LRUList::iterator pos;
+  };
+
+  void Worker();
+  void HandleConnection(int fd, JobLog& log);
+  int HandleRequest(const std::string& line, std::string& reply);
+  int Convert(const std::string& flags, const std::string& path);
+  int Info(const std::string& path, std::string& reply);
+  void Stats(std::string& reply);
+  void PrintStats(std::ostream& out);
+
+  // The cached file for path, loaded (with opts) if needed.  Returns NULL
+  // and the exit code in res if it cannot be read.
+  std::shared_ptr<CachedFile> Load(const std::string& path,
+                                   const ConvertOptions& opts, int& res);
+  void Forget(const std::string& path, const std::shared_ptr<CachedFile>& f);
+  void AddLatency(double ms, bool ok);
+
+  std::string socketPath;
+  int threads;
+  int listenFd;
+  std::atomic<bool> stopping;
+  std::vector<std::thread> pool;
+  std::mutex queueLock;
+  std::condition_variable queueReady;
+  std::deque<int> connections;  // accepted, not yet handled
+
+  std::mutex cacheLock;
+  std::unordered_map<std::string, CacheSlot> cache;
+  LRUList lru;  // most recently used first
+  uint64_t hits, misses;
+
+  std::mutex statsLock;
+  std::vector<double> latencies;  // the most recent requests, in ms
+  size_t nextLatency;
+  uint64_t requests, failed;
+};
+
+// Send one request to the server at socketPath, copy its messages to out
+// and return its exit code (6 if the server cannot be reached).
+int ServerRequest(const std::string& socketPath, const std::string& request,
+                  std::ostream& out);
+
+#endif
@@ -0,0 +1,261 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Splitting a batch over several machines (--shard) and checking
+ *           that all of the parts were done (--merge-shards).
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+
+#include "Shard.h"
+#include "stringformat.hpp"
+
+#include <wx/dir.h>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+using namespace std;
+
+// FNV-1a of the normalized path, finished with the mixer of splitmix64 so
+// the low bits used for the shard are well spread
+static uint64_t PathHash(const string& path) {
+  size_t begin = 0;
+  while (path.compare(begin, 2, "./") == 0 ||
+         path.compare(begin, 2, ".\\") == 0)
+    begin += 2;
+  uint64_t h = 14695981039346656037ull;
+  for (size_t i = begin; i < path.size(); i++) {
+    unsigned char c = path[i] == '\\' ? '/' : (unsigned char)path[i];
+    h = (h ^ c) * 1099511628211ull;
+  }
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+  return h ^ (h >> 31);
+}
+
+bool ParseShard(const string& spec, ShardSpec& shard) {
+  istringstream in(spec);
+  char slash = 0;
+  int k, n;
+  if (!(in >> k >> slash >> n) || slash != '/' || n < 1 || k < 1 || k > n ||
+      !(in >> ws).eof())
+    return false;
+  shard.index = k;
+  shard.count = n;
+  return true;
+}
+
+int ShardOf(const string& path, int count) {
+  return (int)(PathHash(path) % (uint64_t)count) + 1;
+}
+
+uint64_t FileListHash(const vector<string>& paths) {
+  uint64_t h = 0;
+  for (auto& path : paths) h += PathHash(path);
+  return h;
+}
+
+string ShardManifestName(const ShardSpec& shard) {
+  return stringFormat("shard-%d-of-%d.txt", shard.index, shard.count);
+}
+
+bool WriteShardManifest(const string& dir, const ShardSpec& shard,
+                        uint64_t listHash, size_t total,
+                        const vector<BatchJob>& jobs) {
+  string name = wxFileName(dir, ShardManifestName(shard)).GetFullPath()
+                    .ToStdString();
+  string part = PartFileName(name);
+  {
+    ofstream out(part);
+    out << stringFormat("S %d/%d %016llx %llu %llu\n", shard.index,
+                        shard.count, (unsigned long long)listHash,
+                        (unsigned long long)jobs.size(),
+                        (unsigned long long)total);
+    for (auto& job : jobs) {
+      out << stringFormat("J %d %.6f %s\n", job.code, job.seconds,
+                          job.file.GetFullPath().ToStdString());
+      // One M line per line of a message, so a message of several lines
+      // does not end the list of jobs
+      for (size_t i = 0; i < job.messages.GetCount(); i++) {
+        istringstream lines(job.messages[i].ToStdString());
+        string line;
+        while (getline(lines, line)) out << "M " << line << "\n";
+      }
+    }
+    out << "E\n";
+    if (!out.flush()) {
+      out.close();
+      wxRemoveFile(part);
+      return false;
+    }
+  }
+  if (!wxRenameFile(part, name)) {
+    wxRemoveFile(part);
+    return false;
+  }
+  return true;
+}
+
+namespace {
+
+struct ManifestJob {
+  int code;
+  double seconds;
+  string path;
+  vector<string> messages;
+};
+
+struct Manifest {
+  string name;
+  ShardSpec shard;
+  uint64_t listHash = 0;
+  size_t files = 0;
+  size_t total = 0;
+  bool complete = false;
+  vector<ManifestJob> jobs;
+};
+
+// Returns false if the file cannot be read or has no valid header
+bool ReadManifest(const string& fileName, Manifest& m) {
+  ifstream in(fileName);
+  string line;
+  if (!getline(in, line)) return false;
+  istringstream header(line);
+  string tag, spec;
+  unsigned long long files, total;
+  if (!(header >> tag >> spec >> hex >> m.listHash >> dec >> files >>
+        total) ||
+      tag != "S" || !ParseShard(spec, m.shard))
+    return false;
+  m.files = files;
+  m.total = total;
+  while (getline(in, line)) {
+    if (line == "E") {
+      m.complete = true;
+      break;
+    }
+    if (line.compare(0, 2, "M ") == 0 && !m.jobs.empty()) {
+      m.jobs.back().messages.push_back(line.substr(2));
+      continue;
+    }
+    istringstream job(line);
+    ManifestJob j;
+    if (!(job >> tag >> j.code >> j.seconds) || tag != "J") return false;
+    getline(job >> ws, j.path);
+    m.jobs.push_back(j);
+  }
+  if (m.jobs.size() != m.files) m.complete = false;
+  return true;
+}
+
+}  // namespace
+
+int MergeShards(const string& dir, const vector<string>* paths,
+                ostream& out) {
+  wxArrayString found;
+  if (wxDirExists(dir))
+    wxDir::GetAllFiles(dir, &found, "shard-*-of-*.txt", wxDIR_FILES);
+  if (found.IsEmpty()) {
+    out << "s2spice: no shard manifests in " << dir << "\n";
+    return 7;
+  }
+
+  // All manifests must be of the batch of the first one
+  map<int, Manifest> shards;
+  bool valid = true;
+  int count = 0;
+  uint64_t listHash = 0;
+  size_t total = 0;
+  for (size_t i = 0; i < found.GetCount(); i++) {
+    Manifest m;
+    m.name = wxFileName(found[i]).GetFullName().ToStdString();
+    if (!ReadManifest(found[i].ToStdString(), m) ||
+        m.name != ShardManifestName(m.shard)) {
+      out << "s2spice: " << m.name << " is not a valid shard manifest\n";
+      valid = false;
+      continue;
+    }
+    if (count == 0) {
+      count = m.shard.count;
+      listHash = m.listHash;
+      total = m.total;
+    } else if (m.shard.count != count || m.listHash != listHash ||
+               m.total != total) {
+      out << "s2spice: " << m.name << " is from a different batch\n";
+      valid = false;
+      continue;
+    }
+    if (!m.complete) {
+      out << "s2spice: " << m.name << " is incomplete\n";
+      valid = false;
+    }
+    int k = m.shard.index;
+    shards[k] = move(m);
+  }
+  if (count == 0) return 7;
+  for (int k = 1; k <= count; k++) {
+    if (shards.count(k) == 0) {
+      out << stringFormat("s2spice: shard %d/%d is missing\n", k, count);
+      valid = false;
+    }
+  }
+
+  // Together the shards must hold every file of the batch exactly once
+  uint64_t seenHash = 0;
+  size_t seen = 0;
+  for (auto& s : shards) {
+    for (auto& job : s.second.jobs) {
+      int k = ShardOf(job.path, count);
+      if (k != s.first) {
+        out << stringFormat("s2spice: %s belongs to shard %d/%d, not %d/%d\n",
+                            job.path, k, count, s.first, count);
+        valid = false;
+      }
+      seenHash += PathHash(job.path);
+      seen++;
+    }
+  }
+  if (valid && (seen != total || seenHash != listHash)) {
+    out << "s2spice: the shards do not add up to the files of the batch\n";
+    valid = false;
+  }
+  if (paths != NULL &&
+      (paths->size() != total || FileListHash(*paths) != listHash)) {
+    out << "s2spice: the shards are of a different list of files\n";
+    valid = false;
+  }
+
+  int res = 0, failed = 0;
+  double seconds = 0;
+  for (auto& s : shards) {
+    for (auto& job : s.second.jobs) {
+      seconds += job.seconds;
+      if (job.code == 0) continue;
+      failed++;
+      if (res == 0) res = job.code;
+      out << stringFormat("%s failed (%d)\n", job.path, job.code);
+      for (auto& message : job.messages) out << "  " << message << "\n";
+    }
+  }
+  out << stringFormat(
+      "merge: %d of %d shards, %d files of %d, %d failed, %.3f s converting\n",
+      (int)shards.size(), count, (int)seen, (int)total, failed, seconds);
+  if (!valid) return 7;
+  return res;
+}
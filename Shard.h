@@ -0,0 +1,76 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Splitting a batch over several machines (--shard) and checking
+ *           that all of the parts were done (--merge-shards).
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+#if !defined(__SHARD)
+#define __SHARD
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#include "Batch.h"
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Shard index of count (1 <= index <= count)
+struct ShardSpec {
+  int index = 0;
+  int count = 0;
+};
+
+// Parse "K/N" (e.g. "3/8") into shard.  Returns false if malformed.
+bool ParseShard(const std::string& spec, ShardSpec& shard);
+
+// The shard (1..count) a file belongs to.  It depends only on the path as
+// given, with '\' taken as '/' and without a leading "./", so every machine
+// assigns a file to the same shard as long as they are given the same
+// relative paths.
+int ShardOf(const std::string& path, int count);
+
+// A hash of a list of files that does not depend on their order
+uint64_t FileListHash(const std::vector<std::string>& paths);
+
+// The result manifest of a shard, e.g. "shard-3-of-8.txt".  It holds one
+// line per job and is written under a temporary name, so it only appears
+// once the shard is complete:
+//
+//   S <index>/<count> <list hash> <files> <total files>
+//   J <exit code> <seconds> <path>     one per file of the shard
+//   M <message line>                   messages of the job above
+//   E
+std::string ShardManifestName(const ShardSpec& shard);
+bool WriteShardManifest(const std::string& dir, const ShardSpec& shard,
+                        uint64_t listHash, size_t total,
+                        const std::vector<BatchJob>& jobs);
+
+// Check that dir holds the complete manifests of all shards of one batch
+// and that together they cover its files exactly once; if paths is given
+// it must be that batch.  Prints the failed files and a summary to out.
+// Returns 0, 7 if shards are missing or do not match, or else the exit
+// code of the first failed file.
+int MergeShards(const std::string& dir, const std::vector<std::string>* paths,
+                std::ostream& out);
+
+#endif
@@ -0,0 +1,76 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ *
+ * Project:  S2spice
+ * Purpose:  S-parameters on a uniform frequency grid from DC, for the
+ *           transforms to the time domain.
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+
+#include "Spectrum.h"
+
+using namespace std;
+
+size_t SpectrumPoints(const vector<Sparam>& data) {
+  size_t n = 2;
+  while (n < 2 * data.size()) n *= 2;
+  return n + 1;
+}
+
+vector<double> SpectrumTaper(size_t points) {
+  vector<double> taper(points);
+  for (size_t k = 0; k < points; k++) {
+    double c = cos(M_PI / 2 * k / (points - 1.0));
+    taper[k] = c * c;
+  }
+  return taper;
+}
+
+static complex<double> At(const Sparam& s, int i, int j) {
+  return polar(pow(10.0, s.dBAt(i, j) / 20), s.phaseAt(i, j) * M_PI / 180);
+}
+
+Spectrum UniformSpectrum(const vector<Sparam>& data, int i, int j,
+                         size_t points) {
+  Spectrum res(points);
+  if (data.empty()) return res;
+  const double fMax = data.back().Freq;
+  // The record at or above each frequency, starting from DC
+  double fPrev = 0;
+  complex<double> sPrev = At(data[0], i, j).real();
+  size_t next = 0;
+  complex<double> sNext = At(data[0], i, j);
+  for (size_t k = 0; k < points; k++) {
+    double f = fMax * k / (points - 1);
+    while (next < data.size() && data[next].Freq < f) {
+      fPrev = data[next].Freq;
+      sPrev = sNext;
+      if (++next < data.size()) sNext = At(data[next], i, j);
+    }
+    if (next == data.size()) {
+      res[k] = sPrev;
+    } else if (data[next].Freq <= fPrev) {
+      res[k] = sNext;
+    } else {
+      double t = (f - fPrev) / (data[next].Freq - fPrev);
+      res[k] = sPrev + t * (sNext - sPrev);
+    }
+  }
+  return res;
+}
@@ -0,0 +1,72 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ *
+ * Project:  S2spice
+ * Purpose:  S-parameters on a uniform frequency grid from DC, for the
+ *           transforms to the time domain.
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+#if !defined(__SPECTRUM)
+#define __SPECTRUM
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#include "SObject.h"
+
+#include <complex>
+#include <vector>
+
+typedef std::vector<std::complex<double>> Spectrum;
+
+// The number of uniform frequencies from DC to the last frequency of data
+// used for its transforms: one more than a power of two, and at least
+// twice the number of records so the grid is not coarser than the data.
+size_t SpectrumPoints(const std::vector<Sparam>& data);
+
+// S_ij of data at points uniform frequencies from DC to the last frequency,
+// interpolated linearly in the real and imaginary parts.  Below the first
+// frequency the data are interpolated towards their real part at DC.
+Spectrum UniformSpectrum(const std::vector<Sparam>& data, int i, int j,
+                         size_t points);
+
+// A squared cosine falling from 1 at DC to 0 at the last of points
+// frequencies.  Tapering a spectrum with it keeps an impulse within a few
+// samples of the time signal.
+std::vector<double> SpectrumTaper(size_t points);
+
+// The real time signal with the positive frequencies half (points values
+// from DC to the Nyquist frequency), 2 * (points - 1) samples long, and
+// back.  Both use fft (an Eigen::FFT), so a thread needs one of its own.
+template <typename FFT>
+std::vector<double> InverseHalfSpectrum(FFT& fft, const Spectrum& half) {
+  fft.SetFlag(FFT::HalfSpectrum);
+  std::vector<double> signal;
+  fft.inv(signal, half, 2 * (half.size() - 1));
+  return signal;
+}
+template <typename FFT>
+Spectrum ForwardHalfSpectrum(FFT& fft, const std::vector<double>& signal) {
+  fft.SetFlag(FFT::HalfSpectrum);
+  Spectrum half;
+  fft.fwd(half, signal);
+  return half;
+}
+
+#endif
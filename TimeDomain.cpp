@@ -0,0 +1,111 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ *
+ * Project:  S2spice
+ * Purpose:  Impulse and step responses (TDR and TDT) of S-parameter data
+ *           (--time-domain).
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+
+#include "TimeDomain.h"
+#include "Scheduler.h"
+#include "Spectrum.h"
+#include "stringformat.hpp"
+
+#include <unsupported/Eigen/FFT>
+#include <cstdint>
+
+using namespace std;
+
+// Steps before t = 0 in the responses
+static const size_t earlySamples = 4;
+
+TimeResponses TimeDomain(const vector<Sparam>& data, int ports,
+                         TaskScheduler* scheduler) {
+  TimeResponses res;
+  res.ports = ports;
+  if (data.size() < 2) return res;
+  const size_t points = SpectrumPoints(data);
+  const vector<double> taper = SpectrumTaper(points);
+  const size_t nPairs = (size_t)ports * ports;
+  res.dt = 1 / (2 * data.back().Freq);
+  res.t0 = -(double)earlySamples * res.dt;
+  res.samples = points - 1 + earlySamples;
+  res.impulse.resize(nPairs);
+  res.step.resize(nPairs);
+  auto body = [&](size_t begin, size_t end) {
+    Eigen::FFT<double> fft;
+    for (size_t p = begin; p < end; p++) {
+      Spectrum s = UniformSpectrum(data, (int)(p / ports), (int)(p % ports),
+                                   points);
+      for (size_t k = 0; k < points; k++) s[k] *= taper[k];
+      vector<double> h = InverseHalfSpectrum(fft, s);
+      res.impulse[p].resize(res.samples);
+      res.step[p].resize(res.samples);
+      // The signal is periodic, so the early steps are at its end
+      double sum = 0;
+      for (size_t n = 0; n < res.samples; n++) {
+        double x = h[(n + h.size() - earlySamples) % h.size()];
+        sum += x;
+        res.impulse[p][n] = (float)x;
+        res.step[p][n] = (float)sum;
+      }
+    }
+  };
+  if (scheduler != NULL)
+    scheduler->ParallelFor(nPairs, 1, body);
+  else
+    body(0, nPairs);
+  return res;
+}
+
+void WriteTimeCSV(ostream& out, const TimeResponses& r, double Z0) {
+  out << "t";
+  for (int i = 0; i < r.ports; i++) {
+    for (int j = 0; j < r.ports; j++)
+      out << stringFormat(",S%d%d impulse,S%d%d step", i + 1, j + 1, i + 1,
+                          j + 1);
+  }
+  for (int i = 0; i < r.ports; i++) out << stringFormat(",Z%d", i + 1);
+  out << "\n";
+  for (size_t n = 0; n < r.samples; n++) {
+    out << stringFormat("%.6e", r.t0 + n * r.dt);
+    for (size_t p = 0; p < r.impulse.size(); p++)
+      out << stringFormat(",%.6e,%.6e", r.impulse[p][n], r.step[p][n]);
+    // The reflected step gives the impedance
+    for (int i = 0; i < r.ports; i++) {
+      double rho = r.step[i * r.ports + i][n];
+      out << stringFormat(",%.6e", Z0 * (1 + rho) / (1 - rho));
+    }
+    out << "\n";
+  }
+}
+
+void WriteTimeBinary(ostream& out, const TimeResponses& r) {
+  out.write("S2SPTD1", 8);
+  uint32_t ports = r.ports, samples = (uint32_t)r.samples;
+  out.write((const char*)&ports, sizeof(ports));
+  out.write((const char*)&samples, sizeof(samples));
+  out.write((const char*)&r.t0, sizeof(r.t0));
+  out.write((const char*)&r.dt, sizeof(r.dt));
+  for (size_t p = 0; p < r.impulse.size(); p++) {
+    out.write((const char*)r.impulse[p].data(), r.samples * sizeof(float));
+    out.write((const char*)r.step[p].data(), r.samples * sizeof(float));
+  }
+}
@@ -0,0 +1,70 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ *
+ * Project:  S2spice
+ * Purpose:  Impulse and step responses (TDR and TDT) of S-parameter data
+ *           (--time-domain).
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+#if !defined(__TIMEDOMAIN)
+#define __TIMEDOMAIN
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#include "SObject.h"
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+class TaskScheduler;
+
+// The impulse and step responses of every S_ij from t0, a few steps of dt
+// before t = 0 because the taper spreads an impulse over a few steps.  The
+// impulse response is per step, so the step response is its running sum
+// and ends at S_ij at DC.
+struct TimeResponses {
+  int ports = 0;
+  double t0 = 0;
+  double dt = 0;
+  size_t samples = 0;
+  std::vector<std::vector<float>> impulse;  // of S_ij at i * ports + j
+  std::vector<std::vector<float>> step;
+};
+
+// Each S_ij of data is resampled on a uniform grid from DC, tapered with
+// SpectrumTaper() and transformed by an inverse FFT.  Pairs are
+// transformed as tasks of scheduler if given.  dt is half a period of the
+// last frequency and the responses last half a period of the grid step.
+TimeResponses TimeDomain(const std::vector<Sparam>& data, int ports,
+                         TaskScheduler* scheduler);
+
+// CSV with a header line: the time, the impulse and step response of each
+// S_ij and, for each port, the impedance seen by the step (TDR) for the
+// reference impedance Z0.
+void WriteTimeCSV(std::ostream& out, const TimeResponses& r, double Z0);
+
+// Binary, in the byte order of the machine (little endian on all supported
+// ones): the 8 bytes "S2SPTD1\0", the ports and samples as uint32, t0 and
+// dt as doubles, then for each S_ij in order the impulse and step
+// responses as samples floats each.
+void WriteTimeBinary(std::ostream& out, const TimeResponses& r);
+
+#endif
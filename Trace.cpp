@@ -0,0 +1,147 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Records begin/end events of the conversion pipeline and writes
+ *           them in Chrome trace format (chrome://tracing, Perfetto).
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+
+#include "Trace.h"
+#include "stringformat.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+struct TraceEvent {
+  const char* name;
+  int64_t ts;      // nanoseconds since the trace was enabled
+  int32_t detail;  // index into TraceBuffer::details or -1
+  char phase;      // 'B' or 'E'
+};
+
+// Events of one thread.  Events are stored in fixed-size blocks so that
+// recording never moves events that are already stored.
+struct TraceBuffer {
+  static const size_t blockSize = 4096;
+  int tid = 0;
+  vector<unique_ptr<TraceEvent[]>> blocks;
+  size_t used = blockSize;  // events in the last block
+  vector<string> details;
+
+  void Add(const char* name, char phase, const string& detail) {
+    if (used == blockSize) {
+      blocks.emplace_back(new TraceEvent[blockSize]);
+      used = 0;
+    }
+    TraceEvent& e = blocks.back()[used++];
+    e.name = name;
+    e.phase = phase;
+    e.detail = -1;
+    if (!detail.empty()) {
+      e.detail = (int32_t)details.size();
+      details.push_back(detail);
+    }
+    e.ts = chrono::duration_cast<chrono::nanoseconds>(
+               chrono::steady_clock::now().time_since_epoch())
+               .count();
+  }
+};
+
+atomic<bool> Trace::enabled{false};
+
+static mutex registryMutex;
+static vector<unique_ptr<TraceBuffer>> registry;
+static thread_local TraceBuffer* localBuffer = nullptr;
+static int64_t epoch = 0;
+
+static TraceBuffer* LocalBuffer() {
+  if (localBuffer == nullptr) {
+    lock_guard<mutex> lock(registryMutex);
+    registry.emplace_back(new TraceBuffer);
+    localBuffer = registry.back().get();
+    localBuffer->tid = (int)registry.size();
+  }
+  return localBuffer;
+}
+
+void Trace::Enable(bool on) {
+  if (on && epoch == 0) {
+    epoch = chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now().time_since_epoch())
+                .count();
+  }
+  enabled.store(on, memory_order_relaxed);
+}
+
+void Trace::Begin(const char* name, const string& detail) {
+  LocalBuffer()->Add(name, 'B', detail);
+}
+
+void Trace::End(const char* name) { LocalBuffer()->Add(name, 'E', string()); }
+
+static string JsonEscape(const string& s) {
+  string res;
+  for (char c : s) {
+    if (c == '"' || c == '\\') res += '\\';
+    if ((unsigned char)c < 0x20) continue;
+    res += c;
+  }
+  return res;
+}
+
+bool Trace::WriteJSON(const string& fileName) {
+  ofstream out(fileName);
+  if (!out) return false;
+  lock_guard<mutex> lock(registryMutex);
+  out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+  const char* sep = "";
+  for (auto& buf : registry) {
+    out << sep
+        << stringFormat(
+               "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+               "\"tid\": %d, \"args\": {\"name\": \"thread %d\"}}",
+               buf->tid, buf->tid);
+    sep = ",\n";
+    for (size_t b = 0; b < buf->blocks.size(); b++) {
+      size_t n = (b + 1 == buf->blocks.size()) ? buf->used
+                                               : TraceBuffer::blockSize;
+      for (size_t i = 0; i < n; i++) {
+        const TraceEvent& e = buf->blocks[b][i];
+        out << sep
+            << stringFormat(
+                   "{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, "
+                   "\"pid\": 1, \"tid\": %d",
+                   e.name, e.phase, (e.ts - epoch) / 1000.0, buf->tid);
+        if (e.detail >= 0) {
+          out << ", \"args\": {\"detail\": \""
+              << JsonEscape(buf->details[e.detail]) << "\"}";
+        }
+        out << "}";
+      }
+    }
+  }
+  out << "\n]}\n";
+  return (bool)out;
+}
@@ -0,0 +1,78 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Records begin/end events of the conversion pipeline and writes
+ *           them in Chrome trace format (chrome://tracing, Perfetto).
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+#if !defined(__TRACE)
+#define __TRACE
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#include <atomic>
+#include <string>
+
+// Every thread appends to its own buffer, so recording an event takes no
+// lock.  A thread's buffer is registered once, on its first event, and is
+// kept until the trace is written.
+class Trace {
+public:
+  static void Enable(bool on);
+  static bool Enabled() { return enabled.load(std::memory_order_relaxed); }
+
+  // name must be a string literal (it is stored by pointer).  detail is
+  // copied and shown as the "detail" argument of the event.
+  static void Begin(const char* name, const std::string& detail = "");
+  static void End(const char* name);
+
+  // Write all events recorded so far.  Call it when the threads that
+  // record events are idle.
+  static bool WriteJSON(const std::string& fileName);
+
+private:
+  static std::atomic<bool> enabled;
+};
+
+// Records a begin event now and the matching end event when it goes out
+// of scope.
+class TraceScope {
+public:
+  explicit TraceScope(const char* n, const std::string& detail = "")
+      : name(n), active(Trace::Enabled()) {
+    if (active) Trace::Begin(name, detail);
+  }
+  ~TraceScope() {
+    if (active) Trace::End(name);
+  }
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+  const char* name;
+  bool active;
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(...) \
+  TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(__VA_ARGS__)
+
+#endif
@@ -0,0 +1,200 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Watch a directory and convert S-parameter files as they are
+ *           written (--watch).
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+
+#include "Watcher.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// How long a file must be left alone before it is converted (ms)
+static const int settleTime = 300;
+// How often the watch loop checks for shutdown (ms)
+static const int pollInterval = 200;
+// Exit code when the directory cannot be watched
+static const int watchError = 6;
+
+DirWatcher::DirWatcher(const string& d, const ConvertOptions& o, int n)
+    : dir(d), opts(o), threads(n), stopping(false), converted(0), failed(0) {
+  if (threads <= 0) threads = max(1u, thread::hardware_concurrency());
+}
+
+#if !defined(__linux__)
+
+int DirWatcher::Run() {
+  cout << "s2spice: --watch is not supported on this platform\n";
+  return watchError;
+}
+
+#else
+
+static volatile sig_atomic_t stopSignal = 0;
+static void OnStopSignal(int) { stopSignal = 1; }
+
+int DirWatcher::Run() {
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0 || inotify_add_watch(fd, dir.c_str(),
+                                  IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO |
+                                      IN_DELETE_SELF | IN_MOVE_SELF) < 0) {
+    cout << "s2spice: cannot watch " << dir << ": " << strerror(errno)
+         << "\n";
+    if (fd >= 0) close(fd);
+    return watchError;
+  }
+
+  signal(SIGINT, OnStopSignal);
+  signal(SIGTERM, OnStopSignal);
+  stopSignal = 0;
+
+  for (int i = 0; i < threads; i++) pool.emplace_back(&DirWatcher::Worker, this);
+  cout << "s2spice: watching " << dir << " with " << threads << " threads\n"
+       << flush;
+
+  int res = 0;
+  alignas(inotify_event) char buffer[16 * 1024];
+  while (!stopSignal) {
+    // Sleep until the next file settles
+    int timeout = pollInterval;
+    Clock::time_point now = Clock::now();
+    for (auto& s : settling) {
+      auto ms = chrono::duration_cast<chrono::milliseconds>(s.second - now);
+      timeout = max(0, min(timeout, (int)ms.count() + 1));
+    }
+    struct pollfd p = {fd, POLLIN, 0};
+    if (poll(&p, 1, timeout) > 0) {
+      ssize_t n;
+      while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (char* e = buffer; e < buffer + n;) {
+          inotify_event* event = (inotify_event*)e;
+          e += sizeof(inotify_event) + event->len;
+          if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+            cout << "s2spice: " << dir << " was removed\n";
+            res = watchError;
+            stopSignal = 1;
+          } else if (event->len > 0 && !(event->mask & IN_ISDIR)) {
+            Changed(dir + "/" + event->name);
+          }
+        }
+      }
+    }
+
+    now = Clock::now();
+    for (auto it = settling.begin(); it != settling.end();) {
+      if (it->second <= now) {
+        Enqueue(it->first);
+        it = settling.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  close(fd);
+
+  // Files already settled are finished, others are dropped
+  {
+    lock_guard<mutex> lock(queueLock);
+    stopping = true;
+    queueReady.notify_all();
+  }
+  for (auto& t : pool) t.join();
+  pool.clear();
+  cout << "s2spice: " << converted << " files converted, " << failed
+       << " failed\n";
+  return res;
+}
+
+#endif
+
+void DirWatcher::Changed(const string& path) {
+  if (!IsTouchstoneFile(wxFileName(path))) return;
+  settling[path] = Clock::now() + chrono::milliseconds(settleTime);
+}
+
+void DirWatcher::Enqueue(const string& path) {
+  lock_guard<mutex> lock(queueLock);
+  if (busy.count(path)) {
+    again.insert(path);
+  } else if (find(queue.begin(), queue.end(), path) == queue.end()) {
+    queue.push_back(path);
+    queueReady.notify_one();
+  }
+}
+
+void DirWatcher::Worker() {
+  JobLog log;
+  wxLog::SetThreadActiveTarget(&log);
+  unique_lock<mutex> lock(queueLock);
+  for (;;) {
+    queueReady.wait(lock, [this] { return stopping || !queue.empty(); });
+    if (queue.empty()) break;
+    string path = queue.front();
+    queue.pop_front();
+    busy.insert(path);
+    lock.unlock();
+    Convert(path, log);
+    lock.lock();
+    busy.erase(path);
+    if (again.erase(path)) {
+      queue.push_back(path);
+      queueReady.notify_one();
+    }
+  }
+  lock.unlock();
+  wxLog::SetThreadActiveTarget(NULL);
+}
+
+void DirWatcher::Convert(const string& path, JobLog& log) {
+  log.messages.Clear();
+  Clock::time_point start = Clock::now();
+  wxFileName fileName(path);
+  SObject SD;
+  SD.SetQuiet(false);
+  SD.SetForce(true);
+  int res = ConvertFile(SD, fileName, opts);
+  double ms = chrono::duration<double, milli>(Clock::now() - start).count();
+
+  lock_guard<mutex> lock(outLock);
+  if (res == 0) {
+    converted++;
+    cout << "s2spice: converted " << fileName.GetFullName() << " in "
+         << (int)(ms + 0.5) << " ms\n";
+  } else {
+    failed++;
+    cout << "s2spice: " << fileName.GetFullName() << " failed (" << res
+         << ")\n";
+    for (size_t i = 0; i < log.messages.GetCount(); i++)
+      cout << "  " << log.messages[i] << "\n";
+  }
+  cout << flush;
+}
@@ -0,0 +1,82 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Watch a directory and convert S-parameter files as they are
+ *           written (--watch).
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+#if !defined(__WATCHER)
+#define __WATCHER
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#include "Convert.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Converts every Touchstone file in a directory that is created, written
+// or moved there, overwriting its LIB and ASY files.  A file is converted
+// once no change has been seen for a short time, so files written in
+// several pieces are only read when complete.  A file that changes while
+// it is converted is converted again afterwards.
+class DirWatcher {
+public:
+  // threads <= 0 uses one thread per CPU
+  DirWatcher(const std::string& dir, const ConvertOptions& opts, int threads);
+  DirWatcher(const DirWatcher&) = delete;
+  DirWatcher& operator=(const DirWatcher&) = delete;
+
+  // Watch until SIGINT or SIGTERM.  Returns 0 or an exit code.
+  int Run();
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  void Changed(const std::string& path);
+  void Enqueue(const std::string& path);
+  void Worker();
+  void Convert(const std::string& path, JobLog& log);
+
+  std::string dir;
+  ConvertOptions opts;
+  int threads;
+  std::map<std::string, Clock::time_point> settling;  // path, when quiet
+
+  std::mutex queueLock;
+  std::condition_variable queueReady;
+  std::deque<std::string> queue;  // settled, not yet converted
+  std::set<std::string> busy;     // being converted
+  std::set<std::string> again;    // changed while being converted
+  bool stopping;
+  std::vector<std::thread> pool;
+
+  std::mutex outLock;  // serializes the report lines
+  int converted, failed;
+};
+
+#endif
@@ -0,0 +1,252 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Writes synthetic Touchstone files for scale and stress testing.
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+
+#include "TouchstoneGen.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#if !defined(M_PI)
+#define M_PI 3.14159265358979323846
+#endif
+
+using namespace std;
+
+// Small self-contained random generator (splitmix64).  The std::
+// distributions are not portable between libraries so they are avoided.
+class GenRandom {
+public:
+  explicit GenRandom(uint64_t seed) : state(seed) {}
+  uint64_t Next() {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+  // Uniform in (0,1)
+  double Uniform() { return ((Next() >> 11) + 0.5) * (1.0 / 9007199254740992.0); }
+  // Standard normal (Box-Muller)
+  double Gauss() {
+    double u1 = Uniform();
+    double u2 = Uniform();
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+  }
+
+private:
+  uint64_t state;
+};
+
+// Format v like printf("%.6e") without the cost of printf.  Returns the
+// number of characters written to p (at most 14).
+static int FormatValue(double v, char* p) {
+  static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+                                 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14,
+                                 1e15, 1e16, 1e17, 1e18, 1e19, 1e20};
+  if (!isfinite(v)) return snprintf(p, 16, "%.6e", v);
+  char* start = p;
+  if (v < 0) {
+    *p++ = '-';
+    v = -v;
+  }
+  int e = 0;
+  long long m = 0;
+  if (v != 0) {
+    e = (int)floor(log10(v));
+    double scale = (e >= -20 && e <= 20)
+                       ? (e >= 0 ? 1.0 / pow10[e] : pow10[-e])
+                       : pow(10.0, -e);
+    m = llround(v * scale * 1e6);
+    if (m >= 10000000) {
+      m /= 10;
+      e++;
+    } else if (m < 1000000) {
+      m *= 10;
+      e--;
+    }
+  }
+  char digits[8];
+  for (int i = 6; i >= 0; i--) {
+    digits[i] = (char)('0' + m % 10);
+    m /= 10;
+  }
+  *p++ = digits[0];
+  *p++ = '.';
+  memcpy(p, digits + 1, 6);
+  p += 6;
+  *p++ = 'e';
+  *p++ = e < 0 ? '-' : '+';
+  int ae = e < 0 ? -e : e;
+  if (ae >= 100) *p++ = (char)('0' + ae / 100);
+  *p++ = (char)('0' + (ae / 10) % 10);
+  *p++ = (char)('0' + ae % 10);
+  return (int)(p - start);
+}
+
+static double UnitScale(const string& units) {
+  if (units == "HZ") return 1;
+  if (units == "KHZ") return 1e3;
+  if (units == "MHZ") return 1e6;
+  if (units == "GHZ") return 1e9;
+  return 0;
+}
+
+string TouchstoneGenExtension(const TouchstoneGenOptions& opt) {
+  if (opt.version >= 2) return "ts";
+  char ext[16];
+  snprintf(ext, sizeof(ext), "%c%dp", tolower(opt.parameter[0]), opt.ports);
+  return ext;
+}
+
+bool WriteTouchstone(ostream& out, const TouchstoneGenOptions& opt) {
+  const int n = opt.ports;
+  const double unitScale = UnitScale(opt.units);
+  if (n < 1 || n > 99 || opt.freqs < 1 || unitScale == 0 ||
+      opt.fStop < opt.fStart || opt.parameter.empty() ||
+      (opt.format != "DB" && opt.format != "MA" && opt.format != "RI") ||
+      (opt.matrix != "Full" && opt.matrix != "Lower" &&
+       opt.matrix != "Upper") ||
+      (opt.matrix != "Full" && opt.version < 2))
+    return false;
+
+  string buf;
+  buf.reserve(1 << 21);
+  auto flush = [&]() {
+    out.write(buf.data(), buf.size());
+    buf.clear();
+  };
+  char tmp[64];
+
+  // Header
+  buf += "! Synthetic Touchstone file written by s2spice_gen\n";
+  snprintf(tmp, sizeof(tmp), "! %d ports, %zu frequencies, seed %llu\n", n,
+           opt.freqs, (unsigned long long)opt.seed);
+  buf += tmp;
+  if (opt.version >= 2) buf += "[Version] 2.0\n";
+  snprintf(tmp, sizeof(tmp), "# %s %s %s R %g\n", opt.units.c_str(),
+           opt.parameter.c_str(), opt.format.c_str(), opt.Z0);
+  buf += tmp;
+  if (opt.version >= 2) {
+    snprintf(tmp, sizeof(tmp), "[Number of Ports] %d\n", n);
+    buf += tmp;
+    if (n == 2) buf += "[Two-Port Data Order] 12_21\n";
+    snprintf(tmp, sizeof(tmp), "[Number of Frequencies] %zu\n", opt.freqs);
+    buf += tmp;
+    if (opt.matrix != "Full") buf += "[Matrix Format] " + opt.matrix + "\n";
+    buf += "[Network Data]\n";
+  }
+
+  // Version 1 2-port files list S11 S21 S12 S22
+  const bool swap = (n == 2 && opt.version < 2);
+  const double tau = 1e-9;  // delay per port spacing
+  GenRandom random(opt.seed);
+
+  // The response only depends on the port for the diagonal and on the port
+  // distance elsewhere, so without noise each frequency needs just 2n
+  // formatted pairs which are then copied into place.
+  vector<string> diagText(n), offText(n);
+  auto formatPair = [&](double mag, double phase, string& text) {
+    phase = remainder(phase, 360.0);
+    double a, b;
+    if (opt.format == "DB") {
+      a = 20.0 * log10(mag);
+      b = phase;
+    } else if (opt.format == "MA") {
+      a = mag;
+      b = phase;
+    } else {
+      a = mag * cos(phase * M_PI / 180.0);
+      b = mag * sin(phase * M_PI / 180.0);
+    }
+    text = ' ';
+    text.append(tmp, FormatValue(a, tmp));
+    text += ' ';
+    text.append(tmp, FormatValue(b, tmp));
+  };
+  vector<double> diagMag(n), diagPhase(n), offMag(n), offPhase(n);
+  string noisy;
+
+  for (size_t k = 0; k < opt.freqs; k++) {
+    double f = opt.fStart;
+    if (opt.freqs > 1)
+      f += (opt.fStop - opt.fStart) * (double)k / (double)(opt.freqs - 1);
+    for (int d = 0; d < n; d++) {
+      diagMag[d] = 0.1 + 0.05 * sin(2.0 * M_PI * (d + 1) * f / opt.fStop);
+      diagPhase[d] = -720.0 * f * tau * (d + 1);
+      if (d > 0) {
+        offMag[d] = 0.8 / d * exp(-f / (4.0 * opt.fStop));
+        offPhase[d] = -360.0 * f * tau * d;
+      }
+      if (opt.noise <= 0) {
+        formatPair(diagMag[d], diagPhase[d], diagText[d]);
+        if (d > 0) formatPair(offMag[d], offPhase[d], offText[d]);
+      }
+    }
+    buf.append(tmp, FormatValue(f / unitScale, tmp));
+
+    int pairsOnLine = 0;
+    for (int r = 0; r < n; r++) {
+      if (opt.wrap == TouchstoneGenOptions::WrapRows && r > 0 && n > 2) {
+        buf += "\n";
+        pairsOnLine = 0;
+      }
+      for (int c = 0; c < n; c++) {
+        // Lower and Upper list only one triangle
+        if ((opt.matrix == "Lower" && c > r) ||
+            (opt.matrix == "Upper" && c < r))
+          continue;
+        int i = swap ? c : r;
+        int j = swap ? r : c;
+        int d = abs(i - j);
+        bool wrapLine = (opt.wrap == TouchstoneGenOptions::WrapPairs) ||
+                        (opt.wrap == TouchstoneGenOptions::WrapRows &&
+                         pairsOnLine == 4);
+        if (wrapLine && (r > 0 || c > 0)) {
+          buf += "\n";
+          pairsOnLine = 0;
+        }
+        if (opt.noise > 0) {
+          double mag = d == 0 ? diagMag[i] : offMag[d];
+          double phase = d == 0 ? diagPhase[i] : offPhase[d];
+          mag *= 1.0 + opt.noise * random.Gauss();
+          if (mag <= 0) mag = 1e-9;
+          phase += 10.0 * opt.noise * random.Gauss();
+          formatPair(mag, phase, noisy);
+          buf += noisy;
+        } else {
+          buf += d == 0 ? diagText[i] : offText[d];
+        }
+        pairsOnLine++;
+      }
+    }
+    buf += "\n";
+    if (buf.size() > (1 << 20)) {
+      flush();
+      if (!out) return false;
+    }
+  }
+  if (opt.version >= 2) buf += "[End]\n";
+  flush();
+  return (bool)out;
+}
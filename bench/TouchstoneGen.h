@@ -0,0 +1,63 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Writes synthetic Touchstone files for scale and stress testing.
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+#if !defined(__TOUCHSTONEGEN)
+#define __TOUCHSTONEGEN
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Description of the file to generate.  The same options always produce
+// the same file.
+struct TouchstoneGenOptions {
+  enum Wrap {
+    WrapRows,    // one matrix row per line, at most 4 pairs per line
+    WrapSingle,  // the whole frequency record on one line
+    WrapPairs    // one value pair per line
+  };
+  int ports = 2;
+  size_t freqs = 401;
+  double fStart = 1e6;  // Hz
+  double fStop = 6e9;   // Hz
+  int version = 1;      // Touchstone version 1 or 2
+  std::string matrix = "Full";  // V2 [Matrix Format]: Full, Lower or Upper
+  std::string format = "DB";   // DB, MA or RI
+  std::string parameter = "S";  // S, Y, Z, H or G
+  std::string units = "MHZ";    // HZ, KHZ, MHZ or GHZ
+  double Z0 = 50;
+  Wrap wrap = WrapRows;
+  double noise = 0;    // relative amplitude of the random noise
+  uint64_t seed = 1;   // seed of the noise generator
+};
+
+// File extension that matches the options (e.g. "s4p" or "ts")
+std::string TouchstoneGenExtension(const TouchstoneGenOptions& opt);
+
+// Write the file.  Returns false if the options are invalid or the
+// stream fails.
+bool WriteTouchstone(std::ostream& out, const TouchstoneGenOptions& opt);
+
+#endif
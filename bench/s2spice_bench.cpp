@@ -0,0 +1,325 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Benchmark program that times each conversion step of SObject
+ *           separately and reports throughput.
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+
+#include <wx/init.h>
+#include <wx/mstream.h>
+#include "SObject.h"
+#include "stringformat.hpp"
+#include "TouchstoneGen.h"
+
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+#include <numeric>
+
+#include "version.h"
+
+// One line of the benchmark report
+struct BenchResult {
+  string file;
+  string phase;
+  size_t iterations;  // number of times the step was executed
+  double median;      // seconds per execution
+  double minimum;
+  double mean;
+  double bytes;  // bytes processed by one execution
+  double freqs;  // frequencies processed by one execution
+};
+
+// Times the SObject conversion steps on one input file.  Every step starts
+// from the same state so the results do not depend on the order of the
+// steps or on how many times they are run.
+class SObjectBench {
+public:
+  SObjectBench(const wxFileName& file, double minTime, const wxString& tmpDir)
+      : snpFile(file), minTime(minTime), tmpDir(tmpDir) {}
+
+  bool Load() {
+    ifstream in(snpFile.GetFullPath().ToStdString(), ios::binary);
+    if (!in) return false;
+    contents.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    obj.SetQuiet(true);
+    obj.SetForce(true);
+    if (!Parse()) return false;
+    if (!obj.ParseOptionsFromHeader() || !obj.ValidateAfterParse())
+      return false;
+    rawData = obj.data_strings;
+    if (!obj.Convert2S()) return false;
+    nFreq = obj.SData.size();
+    return true;
+  }
+
+  void Run(vector<BenchResult>& results) {
+    double inBytes = contents.size();
+
+    results.push_back(Measure(
+        "ParseTouchstone", inBytes, nFreq, [] {}, [this] { Parse(); }, false));
+
+    results.push_back(Measure(
+        "ParseOptionsFromHeader", obj.option_string.length(), 0, [] {},
+        [this] { obj.ParseOptionsFromHeader(); }, true));
+
+    // Convert2S consumes data_strings so it is restored before every run
+    string parameterType = obj.parameterType;
+    results.push_back(Measure(
+        "Convert2S", rawData.size(), nFreq,
+        [&] {
+          obj.data_strings = rawData;
+          obj.parameterType = parameterType;
+          obj.SData.clear();
+        },
+        [this] { obj.Convert2S(); }, false));
+
+    // h2s is timed on every frequency of the file whatever its type
+    vector<MatrixXcd> H;
+    for (auto& s : obj.SData) H.push_back(s.Scplx());
+    results.push_back(Measure(
+        "h2s", 0, nFreq, [] {},
+        [&] {
+          for (auto& h : H) obj.h2s(h, obj.Z0, 1 / obj.Z0);
+        },
+        true));
+
+    // The outputs go to a scratch directory and not next to the input file
+    obj.lib_file = wxFileName(tmpDir, obj.lib_file.GetFullName());
+    obj.asy_file = wxFileName(tmpDir, obj.asy_file.GetFullName());
+    obj.WriteLIB();
+    double libBytes = FileSize(obj.lib_file);
+    results.push_back(Measure(
+        "WriteLIB", libBytes, nFreq, [] {}, [this] { obj.WriteLIB(); }, false));
+    obj.WriteASY();
+    double asyBytes = FileSize(obj.asy_file);
+    results.push_back(Measure(
+        "WriteASY", asyBytes, 0, [] {}, [this] { obj.WriteASY(); }, true));
+    wxRemoveFile(obj.lib_file.GetFullPath());
+    wxRemoveFile(obj.asy_file.GetFullPath());
+  }
+
+private:
+  typedef chrono::steady_clock Clock;
+
+  // Parse the in-memory copy of the file so disk I/O is not timed
+  bool Parse() {
+    obj.Clean();
+    obj.snp_file = snpFile;
+    obj.InitTargetsAndDefaults(snpFile);
+    if (!obj.DeterminePortsAndVersionFromExt()) return false;
+    wxMemoryInputStream input_stream(contents.data(), contents.size());
+    wxTextInputStream text_input(input_stream);
+    return obj.ParseTouchstone(text_input);
+  }
+
+  static double FileSize(const wxFileName& file) {
+    ifstream in(file.GetFullPath().ToStdString(), ios::binary | ios::ate);
+    return in ? (double)in.tellg() : 0;
+  }
+
+  // Run setup() then body() until minTime seconds of body() have been
+  // collected.  Steps that are repeatable and very short are run in
+  // batches so the clock resolution does not dominate.
+  template <typename Setup, typename Body>
+  BenchResult Measure(const string& phase, double bytes, double freqs,
+                      Setup setup, Body body, bool repeatable) {
+    const size_t minIterations = 5;
+    const size_t maxSamples = 10000;
+    size_t batch = 1;
+    setup();
+    auto t0 = Clock::now();
+    body();  // warm up
+    double once = chrono::duration<double>(Clock::now() - t0).count();
+    if (repeatable && once < 1e-4) {
+      batch = (size_t)(1e-3 / max(once, 1e-9)) + 1;
+    }
+
+    vector<double> samples;
+    double total = 0;
+    while ((total < minTime || samples.size() < minIterations) &&
+           samples.size() < maxSamples) {
+      setup();
+      auto start = Clock::now();
+      for (size_t n = 0; n < batch; n++) body();
+      double dt = chrono::duration<double>(Clock::now() - start).count();
+      samples.push_back(dt / batch);
+      total += dt;
+    }
+
+    BenchResult r;
+    r.file = snpFile.GetFullName().ToStdString();
+    r.phase = phase;
+    r.iterations = samples.size() * batch;
+    r.mean = accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+    sort(samples.begin(), samples.end());
+    r.median = samples[samples.size() / 2];
+    r.minimum = samples.front();
+    r.bytes = bytes;
+    r.freqs = freqs;
+    return r;
+  }
+
+  wxFileName snpFile;
+  double minTime;
+  wxString tmpDir;
+  string contents;  // the input file
+  string rawData;   // data_strings as left by ParseTouchstone
+  size_t nFreq = 0;
+  SObject obj;
+};
+
+static string JsonEscape(const string& s) {
+  string res;
+  for (char c : s) {
+    if (c == '"' || c == '\\') res += '\\';
+    res += c;
+  }
+  return res;
+}
+
+static void WriteJSON(ostream& out, const vector<BenchResult>& results) {
+  out << "{\n  \"program\": \"" << versionName << "\",\n";
+  out << "  \"version\": \"" << versionString << "\",\n";
+  out << "  \"benchmarks\": [\n";
+  for (size_t i = 0; i < results.size(); i++) {
+    const BenchResult& r = results[i];
+    double mbs = r.median > 0 ? r.bytes / r.median / 1e6 : 0;
+    double fps = r.median > 0 ? r.freqs / r.median : 0;
+    out << stringFormat(
+        "    {\"file\": \"%s\", \"phase\": \"%s\", \"iterations\": %zu, "
+        "\"median_s\": %.9g, \"min_s\": %.9g, \"mean_s\": %.9g, "
+        "\"bytes\": %.0f, \"frequencies\": %.0f, \"mb_per_s\": %.6g, "
+        "\"freq_per_s\": %.6g}%s\n",
+        JsonEscape(r.file), r.phase, r.iterations, r.median, r.minimum, r.mean,
+        r.bytes, r.freqs, mbs, fps, i + 1 < results.size() ? "," : "");
+  }
+  out << "  ]\n}\n";
+}
+
+static void WriteTable(ostream& out, const vector<BenchResult>& results) {
+  out << stringFormat("%-28s %-24s %10s %12s %10s %12s\n", "file", "phase",
+                      "iter", "median(us)", "MB/s", "freq/s");
+  for (auto& r : results) {
+    double mbs = r.median > 0 ? r.bytes / r.median / 1e6 : 0;
+    double fps = r.median > 0 ? r.freqs / r.median : 0;
+    out << stringFormat("%-28s %-24s %10zu %12.2f %10.2f %12.4g\n", r.file,
+                        r.phase, r.iterations, r.median * 1e6, mbs, fps);
+  }
+}
+
+// Write a synthetic file described by "PORTSxFREQS" (e.g. "16x10000") to
+// the scratch directory and return its name, or an empty string.
+static wxString MakeSynthetic(const string& spec, const wxString& tmpDir) {
+  TouchstoneGenOptions opt;
+  unsigned long long freqs = 0;
+  if (sscanf(spec.c_str(), "%dx%llu", &opt.ports, &freqs) != 2)
+    return wxString();
+  opt.freqs = freqs;
+  wxFileName name(tmpDir, wxString::Format("synth_%dp_%llu.%s", opt.ports,
+                                           freqs,
+                                           TouchstoneGenExtension(opt)));
+  ofstream out(name.GetFullPath().ToStdString(), ios::binary);
+  if (!out || !WriteTouchstone(out, opt)) return wxString();
+  return name.GetFullPath();
+}
+
+static void Usage() {
+  cout << "Usage: s2spice_bench [--json FILE] [--min-time SECONDS] "
+          "[--synthetic PORTSxFREQS] [file name...]\n"
+          "  --json FILE         also write the results as JSON to FILE\n"
+          "  --min-time SECONDS  minimum time spent on each step (default "
+          "0.5)\n"
+          "  --synthetic PxF     also time a generated file with P ports and "
+          "F frequencies\n"
+          "  [file name]         Touchstone files to time (default: the "
+          "files in the Test folder)\n";
+}
+
+int main(int argc, char** argv) {
+  wxInitializer initializer;
+  if (!initializer.IsOk()) {
+    cerr << "Failed to initialize wxWidgets.\n";
+    return 1;
+  }
+
+  string jsonName;
+  double minTime = 0.5;
+  vector<wxString> files;
+  vector<wxString> synthetic;
+  wxString tmpDir = wxFileName::GetTempDir();
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--synthetic" && i + 1 < argc) {
+      wxString name = MakeSynthetic(argv[++i], tmpDir);
+      if (name.IsEmpty()) {
+        cerr << "Cannot generate synthetic file " << argv[i] << "\n";
+        return 1;
+      }
+      synthetic.push_back(name);
+    } else if (arg == "--json" && i + 1 < argc) {
+      jsonName = argv[++i];
+    } else if (arg == "--min-time" && i + 1 < argc) {
+      minTime = atof(argv[++i]);
+    } else if (arg == "-h" || arg == "--help") {
+      Usage();
+      return 0;
+    } else {
+      files.push_back(wxString(argv[i]));
+    }
+  }
+#if defined(S2SPICE_TEST_DIR)
+  if (files.empty() && synthetic.empty()) {
+    const char* defaults[] = {"AD6PS-1+___+25.S7P", "AD6PS-1+___+25.TS",
+                              "AMP-75+_Unit1.s2p", "BBP-20R5+_Plus25degC.s2p",
+                              "BBP-20R5+_Plus25degC.ts"};
+    for (auto f : defaults) {
+      files.push_back(wxFileName(S2SPICE_TEST_DIR, f).GetFullPath());
+    }
+  }
+#endif
+  files.insert(files.end(), synthetic.begin(), synthetic.end());
+  if (files.empty()) {
+    Usage();
+    return 1;
+  }
+
+  vector<BenchResult> results;
+  for (auto& f : files) {
+    SObjectBench bench(wxFileName(f), minTime, tmpDir);
+    if (!bench.Load()) {
+      cerr << "Cannot benchmark file " << f << "\n";
+      return 2;
+    }
+    bench.Run(results);
+  }
+  for (auto& f : synthetic) wxRemoveFile(f);
+
+  WriteTable(cout, results);
+  if (!jsonName.empty()) {
+    ofstream json(jsonName);
+    if (!json) {
+      cerr << "Cannot create file " << jsonName << "\n";
+      return 3;
+    }
+    WriteJSON(json, results);
+  }
+  return 0;
+}
@@ -0,0 +1,114 @@
+/***************************************************************************
+ *  s2spice  Copyright (C) 2023 by Dan Dickey                              *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation, either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License       *
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  *
+ ***************************************************************************
+ *
+ * Project:  S2spice
+ * Purpose:  Command line front end of the synthetic Touchstone generator.
+ * Author:   Dan Dickey
+ *
+ ***************************************************************************/
+
+#include "TouchstoneGen.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+static void Usage() {
+  cout << "Usage: s2spice_gen [options]\n"
+          "  -p, --ports N        number of ports (default 2)\n"
+          "  -n, --freqs N        number of frequencies (default 401)\n"
+          "  --fstart HZ          first frequency in Hz (default 1e6)\n"
+          "  --fstop HZ           last frequency in Hz (default 6e9)\n"
+          "  --v2                 write a Touchstone 2.0 (.ts) file\n"
+          "  --format DB|MA|RI    data format (default DB)\n"
+          "  --matrix Full|Lower|Upper  V2 [Matrix Format] (default Full)\n"
+          "  --type S|Y|Z|H|G     parameter type (default S)\n"
+          "  --units HZ|KHZ|MHZ|GHZ  frequency units (default MHZ)\n"
+          "  --wrap rows|single|pairs  line wrapping (default rows)\n"
+          "  --noise X            relative noise amplitude (default 0)\n"
+          "  --seed N             noise seed (default 1)\n"
+          "  -o, --output FILE    output file (default synth_<ports>p_<freqs>"
+          ".<ext>)\n";
+}
+
+int main(int argc, char** argv) {
+  TouchstoneGenOptions opt;
+  string output;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if ((arg == "-p" || arg == "--ports") && hasValue) {
+      opt.ports = atoi(argv[++i]);
+    } else if ((arg == "-n" || arg == "--freqs") && hasValue) {
+      opt.freqs = strtoull(argv[++i], NULL, 10);
+    } else if (arg == "--fstart" && hasValue) {
+      opt.fStart = atof(argv[++i]);
+    } else if (arg == "--fstop" && hasValue) {
+      opt.fStop = atof(argv[++i]);
+    } else if (arg == "--v2") {
+      opt.version = 2;
+    } else if (arg == "--format" && hasValue) {
+      opt.format = argv[++i];
+    } else if (arg == "--matrix" && hasValue) {
+      opt.matrix = argv[++i];
+    } else if (arg == "--type" && hasValue) {
+      opt.parameter = argv[++i];
+    } else if (arg == "--units" && hasValue) {
+      opt.units = argv[++i];
+    } else if (arg == "--wrap" && hasValue) {
+      string wrap = argv[++i];
+      if (wrap == "rows")
+        opt.wrap = TouchstoneGenOptions::WrapRows;
+      else if (wrap == "single")
+        opt.wrap = TouchstoneGenOptions::WrapSingle;
+      else if (wrap == "pairs")
+        opt.wrap = TouchstoneGenOptions::WrapPairs;
+      else {
+        Usage();
+        return 1;
+      }
+    } else if (arg == "--noise" && hasValue) {
+      opt.noise = atof(argv[++i]);
+    } else if (arg == "--seed" && hasValue) {
+      opt.seed = strtoull(argv[++i], NULL, 10);
+    } else if ((arg == "-o" || arg == "--output") && hasValue) {
+      output = argv[++i];
+    } else {
+      Usage();
+      return arg == "-h" || arg == "--help" ? 0 : 1;
+    }
+  }
+  if (output.empty()) {
+    output = "synth_" + to_string(opt.ports) + "p_" + to_string(opt.freqs) +
+             "." + TouchstoneGenExtension(opt);
+  }
+
+  ofstream out(output, ios::binary);
+  if (!out) {
+    cerr << "Cannot create file " << output << "\n";
+    return 2;
+  }
+  if (!WriteTouchstone(out, opt)) {
+    cerr << "Cannot write file " << output << "\n";
+    return 3;
+  }
+  cout << output << "\n";
+  return 0;
+}
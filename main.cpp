@@ -35,7 +35,30 @@
 #include <wx/event.h>
 #include <wx/config.h>
 #include <wx/display.h>
+#include <wx/thread.h>
+#include <wx/gauge.h>
+#include <wx/stopwatch.h>
+#include <wx/listctrl.h>
+#include <wx/dnd.h>
+#include <wx/dir.h>
+#include <wx/log.h>
+#include <wx/notebook.h>
+#include <wx/choice.h>
 #include "SObject.h"
+#include "Profiler.h"
+#include "Trace.h"
+#include "PlotPanel.h"
+#include "Convert.h"
+#include "Server.h"
+#include "Watcher.h"
+#include "Pipeline.h"
+#include "Batch.h"
+#include "Shard.h"
+#include "JobManifest.h"
+#include "Cascade.h"
+#include "Family.h"
+#include "MonteCarlo.h"
+#include "Scheduler.h"
 
 using namespace std;
 
@@ -48,6 +71,8 @@ using namespace std;
 #include <fstream>
 #include <string>
 #include <utility>
+#include <atomic>
+#include <memory>
 #include <assert.h>
 
 #include "version.h"
@@ -74,9 +99,98 @@ public:
   virtual int OnRun();
 
 private:
+  // Write the Chrome trace requested with --trace (once)
+  void WriteTrace();
+
   SObject SData1;
   bool gui_no_start;
   int retCode;
+  wxString traceFile;
+};
+
+// What the GUI asks the worker thread to do
+enum WorkerJob { JOB_OPEN, JOB_LIB, JOB_ASY };
+
+// IDs of the events sent by the worker threads
+enum {
+  ID_WORKER_PROGRESS = wxID_HIGHEST + 1,
+  ID_WORKER_DONE,
+  ID_BATCH_STARTED,
+  ID_BATCH_DONE,
+  ID_BATCH_EXIT
+};
+
+// Payload of the progress events sent by the worker
+struct WorkerProgress {
+  wxString step;
+  double done;  // fraction of the step that is complete
+  double rate;  // bytes per second in this step
+};
+
+// Payload of the event sent when the worker is finished
+struct WorkerResult {
+  WorkerJob job;
+  bool ok;
+  bool cancelled;
+  double seconds;
+};
+
+// Runs one SObject operation so the GUI stays responsive.  While it runs
+// the frame does not touch the SObject.
+class ConvertWorker : public wxThread {
+public:
+  ConvertWorker(wxEvtHandler* handler, SObject* SD, WorkerJob job,
+                const wxFileName& file)
+      : wxThread(wxTHREAD_JOINABLE),
+        handler(handler),
+        SData(SD),
+        job(job),
+        file(file),
+        cancel(false) {}
+  void Cancel() { cancel = true; }
+
+protected:
+  virtual ExitCode Entry();
+
+private:
+  wxEvtHandler* handler;
+  SObject* SData;
+  WorkerJob job;
+  wxFileName file;
+  std::atomic<bool> cancel;
+};
+
+// Files converted by the GUI queue.  The worker threads take the next file
+// by incrementing next; everything else is set before they start.
+struct BatchQueue {
+  vector<wxFileName> files;
+  ConvertOptions opts;
+  bool force = false;
+  std::atomic<size_t> next{0};
+  std::atomic<bool> cancel{false};
+};
+
+// Payload of the event sent when a queued file is finished
+struct BatchResult {
+  size_t index;
+  int code;  // 0 or the exit code of ConvertFile()
+  bool cancelled;
+  double seconds;
+  wxArrayString messages;
+};
+
+// One thread of the pool converting the queued files
+class BatchWorker : public wxThread {
+public:
+  BatchWorker(wxEvtHandler* handler, BatchQueue* queue)
+      : wxThread(wxTHREAD_JOINABLE), handler(handler), queue(queue) {}
+
+protected:
+  virtual ExitCode Entry();
+
+private:
+  wxEvtHandler* handler;
+  BatchQueue* queue;
 };
 
 // This is the main event handler for the program
@@ -85,10 +199,61 @@ public:
   MyFrame(const wxString& title, SObject* SD, const wxPoint& pos,
           const wxSize& size);
 
+  // Convert these files (folders are searched for Touchstone files) on a
+  // pool of worker threads.  Returns false if nothing was queued.
+  bool QueueFiles(const wxArrayString& names);
+
 private:
   SObject* SData;
   bool debugFlag;
   wxStreamToTextRedirector* debug_redirector;
+  ConvertWorker* worker;
+  wxButton* openButton;
+  wxButton* libButton;
+  wxButton* symButton;
+  wxButton* cancelButton;
+  wxButton* queueButton;
+  wxCheckBox* overwriteBox;
+  wxGauge* gauge;
+  wxNotebook* notebook;
+  PlotPanel* plot;
+  wxChoice* plotChoice;
+  wxListBox* pairList;
+  wxListCtrl* jobList;
+  std::unique_ptr<BatchQueue> batch;
+  vector<BatchWorker*> batchWorkers;
+  size_t batchFinished;   // jobs finished so far
+  size_t batchConverted;  // jobs finished without error
+  size_t batchFailed;
+  size_t batchExited;  // workers that have run out of jobs
+  uint64_t batchBytes;  // input bytes of the finished jobs
+  wxStopWatch batchTimer;
+
+  // Run a job on the worker thread
+  void StartWorker(WorkerJob job, const wxFileName& file);
+  // Cancel a running job and wait until the worker has finished
+  void StopWorker();
+  // Cancel the queue and wait until its workers have finished
+  void StopBatch();
+  void FinishBatch();
+  // Disable the commands while the worker runs
+  void SetBusy(bool busy);
+  // Show the loaded data (if any) in the plot
+  void ShowPlotData();
+  void OnPairSelected();
+
+  // This function is called when the "Cancel" button is clicked
+  void OnCancel(wxCommandEvent& event);
+
+  // This function is called when the "Convert Files" button is clicked
+  void OnQueue(wxCommandEvent& event);
+
+  // These functions receive the events of the worker threads
+  void OnWorkerProgress(wxThreadEvent& event);
+  void OnWorkerDone(wxThreadEvent& event);
+  void OnBatchStarted(wxThreadEvent& event);
+  void OnBatchDone(wxThreadEvent& event);
+  void OnBatchExit(wxThreadEvent& event);
   // This function is called when the "Open" button is clicked
   void OnOpen(wxCommandEvent& event);
 
@@ -118,9 +283,27 @@ private:
     // The ID of the "SYM" button
     ID_MKSYM,
 
+    // The ID of the "Cancel" button
+    ID_CANCEL,
+
+    // The ID of the "Convert Files" button
+    ID_QUEUE,
   };
 };
 
+// Files and folders dropped on the frame are added to the queue
+class QueueDropTarget : public wxFileDropTarget {
+public:
+  explicit QueueDropTarget(MyFrame* frame) : frame(frame) {}
+  virtual bool OnDropFiles(wxCoord x, wxCoord y,
+                           const wxArrayString& names) {
+    return frame->QueueFiles(names);
+  }
+
+private:
+  MyFrame* frame;
+};
+
 // This is the event table for the GUI
 wxBEGIN_EVENT_TABLE(MyFrame, wxFrame)
   EVT_BUTTON(ID_OPEN, MyFrame::OnOpen)
@@ -128,6 +311,13 @@ wxBEGIN_EVENT_TABLE(MyFrame, wxFrame)
   EVT_BUTTON(ID_MKSYM, MyFrame::OnMkASY)
   EVT_BUTTON(ID_CLOSE, MyFrame::OnQuit)
   EVT_BUTTON(wxID_ABOUT, MyFrame::OnAbout)
+  EVT_BUTTON(ID_CANCEL, MyFrame::OnCancel)
+  EVT_BUTTON(ID_QUEUE, MyFrame::OnQueue)
+  EVT_THREAD(ID_WORKER_PROGRESS, MyFrame::OnWorkerProgress)
+  EVT_THREAD(ID_WORKER_DONE, MyFrame::OnWorkerDone)
+  EVT_THREAD(ID_BATCH_STARTED, MyFrame::OnBatchStarted)
+  EVT_THREAD(ID_BATCH_DONE, MyFrame::OnBatchDone)
+  EVT_THREAD(ID_BATCH_EXIT, MyFrame::OnBatchExit)
   EVT_CLOSE(MyFrame::OnClose)
 wxEND_EVENT_TABLE()
 
@@ -145,6 +335,83 @@ static const wxCmdLineEntryDesc g_cmdLineDesc[] = {
      wxCMD_LINE_VAL_NONE, wxCMD_LINE_PARAM_OPTIONAL},
     {wxCMD_LINE_SWITCH, "q", "quiet",
      "disables the GUI (for command line only usage)"},
+    {wxCMD_LINE_SWITCH, "", "stream",
+     "with -l, convert straight to LIB using constant memory",
+     wxCMD_LINE_VAL_NONE, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "reciprocal",
+     "write one LIB table for S_ij and S_ji if they differ by at most TOL",
+     wxCMD_LINE_VAL_DOUBLE, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "prune",
+     "leave out the S_ij that stay below -DB dB at every frequency",
+     wxCMD_LINE_VAL_DOUBLE, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "mixed-mode",
+     "write the LIB model with these modes as ports (e.g. \"D1,3 D2,4 C1,3 "
+     "C2,4\")",
+     wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "causality",
+     "warn about S-parameters that are not causal within TOL (e.g. 0.01)",
+     wxCMD_LINE_VAL_DOUBLE, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "time-domain",
+     "also write the impulse and step responses as csv or bin",
+     wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "terminate",
+     "terminate these ports and model the others (e.g. \"3 5=75 6=open\")",
+     wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_SWITCH, "", "profile",
+     "print time and memory used by each conversion stage",
+     wxCMD_LINE_VAL_NONE, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "profile-json",
+     "write the profile of every file as JSON to this file",
+     wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "trace",
+     "write a Chrome trace of the conversion pipeline to this file on exit",
+     wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "pipeline",
+     "convert the files in read, convert and write stages with R,C,W threads",
+     wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "io-depth",
+     "with --pipeline, keep up to N file reads and writes in flight",
+     wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "serve",
+     "run as a conversion server on this Unix socket until interrupted",
+     wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "connect",
+     "have the server on this Unix socket convert the files",
+     wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "watch",
+     "convert S-parameter files written to this directory until interrupted",
+     wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "threads",
+     "number of worker threads (default one per CPU); with files, convert "
+     "them as one work-stealing batch",
+     wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "shard",
+     "convert only shard K of N of the files (e.g. 3/8) as a batch",
+     wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "shard-dir",
+     "directory for the result manifests of the shards (default .)",
+     wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "merge-shards",
+     "check that all shards in this directory are complete",
+     wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "jobs",
+     "convert the jobs listed in this manifest file (- for stdin)",
+     wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "results",
+     "with --jobs, write the status and time of each job to this file",
+     wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "cascade",
+     "chain the files (inv:name de-embeds name) into this one LIB file",
+     wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "temperature",
+     "write one LIB file interpolating between the files (e.g. 85=amp.s2p)",
+     wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "parameter",
+     "with --temperature, the name of the subcircuit parameter (TEMP)",
+     wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "monte-carlo",
+     "write one LIB file of the mean and spread of the files of units",
+     wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL},
     {wxCMD_LINE_PARAM, "", "", "file name", wxCMD_LINE_VAL_STRING,
      wxCMD_LINE_PARAM_OPTIONAL | wxCMD_LINE_PARAM_MULTIPLE},
 
@@ -176,61 +443,394 @@ bool MyApp::OnCmdLineParsed(wxCmdLineParser& parser) {
   // after handling all the comand line file names
   SData1.SetQuiet(parser.Found(_("q")));
   SData1.SetForce(parser.Found(_("f")));
-  for (int i = 0; i < pCount; i++) {
-    wxFileName SFile(parser.GetParam(i));
-    if (!SData1.readSFile(SFile)) {
-      wxString mess =
-          wxString::Format(_("%s:%d S-parameter file %s could not be read."), __FILE__,
-                           __LINE__, SFile.GetFullPath().c_str());
+
+  ConvertOptions opts;
+  opts.lib = parser.Found(_("l"));
+  opts.asy = parser.Found(_("s"));
+  // Streaming writes the LIB file while reading
+  opts.stream = parser.Found(_("stream")) && opts.lib;
+  parser.Found(_("reciprocal"), &opts.output.reciprocal);
+  parser.Found(_("prune"), &opts.output.prune);
+  parser.Found(_("causality"), &opts.output.causality);
+  wxString modes;
+  if (parser.Found(_("mixed-mode"), &modes))
+    opts.output.mixedMode = modes.ToStdString();
+  wxString timeFormat;
+  if (parser.Found(_("time-domain"), &timeFormat))
+    opts.output.timeDomain = timeFormat.Lower().ToStdString();
+  wxString terminate;
+  if (parser.Found(_("terminate"), &terminate))
+    opts.output.terminate = terminate.ToStdString();
+
+  // Outputs that cannot be made are refused before anything is written
+  string why;
+  retCode = CheckOptions(opts, why);
+  if (retCode != 0) {
+    wxString mess =
+        wxString::Format(_("%s:%d Cannot convert the files: %s."), __FILE__,
+                         __LINE__, wxString(why));
+    HandleMessage(mess, SData1.GetQuiet());
+    return false;
+  }
+
+  if (parser.Found(_("trace"), &traceFile)) Trace::Enable(true);
+
+  // The profile counters are per file, so only the files converted one at a
+  // time at the end have a profile; the other modes warn instead
+  wxString profileJSON;
+  bool profile = parser.Found(_("profile"));
+  if (parser.Found(_("profile-json"), &profileJSON)) profile = true;
+  auto warnNoProfile = [&](const wxString& mode) {
+    if (!profile) return;
+    wxString mess = wxString::Format(_("%s:%d WARNING: no profile with %s."),
+                                     __FILE__, __LINE__, mode);
+    HandleWarning(mess, SData1.GetQuiet());
+  };
+
+  // Neither the server, its client nor the watcher start the GUI
+  wxString socketPath;
+  if (parser.Found(_("serve"), &socketPath)) {
+    warnNoProfile("--serve, which converts the files of its clients");
+    long threads = 0;
+    parser.Found(_("threads"), &threads);
+    ConvertServer server(socketPath.ToStdString(), (int)threads);
+    retCode = server.Run();
+    WriteTrace();
+    if (retCode != 0) return false;
+    gui_no_start = true;
+    return true;
+  }
+  wxString watchDir;
+  if (parser.Found(_("watch"), &watchDir)) {
+    warnNoProfile("--watch, which converts the files as they arrive");
+    long threads = 0;
+    parser.Found(_("threads"), &threads);
+    // Watching is for keeping the library current, so write both by default
+    if (!opts.lib && !opts.asy) opts.lib = opts.asy = true;
+    DirWatcher watcher(watchDir.ToStdString(), opts, (int)threads);
+    retCode = watcher.Run();
+    WriteTrace();
+    if (retCode != 0) return false;
+    gui_no_start = true;
+    return true;
+  }
+  if (parser.Found(_("connect"), &socketPath)) {
+    // The server only takes the flags below, so the options that shape the
+    // model are refused instead of silently dropped
+    static const char* const perFile[] = {"reciprocal", "prune",
+                                          "mixed-mode", "causality",
+                                          "time-domain", "terminate"};
+    for (const char* name : perFile) {
+      if (!parser.Found(name)) continue;
+      wxString mess = wxString::Format(
+          _("%s:%d Cannot convert the files: the server does not take --%s; "
+            "convert them without --connect."),
+          __FILE__, __LINE__, name);
       HandleMessage(mess, SData1.GetQuiet());
-      retCode = 1;
+      retCode = 12;
       return false;
     }
+    warnNoProfile("--connect, as the server converts the files");
+    string flags;
+    if (opts.lib) flags += 'l';
+    if (opts.asy) flags += 's';
+    if (SData1.GetForce()) flags += 'f';
+    if (opts.stream) flags += 't';
+    if (flags.empty()) flags = "-";
+    // Without files just show how the server is doing
+    if (pCount == 0)
+      retCode = ServerRequest(socketPath.ToStdString(), "STATS", cout);
+    for (int i = 0; i < pCount; i++) {
+      // The server has its own working directory
+      wxFileName SFile(parser.GetParam(i));
+      SFile.MakeAbsolute();
+      retCode = ServerRequest(
+          socketPath.ToStdString(),
+          "CONVERT " + flags + " " + SFile.GetFullPath().ToStdString(), cout);
+      if (retCode != 0) break;
+    }
+    WriteTrace();
+    if (retCode != 0) return false;
+    gui_no_start = true;
+    return true;
+  }
 
-    // Should we create the symbol file?
-    if (parser.Found(_("s"))) {
-      if (SData1.getASYfile().Exists() && !SData1.GetForce()) {
-        wxString mess = wxString::Format(
-            _("%s:%d ASY file %s already exists.  Delete it first."), __FILE__,
-            __LINE__, SData1.getASYfile().GetFullPath().c_str());
-        HandleMessage(mess, SData1.GetQuiet());
-        retCode = 2;
-        return false;
-      }
-      if (!SData1.WriteASY()) {
-        wxString mess = wxString::Format(
-            _("%s:%d ASY file %s creation failed."), __FILE__, __LINE__,
-            SData1.getASYfile().GetFullPath().c_str());
-        HandleMessage(mess, SData1.GetQuiet());
-        retCode = 3;
-        return false;
-      }
+  // The files are the stages of one model instead of models of their own
+  wxString cascadeFile;
+  if (parser.Found(_("cascade"), &cascadeFile)) {
+    warnNoProfile("--cascade, which converts the files into one model");
+    vector<CascadeStage> stages;
+    for (int i = 0; i < pCount; i++)
+      stages.push_back(ParseCascadeStage(parser.GetParam(i)));
+    long threads = 0;
+    parser.Found(_("threads"), &threads);
+    TaskScheduler scheduler((int)threads);
+    SData1.SetScheduler(&scheduler);
+    retCode = CascadeFiles(stages, wxFileName(cascadeFile), opts, SData1);
+    SData1.SetScheduler(NULL);
+    WriteTrace();
+    if (retCode != 0) return false;
+    if (SData1.GetQuiet()) gui_no_start = true;
+    return true;
+  }
+
+  // The files are the same part at several temperatures (or values of
+  // another parameter) and make one model
+  wxString familyFile;
+  if (parser.Found(_("temperature"), &familyFile)) {
+    vector<FamilyMember> members(pCount);
+    for (int i = 0; i < pCount; i++) {
+      if (ParseFamilyMember(parser.GetParam(i), members[i])) continue;
+      wxString mess = wxString::Format(
+          _("%s:%d --temperature wants files like 85=amp.s2p or with the "
+            "value in the name, not '%s'."),
+          __FILE__, __LINE__, parser.GetParam(i));
+      HandleMessage(mess, SData1.GetQuiet());
+      retCode = 11;
+      return false;
     }
+    warnNoProfile("--temperature, which converts the files into one model");
+    wxString param = "TEMP";
+    parser.Found(_("parameter"), &param);
+    long threads = 0;
+    parser.Found(_("threads"), &threads);
+    TaskScheduler scheduler((int)threads);
+    SData1.SetScheduler(&scheduler);
+    retCode = FamilyFiles(members, param.ToStdString(),
+                          wxFileName(familyFile), opts, SData1);
+    SData1.SetScheduler(NULL);
+    WriteTrace();
+    if (retCode != 0) return false;
+    if (SData1.GetQuiet()) gui_no_start = true;
+    return true;
+  }
 
-    // Should we create the library file?
-    if (parser.Found(_("l"))) {
-      if (SData1.getLIBfile().Exists() && !SData1.GetForce()) {
-        wxString mess = wxString::Format(
-            _("%s:%d LIB file %s already exists.  Delete it first."), __FILE__,
-            __LINE__, SData1.getLIBfile().GetFullPath().c_str());
+  // The files are units of one part and make one model of their spread
+  wxString spreadFile;
+  if (parser.Found(_("monte-carlo"), &spreadFile)) {
+    warnNoProfile("--monte-carlo, which converts the files into one model");
+    vector<wxFileName> units;
+    for (int i = 0; i < pCount; i++)
+      units.push_back(wxFileName(parser.GetParam(i)));
+    long threads = 0;
+    parser.Found(_("threads"), &threads);
+    TaskScheduler scheduler((int)threads);
+    SData1.SetScheduler(&scheduler);
+    retCode = MonteCarloFiles(units, wxFileName(spreadFile), opts, SData1);
+    SData1.SetScheduler(NULL);
+    WriteTrace();
+    if (retCode != 0) return false;
+    if (SData1.GetQuiet()) gui_no_start = true;
+    return true;
+  }
+
+  // A manifest lists the jobs instead of the command line.  It is read
+  // while the jobs are converted, so it can be of any length.
+  wxString jobsFile;
+  if (parser.Found(_("jobs"), &jobsFile)) {
+    BatchJob defaults;
+    defaults.opts = opts;
+    defaults.force = SData1.GetForce();
+    ifstream manifestFile;
+    istream* manifest = &cin;
+    wxString baseDir;
+    if (jobsFile != "-") {
+      manifestFile.open(jobsFile.ToStdString());
+      if (!manifestFile) {
+        wxString mess = wxString::Format(_("%s:%d Cannot open file '%s'."),
+                                         __FILE__, __LINE__, jobsFile);
         HandleMessage(mess, SData1.GetQuiet());
-        retCode = 4;
+        retCode = 8;
         return false;
       }
-      if (!SData1.WriteLIB()) {
-        wxString mess = wxString::Format(
-            _("%s:%d LIB file %s not created."), __FILE__, __LINE__,
-            SData1.getLIBfile().GetFullPath().c_str());
+      manifest = &manifestFile;
+      baseDir = wxFileName(jobsFile).GetPath();
+    }
+    wxString resultsFile;
+    ofstream results;
+    if (parser.Found(_("results"), &resultsFile)) {
+      results.open(resultsFile.ToStdString());
+      if (!results) {
+        wxString mess = wxString::Format(_("%s:%d Cannot create file '%s'."),
+                                         __FILE__, __LINE__, resultsFile);
         HandleMessage(mess, SData1.GetQuiet());
-        retCode = 5;
+        retCode = 8;
         return false;
       }
     }
+    warnNoProfile("--jobs, which converts the jobs at once");
+    JobManifest jobs(*manifest, defaults, baseDir);
+    long threads = 0;
+    parser.Found(_("threads"), &threads);
+    BalancedBatch batch((int)threads);
+    size_t index = 0;
+    retCode = batch.Stream(
+        [&](BatchJob& job) { return jobs.Next(job); },
+        [&](const BatchJob& job) {
+          if (job.code != 0) BalancedBatch::WriteFailure(cout, job);
+          if (results.is_open()) WriteJobResult(results, ++index, job);
+        });
+    batch.WriteSummary(cout);
+    if (!jobs.Error().empty()) {
+      wxString mess = wxString::Format(_("%s:%d Job manifest %s, %s."),
+                                       __FILE__, __LINE__, jobsFile,
+                                       jobs.Error());
+      HandleMessage(mess, SData1.GetQuiet());
+      retCode = 8;
+    }
+    if (results.is_open() && !results.flush()) {
+      wxString mess = wxString::Format(_("%s:%d Cannot write file '%s'."),
+                                       __FILE__, __LINE__, resultsFile);
+      HandleMessage(mess, SData1.GetQuiet());
+      retCode = 8;
+    }
+    WriteTrace();
+    if (retCode != 0) return false;
+    gui_no_start = true;
+    return true;
   }
+
+  // A shard is a batch too, but also writes its result manifest, which
+  // --merge-shards checks once all shards are done
+  wxString shardSpec, mergeDir;
+  if (parser.Found(_("shard"), &shardSpec) ||
+      parser.Found(_("merge-shards"), &mergeDir)) {
+    vector<string> paths;
+    for (int i = 0; i < pCount; i++) {
+      wxFileName SFile(parser.GetParam(i));
+      paths.push_back(SFile.GetFullPath().ToStdString());
+    }
+    if (!mergeDir.IsEmpty()) {
+      warnNoProfile("--merge-shards, which converts no files");
+      retCode = MergeShards(mergeDir.ToStdString(), pCount > 0 ? &paths : NULL,
+                            cout);
+      if (retCode != 0) return false;
+      gui_no_start = true;
+      return true;
+    }
+    ShardSpec shard;
+    if (!ParseShard(shardSpec.ToStdString(), shard)) {
+      wxString mess = wxString::Format(
+          _("%s:%d --shard wants K/N with 1 <= K <= N like 3/8, not '%s'."),
+          __FILE__, __LINE__, shardSpec);
+      HandleMessage(mess, SData1.GetQuiet());
+      retCode = 7;
+      return false;
+    }
+    warnNoProfile("--shard, which converts the files at once");
+    vector<BatchJob> jobs;
+    for (int i = 0; i < pCount; i++) {
+      if (ShardOf(paths[i], shard.count) != shard.index) continue;
+      jobs.push_back(BatchJob());
+      jobs.back().file = wxFileName(parser.GetParam(i));
+      jobs.back().opts = opts;
+      jobs.back().force = SData1.GetForce();
+    }
+    long threads = 0;
+    parser.Found(_("threads"), &threads);
+    BalancedBatch batch((int)threads);
+    retCode = batch.Run(jobs);
+    batch.WriteReport(cout, jobs);
+    wxString shardDir = ".";
+    parser.Found(_("shard-dir"), &shardDir);
+    if (!WriteShardManifest(shardDir.ToStdString(), shard,
+                            FileListHash(paths), paths.size(), jobs)) {
+      wxString mess = wxString::Format(
+          _("%s:%d Cannot create file '%s'."), __FILE__, __LINE__,
+          wxFileName(shardDir, ShardManifestName(shard)).GetFullPath());
+      HandleMessage(mess, SData1.GetQuiet());
+      retCode = 7;
+    }
+    WriteTrace();
+    if (retCode != 0) return false;
+    gui_no_start = true;
+    return true;
+  }
+
+  Profiler::Enable(profile);
+  vector<ProfileRecord> profiles;
+
+  wxString pipelineSpec;
+  long ioDepth = 0;
+  parser.Found(_("io-depth"), &ioDepth);
+  bool pipelined = parser.Found(_("pipeline"), &pipelineSpec) || ioDepth > 0;
+  if (pipelined && pCount > 0) {
+    PipelineThreads threads;
+    if (!pipelineSpec.IsEmpty() &&
+        !ParsePipelineThreads(pipelineSpec.ToStdString(), threads)) {
+      wxString mess = wxString::Format(
+          _("%s:%d --pipeline wants three thread counts like 2,8,2, not '%s'."),
+          __FILE__, __LINE__, pipelineSpec);
+      HandleMessage(mess, SData1.GetQuiet());
+      retCode = 12;
+      return false;
+    }
+    threads.ioDepth = (int)ioDepth;
+    vector<wxFileName> files;
+    for (int i = 0; i < pCount; i++)
+      files.push_back(wxFileName(parser.GetParam(i)));
+    warnNoProfile("--pipeline or --io-depth, which convert the files at once");
+    Profiler::Enable(false);
+    BatchPipeline pipeline(opts, SData1.GetForce(), threads);
+    retCode = pipeline.Run(files);
+    pipeline.WriteReport(cout);
+    pCount = 0;  // all done
+  }
+
+  long batchThreads = 0;
+  if (parser.Found(_("threads"), &batchThreads) && pCount > 0) {
+    vector<BatchJob> jobs(pCount);
+    for (int i = 0; i < pCount; i++) {
+      jobs[i].file = wxFileName(parser.GetParam(i));
+      jobs[i].opts = opts;
+      jobs[i].force = SData1.GetForce();
+    }
+    warnNoProfile("--threads, which converts the files at once");
+    Profiler::Enable(false);
+    BalancedBatch batch((int)batchThreads);
+    retCode = batch.Run(jobs);
+    batch.WriteReport(cout, jobs);
+    pCount = 0;  // all done
+  }
+
+  for (int i = 0; i < pCount; i++) {
+    wxFileName SFile(parser.GetParam(i));
+    if (profile) Profiler::Reset();
+    retCode = ConvertFile(SData1, SFile, opts);
+    if (profile) {
+      profiles.push_back(
+          Profiler::Snapshot(SFile.GetFullPath().ToStdString(), retCode == 0));
+      Profiler::WriteText(cout, profiles.back());
+    }
+    if (retCode != 0) break;
+  }
+
+  if (!profileJSON.IsEmpty()) {
+    ofstream json(profileJSON.ToStdString());
+    if (json) {
+      Profiler::WriteJSON(json, profiles);
+    } else {
+      wxString mess = wxString::Format(_("%s:%d Cannot create file '%s'."),
+                                       __FILE__, __LINE__, profileJSON);
+      HandleMessage(mess, SData1.GetQuiet());
+    }
+  }
+  if (retCode != 0 || SData1.GetQuiet()) WriteTrace();
+  if (retCode != 0) return false;
   if (SData1.GetQuiet()) gui_no_start = true;
   return true;
 }
 
+void MyApp::WriteTrace() {
+  if (traceFile.IsEmpty()) return;
+  if (!Trace::WriteJSON(traceFile.ToStdString())) {
+    wxString mess = wxString::Format(_("%s:%d Cannot create file '%s'."),
+                                     __FILE__, __LINE__, traceFile);
+    HandleMessage(mess, SData1.GetQuiet());
+  }
+  traceFile.Clear();
+}
+
 bool MyApp::OnInit() {
   // init wxApp parent object
   gui_no_start = false;
@@ -258,6 +858,7 @@ bool MyApp::OnInit() {
 
 int MyApp::OnExit() {
   // clean up
+  WriteTrace();
   return retCode;
 }
 
@@ -271,6 +872,9 @@ MyFrame::MyFrame(const wxString& title, SObject* SD, const wxPoint& pos,
   SData = SD;
   debugFlag = true;
   debug_redirector = NULL;
+  worker = NULL;
+  batchFinished = batchConverted = batchFailed = batchExited = 0;
+  batchBytes = 0;
 #if defined(__WXMSW__)
   SetIcon(wxICON(IDI_ICON1));
 #endif
@@ -279,6 +883,9 @@ MyFrame::MyFrame(const wxString& title, SObject* SD, const wxPoint& pos,
   menuFile->AppendSeparator();
   menuFile->Append(ID_MKLIB, _("&Save LIB...\tCtrl-L"), _("Save Library file"));
   menuFile->Append(ID_MKSYM, _("&Save ASY...\tCtrl-L"), _("Save Symbol file"));
+  menuFile->AppendSeparator();
+  menuFile->Append(ID_QUEUE, _("&Convert Files...\tCtrl-M"),
+                   _("Convert several SnP files to LIB and ASY files"));
   menuFile->Append(wxID_EXIT);
 
   auto menuHelp = DBG_NEW wxMenu();
@@ -289,7 +896,10 @@ MyFrame::MyFrame(const wxString& title, SObject* SD, const wxPoint& pos,
   menuBar->Append(menuHelp, _("&Help"));
   SetMenuBar(menuBar);
 
-  CreateStatusBar();
+  // The second field shows the throughput of a running job
+  CreateStatusBar(2);
+  const int statusWidths[] = {-1, 150};
+  SetStatusWidths(2, statusWidths);
   SetStatusText(
       _("S2spice: Select OPEN to start converting Touchstone files."));
 
@@ -306,6 +916,9 @@ MyFrame::MyFrame(const wxString& title, SObject* SD, const wxPoint& pos,
       case ID_MKLIB:
         OnMkLIB(event);
         break;
+      case ID_QUEUE:
+        OnQueue(event);
+        break;
       case wxID_ABOUT:
         OnAbout(event);
         break;
@@ -323,20 +936,73 @@ MyFrame::MyFrame(const wxString& title, SObject* SD, const wxPoint& pos,
   wxSizer* buttonRowSizer = DBG_NEW wxBoxSizer(wxHORIZONTAL);
 
   // Create the buttons
-  wxButton* openButton = DBG_NEW wxButton(mainPanel, ID_OPEN, _("Open"));
+  openButton = DBG_NEW wxButton(mainPanel, ID_OPEN, _("Open"));
   buttonRowSizer->Add(openButton, 0);
 
-  wxButton* libButton = DBG_NEW wxButton(mainPanel, ID_MKLIB, _("Save LIB"));
+  libButton = DBG_NEW wxButton(mainPanel, ID_MKLIB, _("Save LIB"));
   buttonRowSizer->Add(libButton, 0);
 
-  wxButton* symButton = DBG_NEW wxButton(mainPanel, ID_MKSYM, _("Save SYM"));
+  symButton = DBG_NEW wxButton(mainPanel, ID_MKSYM, _("Save SYM"));
   buttonRowSizer->Add(symButton, 0);
 
+  queueButton = DBG_NEW wxButton(mainPanel, ID_QUEUE, _("Convert Files"));
+  buttonRowSizer->Add(queueButton, 0);
+
+  overwriteBox = DBG_NEW wxCheckBox(mainPanel, wxID_ANY, _("Overwrite"));
+  overwriteBox->SetValue(SData->GetForce());
+  buttonRowSizer->Add(overwriteBox, 0, wxALIGN_CENTER_VERTICAL | wxLEFT, 5);
+
   wxButton* aboutButton =
       DBG_NEW wxButton(mainPanel, wxID_ABOUT, _("About..."));
   buttonRowSizer->Add(aboutButton, 0);
+
+  // Progress of the running job
+  gauge = DBG_NEW wxGauge(mainPanel, wxID_ANY, 1000, wxDefaultPosition,
+                          wxSize(200, -1));
+  buttonRowSizer->Add(gauge, 0, wxALIGN_CENTER_VERTICAL | wxLEFT, 10);
+
+  cancelButton = DBG_NEW wxButton(mainPanel, ID_CANCEL, _("Cancel"));
+  cancelButton->Enable(false);
+  buttonRowSizer->Add(cancelButton, 0);
   frameSizer->Add(buttonRowSizer);
 
+  notebook = DBG_NEW wxNotebook(mainPanel, wxID_ANY);
+
+  // Plot of the loaded data with the port pairs to show on its left
+  wxPanel* plotPage = DBG_NEW wxPanel(notebook);
+  wxBoxSizer* plotSizer = DBG_NEW wxBoxSizer(wxHORIZONTAL);
+  wxBoxSizer* plotControls = DBG_NEW wxBoxSizer(wxVERTICAL);
+  wxString plotChoices[] = {_("Magnitude (dB)"), _("Phase (deg)")};
+  plotChoice = DBG_NEW wxChoice(plotPage, wxID_ANY, wxDefaultPosition,
+                                wxDefaultSize, 2, plotChoices);
+  plotChoice->SetSelection(0);
+  plotControls->Add(plotChoice, 0, wxEXPAND);
+  pairList = DBG_NEW wxListBox(plotPage, wxID_ANY, wxDefaultPosition,
+                               wxSize(90, -1), 0, NULL, wxLB_EXTENDED);
+  plotControls->Add(pairList, 1, wxEXPAND);
+  plotSizer->Add(plotControls, 0, wxEXPAND);
+  plot = DBG_NEW PlotPanel(plotPage);
+  plotSizer->Add(plot, 1, wxEXPAND);
+  plotPage->SetSizer(plotSizer);
+  notebook->AddPage(plotPage, _("Plot"));
+  plotChoice->Bind(wxEVT_CHOICE, [this](wxCommandEvent& event) {
+    plot->SetPhase(plotChoice->GetSelection() == 1);
+  });
+  pairList->Bind(wxEVT_LISTBOX,
+                 [this](wxCommandEvent& event) { OnPairSelected(); });
+
+  // Files of the conversion queue with their status and errors
+  jobList = DBG_NEW wxListCtrl(notebook, wxID_ANY, wxDefaultPosition,
+                               wxSize(-1, 150), wxLC_REPORT | wxLC_SINGLE_SEL);
+  jobList->AppendColumn(_("File"), wxLIST_FORMAT_LEFT, 250);
+  jobList->AppendColumn(_("Status"), wxLIST_FORMAT_LEFT, 80);
+  jobList->AppendColumn(_("Time (s)"), wxLIST_FORMAT_RIGHT, 70);
+  jobList->AppendColumn(_("Messages"), wxLIST_FORMAT_LEFT, 400);
+  notebook->AddPage(jobList, _("Files"));
+  frameSizer->Add(notebook, 2, wxEXPAND);
+  SetDropTarget(DBG_NEW QueueDropTarget(this));
+  ShowPlotData();
+
   wxStaticBox* debugStaticBox =
       DBG_NEW wxStaticBox(mainPanel, wxID_ANY, _("Debug Messages"));
   wxSizer* debugBoxSizer =
@@ -410,6 +1076,9 @@ void MyFrame::OnClose(wxCloseEvent& event) {
       return;
     }
   }
+  // Only once closing is certain, so a vetoed close keeps the work going
+  StopWorker();
+  StopBatch();
   if (debug_redirector != NULL) delete debug_redirector;
   debug_redirector = NULL;
   debugFlag = false;
@@ -418,7 +1087,7 @@ void MyFrame::OnClose(wxCloseEvent& event) {
 
 void MyFrame::OnMkLIB(wxCommandEvent& event) {
   //  wxMessageBox("Make LIB button pressed.");
-  if (SData->nPorts() < 1) {
+  if (SData->nPorts() < 1 || SData->nFreq() < 1) {
     wxString mess = wxString::Format(
         _("%s:%d No data. Please open SnP file first."), __FILE__, __LINE__);
     wxLogError(mess);
@@ -426,48 +1095,221 @@ void MyFrame::OnMkLIB(wxCommandEvent& event) {
     return;
   }
 
-  wxBusyCursor wait;
-  bool res = SData->writeLibFile(this);
-  if (res) {
-    wxString mess =
-        wxString::Format(_("S2spice: Library file %s successfully created."),
-                         SData->getLIBfile().GetFullPath());
-    SetStatusText(mess);
-    cout << mess << "\n";
-  }
+  if (worker != NULL || !SData->confirmLibFile(this)) return;
+  StartWorker(JOB_LIB, SData->getLIBfile());
 }
 
 void MyFrame::OnMkASY(wxCommandEvent& event) {
   //  wxMessageBox("Symbol button pressed.");
-  wxBusyCursor wait;
-  bool res = SData->writeSymFile(this);
-  if (res) {
-    wxString mess(
-        wxString::Format(_("S2spice: Symbol file %s successfully created."),
-                         SData->getASYfile().GetFullPath()));
-    SetStatusText(mess);
+  if (worker != NULL || !SData->confirmSymFile(this)) return;
+  StartWorker(JOB_ASY, SData->getASYfile());
+}
+
+void MyFrame::OnOpen(wxCommandEvent& event) {
+  if (worker != NULL) return;
+  wxFileName fileName;
+  if (!SData->chooseSFile(this, fileName)) return;
+  StartWorker(JOB_OPEN, fileName);
+}
+
+void MyFrame::OnCancel(wxCommandEvent& event) {
+  if (batch) batch->cancel = true;
+  if (worker != NULL) worker->Cancel();
+  if (!batch && worker == NULL) return;
+  cancelButton->Enable(false);
+  SetStatusText(_("S2spice: Cancelling..."));
+}
+
+void MyFrame::StartWorker(WorkerJob job, const wxFileName& file) {
+  // Opening replaces the data the plot is showing
+  if (job == JOB_OPEN) {
+    plot->SetData(NULL);
+    pairList->Clear();
+  }
+  worker = DBG_NEW ConvertWorker(this, SData, job, file);
+  if (worker->Run() != wxTHREAD_NO_ERROR) {
+    delete worker;
+    worker = NULL;
+    wxString mess = wxString::Format(_("%s:%d Cannot start worker thread."),
+                                     __FILE__, __LINE__);
+    wxLogError(mess);
     cout << mess << "\n";
+    return;
   }
+  SetBusy(true);
+  SetStatusText(
+      wxString::Format(_("S2spice: Working on %s..."), file.GetFullName()));
 }
 
-void MyFrame::OnOpen(wxCommandEvent& event) {
+void MyFrame::ShowPlotData() {
+  pairList->Clear();
+  if (SData->nPorts() < 1 || SData->nFreq() < 1) {
+    plot->SetData(NULL);
+    return;
+  }
+  plot->SetData(SData);
+  int ports = SData->nPorts();
+  wxArrayString names;
+  for (int i = 0; i < ports; i++) {
+    for (int j = 0; j < ports; j++) {
+      names.Add(
+          wxString::Format(ports < 10 ? "S%d%d" : "S%d,%d", i + 1, j + 1));
+    }
+  }
+  pairList->Set(names);
+  // Start with the reflection and, if there is one, the transmission
+  pairList->SetSelection(0);
+  if (ports > 1) pairList->SetSelection(ports);
+  OnPairSelected();
+}
+
+void MyFrame::OnPairSelected() {
+  wxArrayInt selections;
+  pairList->GetSelections(selections);
+  int ports = SData->nPorts();
+  vector<pair<int, int>> pairs;
+  for (size_t k = 0; k < selections.GetCount(); k++) {
+    pairs.push_back(make_pair(selections[k] / ports, selections[k] % ports));
+  }
+  plot->SetPairs(pairs);
+}
+
+void MyFrame::StopWorker() {
+  if (worker == NULL) return;
+  worker->Cancel();
+  worker->Wait();
+  delete worker;
+  worker = NULL;
+  SetBusy(false);
+}
+
+void MyFrame::SetBusy(bool busy) {
+  openButton->Enable(!busy);
+  libButton->Enable(!busy);
+  symButton->Enable(!busy);
+  queueButton->Enable(!busy);
+  overwriteBox->Enable(!busy);
+  cancelButton->Enable(busy);
+  wxMenuBar* menuBar = GetMenuBar();
+  menuBar->Enable(ID_OPEN, !busy);
+  menuBar->Enable(ID_MKLIB, !busy);
+  menuBar->Enable(ID_MKSYM, !busy);
+  menuBar->Enable(ID_QUEUE, !busy);
+  gauge->SetValue(0);
+  SetStatusText(wxEmptyString, 1);
+}
+
+void MyFrame::OnWorkerProgress(wxThreadEvent& event) {
+  if (worker == NULL) return;
+  WorkerProgress p = event.GetPayload<WorkerProgress>();
+  gauge->SetValue((int)(p.done * gauge->GetRange()));
+  SetStatusText(
+      wxString::Format(_("S2spice: %s... %.0f%%"), p.step, 100 * p.done));
+  SetStatusText(wxString::Format(_("%.1f MB/s"), p.rate / 1e6), 1);
+}
+
+void MyFrame::OnWorkerDone(wxThreadEvent& event) {
+  // The worker may already have been stopped by OnClose()
+  if (worker == NULL) return;
+  worker->Wait();
+  delete worker;
+  worker = NULL;
+  SetBusy(false);
+
+  WorkerResult r = event.GetPayload<WorkerResult>();
+  if (r.job == JOB_OPEN) ShowPlotData();
   wxString mess;
-  if (SData->openSFile(this)) {
-    mess = wxString::Format(_("S2spice: Data successfully imported from %s."),
-                            SData->getSNPfile().GetFullPath());
-    SetStatusText(mess);
-    cout << mess << "\n";
-    mess = wxString::Format(
-        _("S2spice: First Frequency = %g, Last Frequency = %g."),
-        SData->fBegin(), SData->fEnd());
-    SetStatusText(mess);
-    cout << mess << "\n";
-  } else {
-    mess = wxString::Format(_("S2spice: Data import from %s failed!"),
-                            SData->getSNPfile().GetFullPath());
+  if (r.cancelled) {
+    mess = _("S2spice: Cancelled.  No file was changed.");
+    if (r.job == JOB_OPEN) mess = _("S2spice: Data import cancelled.");
     SetStatusText(mess);
     cout << mess << "\n";
+    return;
   }
+  SetStatusText(wxString::Format(_("%.2f s"), r.seconds), 1);
+  switch (r.job) {
+    case JOB_OPEN:
+      if (r.ok) {
+        mess = wxString::Format(
+            _("S2spice: Data successfully imported from %s."),
+            SData->getSNPfile().GetFullPath());
+        SetStatusText(mess);
+        cout << mess << "\n";
+        mess = wxString::Format(
+            _("S2spice: First Frequency = %g, Last Frequency = %g."),
+            SData->fBegin(), SData->fEnd());
+      } else {
+        mess = wxString::Format(_("S2spice: Data import from %s failed!"),
+                                SData->getSNPfile().GetFullPath());
+      }
+      break;
+    case JOB_LIB:
+      if (!r.ok) return;
+      mess =
+          wxString::Format(_("S2spice: Library file %s successfully created."),
+                           SData->getLIBfile().GetFullPath());
+      break;
+    case JOB_ASY:
+      if (!r.ok) return;
+      mess =
+          wxString::Format(_("S2spice: Symbol file %s successfully created."),
+                           SData->getASYfile().GetFullPath());
+      break;
+  }
+  SetStatusText(mess);
+  cout << mess << "\n";
+}
+
+wxThread::ExitCode ConvertWorker::Entry() {
+  wxStopWatch total;
+  wxStopWatch stepTimer;
+  wxString lastStep;
+  long lastPost = -1000;
+  SData->SetProgress([&](const char* step, double done, uint64_t bytes) {
+    if (lastStep != step) {
+      lastStep = step;
+      stepTimer.Start();
+    }
+    // Limit the events to 10 per second
+    if (total.Time() - lastPost >= 100) {
+      lastPost = total.Time();
+      double seconds = stepTimer.Time() / 1000.0;
+      WorkerProgress p;
+      p.step = lastStep;
+      p.done = done;
+      p.rate = seconds > 0 ? bytes / seconds : 0;
+      wxThreadEvent* ev =
+          DBG_NEW wxThreadEvent(wxEVT_THREAD, ID_WORKER_PROGRESS);
+      ev->SetPayload(p);
+      wxQueueEvent(handler, ev);
+    }
+    return !cancel && !TestDestroy();
+  });
+
+  bool ok = false;
+  switch (job) {
+    case JOB_OPEN:
+      ok = SData->readSFile(file);
+      break;
+    case JOB_LIB:
+      ok = SData->WriteLIB();
+      break;
+    case JOB_ASY:
+      ok = SData->WriteASY();
+      break;
+  }
+  SData->SetProgress(SObject::ProgressFunc());
+
+  WorkerResult r;
+  r.job = job;
+  r.ok = ok;
+  r.cancelled = SData->Cancelled();
+  r.seconds = total.Time() / 1000.0;
+  wxThreadEvent* ev =
+      DBG_NEW wxThreadEvent(wxEVT_THREAD, ID_WORKER_DONE);
+  ev->SetPayload(r);
+  wxQueueEvent(handler, ev);
+  return (ExitCode)0;
 }
 
 void MyFrame::OnAbout(wxCommandEvent& event) {
@@ -490,3 +1332,183 @@ void MyFrame::OnAbout(wxCommandEvent& event) {
       wxString::Format(_("About %s"), versionName), wxOK | wxICON_INFORMATION,
       this);
 }
+
+void MyFrame::OnQueue(wxCommandEvent& event) {
+  if (worker != NULL || batch) return;
+  wxFileDialog openFileDialog(this, _("Convert SnP files"), "", "",
+                              SObject::SFileWildcard(),
+                              wxFD_OPEN | wxFD_FILE_MUST_EXIST | wxFD_MULTIPLE);
+  if (openFileDialog.ShowModal() == wxID_CANCEL) return;
+  wxArrayString names;
+  openFileDialog.GetPaths(names);
+  QueueFiles(names);
+}
+
+bool MyFrame::QueueFiles(const wxArrayString& names) {
+  if (worker != NULL || batch) return false;
+  std::unique_ptr<BatchQueue> queue(DBG_NEW BatchQueue);
+  for (size_t i = 0; i < names.GetCount(); i++) {
+    if (wxDirExists(names[i])) {
+      wxArrayString found;
+      wxDir::GetAllFiles(names[i], &found, wxEmptyString, wxDIR_FILES);
+      found.Sort();
+      for (size_t j = 0; j < found.GetCount(); j++) {
+        wxFileName file(found[j]);
+        if (IsTouchstoneFile(file)) queue->files.push_back(file);
+      }
+    } else {
+      queue->files.push_back(wxFileName(names[i]));
+    }
+  }
+  if (queue->files.empty()) {
+    SetStatusText(_("S2spice: No S-parameter files to convert."));
+    return false;
+  }
+  queue->opts.lib = true;
+  queue->opts.asy = true;
+  queue->force = overwriteBox->GetValue();
+
+  notebook->SetSelection(1);
+  jobList->DeleteAllItems();
+  for (size_t i = 0; i < queue->files.size(); i++) {
+    long row = jobList->InsertItem((long)i, queue->files[i].GetFullPath());
+    jobList->SetItem(row, 1, _("Queued"));
+  }
+  batch = std::move(queue);
+  batchFinished = batchConverted = batchFailed = batchExited = 0;
+  batchBytes = 0;
+  batchTimer.Start();
+
+  size_t nThreads = wxThread::GetCPUCount() > 0 ? wxThread::GetCPUCount() : 1;
+  nThreads = min(nThreads, batch->files.size());
+  for (size_t i = 0; i < nThreads; i++) {
+    BatchWorker* w = DBG_NEW BatchWorker(this, batch.get());
+    if (w->Run() != wxTHREAD_NO_ERROR) {
+      delete w;
+      continue;
+    }
+    batchWorkers.push_back(w);
+  }
+  if (batchWorkers.empty()) {
+    batch.reset();
+    wxString mess = wxString::Format(_("%s:%d Cannot start worker thread."),
+                                     __FILE__, __LINE__);
+    wxLogError(mess);
+    cout << mess << "\n";
+    return false;
+  }
+  SetBusy(true);
+  SetStatusText(
+      wxString::Format(_("S2spice: Converting %d files on %d threads..."),
+                       (int)batch->files.size(), (int)batchWorkers.size()));
+  return true;
+}
+
+void MyFrame::OnBatchStarted(wxThreadEvent& event) {
+  if (!batch) return;
+  jobList->SetItem(event.GetInt(), 1, _("Running"));
+}
+
+void MyFrame::OnBatchDone(wxThreadEvent& event) {
+  if (!batch) return;
+  BatchResult r = event.GetPayload<BatchResult>();
+  wxString status = _("Done");
+  if (r.cancelled) {
+    status = _("Cancelled");
+  } else if (r.code != 0) {
+    status = _("Failed");
+    batchFailed++;
+  } else {
+    batchConverted++;
+  }
+  long row = (long)r.index;
+  jobList->SetItem(row, 1, status);
+  jobList->SetItem(row, 2, wxString::Format("%.2f", r.seconds));
+  jobList->SetItem(row, 3, wxJoin(r.messages, ';', 0));
+  if (r.code != 0 && !r.cancelled) jobList->SetItemTextColour(row, *wxRED);
+
+  batchFinished++;
+  wxULongLong size = batch->files[r.index].GetSize();
+  if (size != wxInvalidSize) batchBytes += size.GetValue();
+  gauge->SetValue(
+      (int)(gauge->GetRange() * batchFinished / batch->files.size()));
+  SetStatusText(wxString::Format(_("S2spice: %d of %d files converted..."),
+                                 (int)batchFinished, (int)batch->files.size()));
+  double seconds = batchTimer.Time() / 1000.0;
+  if (seconds > 0)
+    SetStatusText(wxString::Format(_("%.1f MB/s"), batchBytes / 1e6 / seconds),
+                  1);
+}
+
+void MyFrame::OnBatchExit(wxThreadEvent& event) {
+  if (!batch) return;
+  if (++batchExited == batchWorkers.size()) FinishBatch();
+}
+
+void MyFrame::FinishBatch() {
+  for (auto w : batchWorkers) {
+    w->Wait();
+    delete w;
+  }
+  batchWorkers.clear();
+  bool cancelled = batch->cancel;
+  size_t total = batch->files.size();
+  // Files no worker got to before a cancel
+  for (long row = 0; row < (long)total; row++) {
+    if (jobList->GetItemText(row, 1) == _("Queued"))
+      jobList->SetItem(row, 1, _("Cancelled"));
+  }
+  batch.reset();
+  double seconds = batchTimer.Time() / 1000.0;
+  SetBusy(false);
+  wxString mess = wxString::Format(
+      _("S2spice: %d of %d files converted in %.1f s, %d failed%s."),
+      (int)batchConverted, (int)total, seconds, (int)batchFailed,
+      cancelled ? _(", cancelled") : wxString());
+  SetStatusText(mess);
+  cout << mess << "\n";
+}
+
+void MyFrame::StopBatch() {
+  if (!batch) return;
+  batch->cancel = true;
+  FinishBatch();
+}
+
+wxThread::ExitCode BatchWorker::Entry() {
+  JobLog log;
+  wxLog* oldLog = wxLog::SetThreadActiveTarget(&log);
+  for (;;) {
+    size_t n = queue->next++;
+    if (n >= queue->files.size() || queue->cancel || TestDestroy()) break;
+
+    wxThreadEvent* started =
+        DBG_NEW wxThreadEvent(wxEVT_THREAD, ID_BATCH_STARTED);
+    started->SetInt((int)n);
+    wxQueueEvent(handler, started);
+
+    // Each job has its own SObject; messages go to the job log
+    SObject SD;
+    SD.SetQuiet(false);
+    SD.SetForce(queue->force);
+    SD.SetProgress([this](const char* step, double done, uint64_t bytes) {
+      return !queue->cancel && !TestDestroy();
+    });
+    log.messages.Clear();
+    wxStopWatch timer;
+    wxFileName file = queue->files[n];
+    BatchResult r;
+    r.index = n;
+    r.code = ConvertFile(SD, file, queue->opts);
+    r.cancelled = SD.Cancelled();
+    r.seconds = timer.Time() / 1000.0;
+    r.messages = log.messages;
+
+    wxThreadEvent* done = DBG_NEW wxThreadEvent(wxEVT_THREAD, ID_BATCH_DONE);
+    done->SetPayload(r);
+    wxQueueEvent(handler, done);
+  }
+  wxLog::SetThreadActiveTarget(oldLog);
+  wxQueueEvent(handler, DBG_NEW wxThreadEvent(wxEVT_THREAD, ID_BATCH_EXIT));
+  return (ExitCode)0;
+}
@@ -51,6 +51,16 @@
               )
             )
           )
+          @echo Causal data must pass the causality check
+          "%BIN%" -l -q -f --causality 0.01 RC-delay.s2p > causality.txt
+          findstr /c:"not causal" causality.txt >nul
+          if not errorlevel 1 (
+            type causality.txt
+            @echo RC-delay.s2p is causal but was reported as not causal
+            set FAILED=1
+          )
+          del causality.txt
+          del RC-delay.inc
           if "%FAILED%"=="1" (
             @echo One or more CLI tests failed.
             exit /b 1